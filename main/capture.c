@@ -0,0 +1,165 @@
+#include <inttypes.h>
+#include <stddef.h>
+#include <string.h>
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "capture.h"
+
+/*
+ * Records every notification into a byte ring, in the capture file format
+ * itself, so streaming it is a plain copy.  The ring keeps the newest
+ * records: recording from boot, it holds the moments before a problem is
+ * noticed, which is what a field report needs.
+ *
+ * The host task writes and the console task reads; both only ever move the
+ * tail by whole records, so a reader never sees half a record that the
+ * writer then overwrites.
+ */
+
+#define RING_SIZE CONFIG_DONGLE_CAPTURE_RING_SIZE
+
+static const char *tag = "CAPTURE";
+
+static portMUX_TYPE capture_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static volatile bool enabled = CONFIG_DONGLE_CAPTURE_AT_BOOT;
+
+static uint8_t ring[RING_SIZE];
+static size_t head;
+static size_t tail;
+static size_t used;
+
+static struct capture_stats stats;
+
+static void ring_put(const void *src, size_t len)
+{
+    size_t first = len < RING_SIZE - head ? len : RING_SIZE - head;
+
+    memcpy(&ring[head], src, first);
+    memcpy(ring, (const uint8_t *)src + first, len - first);
+    head = (head + len) % RING_SIZE;
+    used += len;
+}
+
+static void ring_get(size_t at, void *dst, size_t len)
+{
+    size_t first = len < RING_SIZE - at ? len : RING_SIZE - at;
+
+    memcpy(dst, &ring[at], first);
+    memcpy((uint8_t *)dst + first, ring, len - first);
+}
+
+static size_t record_size_at(size_t at)
+{
+    struct capture_record rec;
+
+    ring_get(at, &rec, sizeof rec);
+    return sizeof rec + rec.len;
+}
+
+void capture_set_enabled(bool on)
+{
+    enabled = on;
+    ESP_LOGI(tag, "capture %s", on ? "on" : "off");
+}
+
+bool capture_enabled(void)
+{
+    return enabled;
+}
+
+void capture_on_notify(int64_t now, uint16_t conn_handle, uint16_t attr_handle,
+                       bool indication, const uint8_t *data, uint16_t len)
+{
+    struct capture_record rec = {
+        .timestamp_us = now,
+        .conn_handle = conn_handle,
+        .attr_handle = attr_handle,
+        .flags = indication ? CAPTURE_FLAG_INDICATION : 0,
+    };
+    bool lost = false;
+
+    if (!enabled)
+    {
+        return;
+    }
+
+    if (len > CAPTURE_MAX_LEN)
+    {
+        len = CAPTURE_MAX_LEN;
+        rec.flags |= CAPTURE_FLAG_TRUNCATED;
+        stats.truncated++;
+    }
+    rec.len = len;
+
+    portENTER_CRITICAL(&capture_lock);
+    while (RING_SIZE - used < sizeof rec + len)
+    {
+        size_t oldest = record_size_at(tail);
+
+        tail = (tail + oldest) % RING_SIZE;
+        used -= oldest;
+        stats.lost++;
+        lost = true;
+    }
+
+    /* Mark the gap on the record that now comes first. */
+    if (lost && used > 0)
+    {
+        ring[(tail + offsetof(struct capture_record, flags)) % RING_SIZE] |= CAPTURE_FLAG_LOST;
+    }
+    else if (lost)
+    {
+        rec.flags |= CAPTURE_FLAG_LOST;
+    }
+
+    ring_put(&rec, sizeof rec);
+    ring_put(data, len);
+    stats.records++;
+    portEXIT_CRITICAL(&capture_lock);
+}
+
+void capture_file_header(struct capture_file_header *out)
+{
+    memset(out, 0, sizeof *out);
+    memcpy(out->magic, CAPTURE_MAGIC, sizeof CAPTURE_MAGIC);
+    out->version = CAPTURE_VERSION;
+    out->record_header_len = sizeof(struct capture_record);
+}
+
+size_t capture_read(uint8_t *buffer, size_t size)
+{
+    size_t done = 0;
+
+    portENTER_CRITICAL(&capture_lock);
+    while (used > 0)
+    {
+        size_t n = record_size_at(tail);
+
+        if (done + n > size)
+        {
+            break;
+        }
+
+        ring_get(tail, buffer + done, n);
+        tail = (tail + n) % RING_SIZE;
+        used -= n;
+        done += n;
+    }
+    portEXIT_CRITICAL(&capture_lock);
+
+    return done;
+}
+
+void capture_stats_get(struct capture_stats *out)
+{
+    *out = stats;
+}
+
+void capture_stats_log(void)
+{
+    ESP_LOGI(tag, "%s; records=%" PRIu32 " lost=%" PRIu32 " truncated=%" PRIu32
+                  " buffered=%u of %u B",
+             enabled ? "on" : "off", stats.records, stats.lost, stats.truncated,
+             (unsigned)used, (unsigned)RING_SIZE);
+}
@@ -0,0 +1,100 @@
+#ifndef H_CAPTURE_
+#define H_CAPTURE_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Capture file format.  Everything is little endian and packed.  A file is
+ * one struct capture_file_header followed by records, each a struct
+ * capture_record followed by len bytes of the notification payload exactly
+ * as the device sent it.
+ *
+ * To record one from the console, keep the port open across the command
+ * and the read (closing it ends the stream):
+ *
+ *   stty -F /dev/ttyACM0 raw -echo
+ *   exec 3<>/dev/ttyACM0; printf 'capture stream\r' >&3; cat <&3 > mouse.cap
+ *
+ * The stream starts with what the ring still holds, then follows live.
+ */
+
+#define CAPTURE_MAGIC "BLENCAP"
+#define CAPTURE_VERSION 1
+
+/** Payload bytes kept per notification; longer ones are cut. */
+#define CAPTURE_MAX_LEN 256
+
+struct capture_file_header {
+    /** CAPTURE_MAGIC, NUL terminated. */
+    char magic[8];
+    uint16_t version;
+    /** sizeof(struct capture_record), so readers can skip fields added later. */
+    uint16_t record_header_len;
+    uint32_t reserved;
+} __attribute__((packed));
+
+/** The notification was an indication. */
+#define CAPTURE_FLAG_INDICATION 0x01
+/** Older records were overwritten before this one could be read. */
+#define CAPTURE_FLAG_LOST 0x02
+/** The payload was longer than CAPTURE_MAX_LEN and was cut. */
+#define CAPTURE_FLAG_TRUNCATED 0x04
+
+struct capture_record {
+    /** esp_timer time of BLE_GAP_EVENT_NOTIFY_RX. */
+    uint64_t timestamp_us;
+    uint16_t conn_handle;
+    uint16_t attr_handle;
+    /** Payload bytes following this header. */
+    uint16_t len;
+    uint8_t flags;
+    uint8_t reserved;
+} __attribute__((packed));
+
+struct capture_stats {
+    /** Notifications recorded. */
+    uint32_t records;
+
+    /** Records overwritten before they were read. */
+    uint32_t lost;
+
+    /** Payloads cut to CAPTURE_MAX_LEN. */
+    uint32_t truncated;
+};
+
+/** Starts or stops recording notifications into the ring. */
+void capture_set_enabled(bool enabled);
+bool capture_enabled(void);
+
+/**
+ * BLE_GAP_EVENT_NOTIFY_RX: records the payload if capturing.  When the
+ * ring is full the oldest records make room.
+ */
+void capture_on_notify(int64_t now, uint16_t conn_handle, uint16_t attr_handle,
+                       bool indication, const uint8_t *data, uint16_t len);
+
+/** Writes the file header for a new stream. */
+void capture_file_header(struct capture_file_header *out);
+
+/**
+ * Takes the oldest whole records out of the ring, as many as fit.  size
+ * must hold at least one record of CAPTURE_MAX_LEN.
+ *
+ * @return Bytes written to buffer, 0 if the ring is empty.
+ */
+size_t capture_read(uint8_t *buffer, size_t size);
+
+void capture_stats_get(struct capture_stats *out);
+void capture_stats_log(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
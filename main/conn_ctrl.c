@@ -0,0 +1,426 @@
+#include <string.h>
+#include <inttypes.h>
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "host/ble_hs.h"
+#include "nimble/nimble_port.h"
+#include "phase_lock.h"
+#include "conn_ctrl.h"
+
+/*
+ * Owns every connection parameter update the dongle sends.  While the
+ * mouse reports motion the link runs at the shortest interval with no
+ * peripheral latency; after configurable idle periods it steps down to
+ * longer intervals with peripheral latency so the mouse can sleep through
+ * most connection events.  The first input after idle switches straight
+ * back to the fast set.
+ *
+ * Link health feeds back into the idle stages: with a weak RSSI, or after
+ * the previous connection was lost to a supervision timeout, peripheral
+ * latency stays at zero so missed events can't stack up into another
+ * timeout.
+ */
+
+#define CONN_CTRL_TICK_MS 250
+/* A rejected update isn't asked for again sooner than this. */
+#define CONN_CTRL_RETRY_MS 1000
+
+static const char *tag = "CONN_CTRL";
+
+struct conn_ctrl_params
+{
+    uint16_t itvl;
+    uint16_t latency;
+};
+
+static const struct conn_ctrl_params state_params[CONN_CTRL_STATE_COUNT] = {
+    [CONN_CTRL_FAST] = {CONFIG_DONGLE_CONN_FAST_ITVL, 0},
+    [CONN_CTRL_IDLE] = {CONFIG_DONGLE_CONN_IDLE_ITVL, CONFIG_DONGLE_CONN_IDLE_LATENCY},
+    [CONN_CTRL_SLEEP] = {CONFIG_DONGLE_CONN_SLEEP_ITVL, CONFIG_DONGLE_CONN_SLEEP_LATENCY},
+    [CONN_CTRL_SUSPEND] = {CONFIG_DONGLE_CONN_SUSPEND_ITVL, CONFIG_DONGLE_CONN_SUSPEND_LATENCY},
+};
+
+static const char *const state_names[CONN_CTRL_STATE_COUNT] = {
+    [CONN_CTRL_FAST] = "fast",
+    [CONN_CTRL_IDLE] = "idle",
+    [CONN_CTRL_SLEEP] = "sleep",
+    [CONN_CTRL_SUSPEND] = "suspend",
+};
+
+static struct
+{
+    uint16_t conn_handle;
+
+    /* State whose parameters are live, and the one requested. */
+    enum conn_ctrl_state state;
+    enum conn_ctrl_state req_state;
+    int nudge;
+    int req_nudge;
+    bool update_pending;
+    int64_t update_start_us;
+
+    int64_t last_input_us;
+    int64_t state_since_us;
+    /* First input after idle; 0 while not waking. */
+    int64_t wake_start_us;
+    /* No new request before this; set when the peer rejects one. */
+    int64_t retry_us;
+
+    /* Set by a supervision timeout, cleared once RSSI looks healthy. */
+    bool recovering;
+
+    /* The USB host is suspended; survives reconnects. */
+    bool suspended;
+
+    struct ble_npl_callout tick;
+    bool tick_init;
+} cc = {
+    .conn_handle = BLE_HS_CONN_HANDLE_NONE,
+};
+
+static struct conn_ctrl_stats stats = {
+    .rssi_min = INT8_MAX,
+};
+
+static int request_itvl(enum conn_ctrl_state state, uint16_t itvl, int nudge)
+{
+    struct ble_gap_upd_params params = {
+        .itvl_min = itvl,
+        .itvl_max = itvl,
+        .latency = state_params[state].latency,
+        .supervision_timeout = CONFIG_DONGLE_CONN_SUPERVISION_TIMEOUT,
+        .min_ce_len = 0,
+        .max_ce_len = 0,
+    };
+    int rc;
+
+    if (stats.weak_link)
+    {
+        params.latency = 0;
+    }
+
+    rc = ble_gap_update_params(cc.conn_handle, &params);
+    if (rc != 0)
+    {
+        MODLOG_DFLT(DEBUG, "conn ctrl: update to %s failed; rc=%d\n", state_names[state], rc);
+        stats.updates_rejected++;
+        return rc;
+    }
+
+    cc.req_state = state;
+    cc.req_nudge = nudge;
+    cc.update_pending = true;
+    cc.update_start_us = esp_timer_get_time();
+    return 0;
+}
+
+static int request(enum conn_ctrl_state state)
+{
+    return request_itvl(state, state_params[state].itvl, 0);
+}
+
+static void enter(enum conn_ctrl_state state, int64_t now)
+{
+    stats.time_us[cc.state] += now - cc.state_since_us;
+    cc.state_since_us = now;
+
+    if (state != cc.state)
+    {
+        stats.entered[state]++;
+        ESP_LOGI(tag, "%s -> %s", state_names[cc.state], state_names[state]);
+    }
+
+    cc.state = state;
+    stats.state = state;
+}
+
+static void sample_rssi(void)
+{
+    int8_t rssi;
+
+    if (ble_gap_conn_rssi(cc.conn_handle, &rssi) != 0)
+    {
+        return;
+    }
+
+    stats.rssi = rssi;
+    if (rssi < stats.rssi_min)
+    {
+        stats.rssi_min = rssi;
+    }
+
+    if (rssi >= CONFIG_DONGLE_CONN_RSSI_WEAK)
+    {
+        cc.recovering = false;
+    }
+    stats.weak_link = cc.recovering || rssi < CONFIG_DONGLE_CONN_RSSI_WEAK;
+}
+
+static void on_tick(struct ble_npl_event *ev)
+{
+    int64_t now = esp_timer_get_time();
+    int64_t idle_ms;
+
+    if (cc.conn_handle == BLE_HS_CONN_HANDLE_NONE)
+    {
+        return;
+    }
+
+    sample_rssi();
+
+    if (cc.update_pending || now < cc.retry_us)
+    {
+        /* Nothing to do, or waiting out a rejection. */
+    }
+    else if (cc.wake_start_us != 0 && cc.state != CONN_CTRL_FAST)
+    {
+        request(CONN_CTRL_FAST);
+    }
+    else if (cc.suspended && cc.state != CONN_CTRL_SUSPEND)
+    {
+        request(CONN_CTRL_SUSPEND);
+    }
+    else if (cc.nudge == 0 && !cc.suspended)
+    {
+        idle_ms = (now - cc.last_input_us) / 1000;
+
+        if (cc.state == CONN_CTRL_FAST && idle_ms >= CONFIG_DONGLE_CONN_IDLE_MS)
+        {
+            request(CONN_CTRL_IDLE);
+        }
+        else if (cc.state == CONN_CTRL_IDLE && idle_ms >= CONFIG_DONGLE_CONN_SLEEP_MS)
+        {
+            request(CONN_CTRL_SLEEP);
+        }
+    }
+
+    ble_npl_callout_reset(&cc.tick, ble_npl_time_ms_to_ticks32(CONN_CTRL_TICK_MS));
+}
+
+void conn_ctrl_on_input(uint16_t conn_handle, int64_t now)
+{
+    if (conn_handle != cc.conn_handle)
+    {
+        return;
+    }
+
+    cc.last_input_us = now;
+
+    /* The host can't take input; a press wakes it and resume speeds up. */
+    if (cc.suspended)
+    {
+        return;
+    }
+
+    if (cc.state == CONN_CTRL_FAST && !(cc.update_pending && cc.req_state != CONN_CTRL_FAST))
+    {
+        return;
+    }
+
+    if (cc.wake_start_us == 0)
+    {
+        cc.wake_start_us = now;
+    }
+
+    /* An idle-bound update may still be in flight; the fast request goes
+     * out as soon as it lands.  After a rejection the tick retries. */
+    if (!cc.update_pending && now >= cc.retry_us)
+    {
+        request(CONN_CTRL_FAST);
+    }
+}
+
+void conn_ctrl_on_conn_update(uint16_t conn_handle, int status)
+{
+    struct ble_gap_conn_desc desc;
+    int64_t now = esp_timer_get_time();
+    bool ours;
+    uint32_t took;
+
+    if (conn_handle != cc.conn_handle)
+    {
+        return;
+    }
+
+    ours = cc.update_pending;
+    cc.update_pending = false;
+
+    if (ble_gap_conn_find(conn_handle, &desc) != 0)
+    {
+        return;
+    }
+
+    if (!ours)
+    {
+        stats.updates_by_peer++;
+    }
+    else if (status != 0)
+    {
+        stats.updates_rejected++;
+        cc.retry_us = now + CONN_CTRL_RETRY_MS * 1000LL;
+    }
+    else
+    {
+        took = (uint32_t)(now - cc.update_start_us);
+        stats.update_us_last = took;
+        if (took > stats.update_us_max)
+        {
+            stats.update_us_max = took;
+        }
+
+        enter(cc.req_state, now);
+        cc.nudge = cc.req_nudge;
+
+        if (cc.state == CONN_CTRL_FAST && cc.wake_start_us != 0)
+        {
+            took = (uint32_t)(now - cc.wake_start_us);
+            stats.wake_us_last = took;
+            if (took > stats.wake_us_max)
+            {
+                stats.wake_us_max = took;
+            }
+            cc.wake_start_us = 0;
+        }
+    }
+
+    /* Input that arrived while an idle-bound update was in flight. */
+    if (cc.update_pending || now < cc.retry_us)
+    {
+        /* The tick follows up after a rejection. */
+    }
+    else if (cc.wake_start_us != 0 && cc.state != CONN_CTRL_FAST)
+    {
+        request(CONN_CTRL_FAST);
+    }
+    /* USB suspended while another update was in flight. */
+    else if (cc.suspended && cc.state != CONN_CTRL_SUSPEND)
+    {
+        request(CONN_CTRL_SUSPEND);
+    }
+
+    phase_lock_on_params(conn_handle, &desc, ours && status == 0 ? cc.nudge : 0);
+}
+
+void conn_ctrl_set_suspended(bool suspended)
+{
+    if (suspended == cc.suspended)
+    {
+        return;
+    }
+
+    cc.suspended = suspended;
+    if (cc.conn_handle == BLE_HS_CONN_HANDLE_NONE)
+    {
+        return;
+    }
+
+    if (!suspended)
+    {
+        /* Resume counts as input: measure how long fast takes to land. */
+        cc.last_input_us = esp_timer_get_time();
+        cc.wake_start_us = cc.last_input_us;
+    }
+
+    /* Otherwise conn_ctrl_on_conn_update() follows up. */
+    if (!cc.update_pending)
+    {
+        request(suspended ? CONN_CTRL_SUSPEND : CONN_CTRL_FAST);
+    }
+}
+
+int conn_ctrl_nudge(uint16_t base_itvl, int dir)
+{
+    if (cc.conn_handle == BLE_HS_CONN_HANDLE_NONE ||
+        cc.state != CONN_CTRL_FAST || cc.update_pending)
+    {
+        return BLE_HS_EBUSY;
+    }
+
+    if (base_itvl + dir < BLE_HCI_CONN_ITVL_MIN || base_itvl + dir > BLE_HCI_CONN_ITVL_MAX)
+    {
+        return BLE_HS_EINVAL;
+    }
+
+    return request_itvl(CONN_CTRL_FAST, base_itvl + dir, dir);
+}
+
+bool conn_ctrl_is_fast(void)
+{
+    return cc.state == CONN_CTRL_FAST && !cc.update_pending;
+}
+
+void conn_ctrl_start(uint16_t conn_handle)
+{
+    int64_t now = esp_timer_get_time();
+
+    if (!cc.tick_init)
+    {
+        ble_npl_callout_init(&cc.tick, nimble_port_get_dflt_eventq(), on_tick, NULL);
+        cc.tick_init = true;
+    }
+
+    cc.conn_handle = conn_handle;
+    cc.state = CONN_CTRL_FAST;
+    cc.nudge = 0;
+    cc.update_pending = false;
+    cc.last_input_us = now;
+    cc.state_since_us = now;
+    cc.wake_start_us = 0;
+    cc.retry_us = 0;
+    stats.state = CONN_CTRL_FAST;
+    stats.weak_link = cc.recovering;
+    stats.entered[CONN_CTRL_FAST]++;
+
+    /* Don't wait for the peer's preferred parameters. */
+    request(cc.suspended ? CONN_CTRL_SUSPEND : CONN_CTRL_FAST);
+
+    ble_npl_callout_reset(&cc.tick, ble_npl_time_ms_to_ticks32(CONN_CTRL_TICK_MS));
+}
+
+void conn_ctrl_stop(uint16_t conn_handle, int reason)
+{
+    if (conn_handle != cc.conn_handle)
+    {
+        return;
+    }
+
+    enter(cc.state, esp_timer_get_time());
+    ble_npl_callout_stop(&cc.tick);
+    cc.conn_handle = BLE_HS_CONN_HANDLE_NONE;
+
+    stats.disconnects++;
+    stats.last_disconnect_reason = reason;
+    if (reason == BLE_HS_HCI_ERR(BLE_ERR_CONN_SPVN_TMO))
+    {
+        stats.supervision_timeouts++;
+        cc.recovering = true;
+    }
+}
+
+void conn_ctrl_stats_get(struct conn_ctrl_stats *out)
+{
+    *out = stats;
+}
+
+void conn_ctrl_stats_log(void)
+{
+    struct conn_ctrl_stats s;
+
+    conn_ctrl_stats_get(&s);
+
+    ESP_LOGI(tag, "state=%s entered fast/idle/sleep/suspend=%" PRIu32 "/%" PRIu32 "/%" PRIu32
+                  "/%" PRIu32 " time=%" PRIu64 "/%" PRIu64 "/%" PRIu64 "/%" PRIu64 "ms",
+             state_names[s.state],
+             s.entered[CONN_CTRL_FAST], s.entered[CONN_CTRL_IDLE], s.entered[CONN_CTRL_SLEEP],
+             s.entered[CONN_CTRL_SUSPEND],
+             s.time_us[CONN_CTRL_FAST] / 1000, s.time_us[CONN_CTRL_IDLE] / 1000,
+             s.time_us[CONN_CTRL_SLEEP] / 1000, s.time_us[CONN_CTRL_SUSPEND] / 1000);
+    ESP_LOGI(tag, "update last/max=%" PRIu32 "/%" PRIu32 "us wake last/max=%" PRIu32 "/%" PRIu32
+                  "us rejected=%" PRIu32 " by_peer=%" PRIu32,
+             s.update_us_last, s.update_us_max, s.wake_us_last, s.wake_us_max,
+             s.updates_rejected, s.updates_by_peer);
+    ESP_LOGI(tag, "rssi=%d min=%d weak=%d disconnects=%" PRIu32 " spvn_tmo=%" PRIu32
+                  " last_reason=0x%x",
+             s.rssi, s.rssi_min, s.weak_link, s.disconnects, s.supervision_timeouts,
+             s.last_disconnect_reason);
+}
@@ -0,0 +1,90 @@
+#ifndef H_CONN_CTRL_
+#define H_CONN_CTRL_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+enum conn_ctrl_state {
+    /** Mouse in use: shortest interval, no peripheral latency. */
+    CONN_CTRL_FAST,
+    /** First idle stage. */
+    CONN_CTRL_IDLE,
+    /** Long idle: long interval, high peripheral latency. */
+    CONN_CTRL_SLEEP,
+    /** USB host asleep: longest interval; input doesn't leave it. */
+    CONN_CTRL_SUSPEND,
+    CONN_CTRL_STATE_COUNT
+};
+
+struct conn_ctrl_stats {
+    enum conn_ctrl_state state;
+
+    /** Times each state was entered, and total time spent in it. */
+    uint32_t entered[CONN_CTRL_STATE_COUNT];
+    uint64_t time_us[CONN_CTRL_STATE_COUNT];
+
+    /** Request-to-applied time of parameter updates. */
+    uint32_t update_us_last;
+    uint32_t update_us_max;
+    uint32_t updates_rejected;
+    uint32_t updates_by_peer;
+
+    /** First input after idle until fast parameters were live. */
+    uint32_t wake_us_last;
+    uint32_t wake_us_max;
+
+    int8_t rssi;
+    int8_t rssi_min;
+    bool weak_link;
+
+    uint32_t disconnects;
+    uint32_t supervision_timeouts;
+    int last_disconnect_reason;
+};
+
+/** Takes over parameter control of a freshly established connection. */
+void conn_ctrl_start(uint16_t conn_handle);
+
+/** Records the disconnect reason and stops the controller. */
+void conn_ctrl_stop(uint16_t conn_handle, int reason);
+
+/** Marks input activity; leaves any idle state immediately. */
+void conn_ctrl_on_input(uint16_t conn_handle, int64_t now);
+
+/**
+ * Enters or leaves the suspend state, following USB suspend and resume.
+ * Leaving it goes straight to the fast state.
+ */
+void conn_ctrl_set_suspended(bool suspended);
+
+/** Handles BLE_GAP_EVENT_CONN_UPDATE. */
+void conn_ctrl_on_conn_update(uint16_t conn_handle, int status);
+
+/**
+ * Runs the fast state one interval step longer (dir > 0) or shorter
+ * (dir < 0) than base_itvl, or at base_itvl (dir == 0).  Only allowed
+ * while fast.
+ *
+ * @param base_itvl  Interval the link settled on, in 1.25 ms units; not
+ *                   necessarily the configured one.
+ *
+ * @return 0 on success; BLE_HS_EBUSY if the controller is not in the fast
+ *         state or another update is in flight; BLE_HS_EINVAL if the
+ *         shifted interval is out of range.
+ */
+int conn_ctrl_nudge(uint16_t base_itvl, int dir);
+
+bool conn_ctrl_is_fast(void);
+
+void conn_ctrl_stats_get(struct conn_ctrl_stats *out);
+void conn_ctrl_stats_log(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
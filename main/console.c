@@ -0,0 +1,552 @@
+#include <inttypes.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "esp_log.h"
+#include "esp_heap_caps.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "tinyusb.h"
+#include "tusb_cdc_acm.h"
+#include "host/ble_hs.h"
+#include "capture.h"
+#include "trace.h"
+#include "loadgen.h"
+#include "stall.h"
+#include "console.h"
+
+/*
+ * Profiling console on a CDC-ACM interface next to the HID ones.  Open the
+ * serial port with any terminal and type a command:
+ *
+ *   tasks         CPU use of each task since the last report, and the
+ *                 least free stack it ever had
+ *   mem           heap, the NimBLE memory pools (peer discovery pools,
+ *                 msys mbufs, ...) with their low-water marks
+ *   stream <ms>   both reports every <ms>; "stream off" stops
+ *   capture on|off  recording of BLE notifications (see capture.h)
+ *   capture stream  switches the port to the binary capture format; it
+ *                 stays binary until the port is closed or a line is sent
+ *   trace on|off|stream  the same for pipeline trace events (see trace.h)
+ *   load <pattern> [rate]  synthetic notifications (see loadgen.h); "load"
+ *                 alone shows the last second's numbers
+ *   stall [reset]  hot path cycle histograms, quiet and under flash writes
+ *                 (see stall.h); "stall writes on|off" drives the writes
+ *
+ * Stack arrays in the GAP event handler live on the NimBLE host task's
+ * stack ("nimble_host"), so its free minimum shows how close they came.
+ *
+ * Lines are assembled in the TinyUSB task and handed to a console task at
+ * the lowest priority, which gathers the numbers and writes the reply.  A
+ * terminal that stops reading costs dropped output, never a stalled USB or
+ * host task.  Binary streams are the exception to dropping: a partial
+ * chunk would misalign every record after it, so the console task waits
+ * for the terminal instead, and the ring loses and flags whole records
+ * meanwhile.
+ */
+
+#define CONSOLE_LINE_LEN 32
+#define CONSOLE_MAX_TASKS 24
+#define CONSOLE_FLUSH_MS 50
+#define CONSOLE_BINARY_POLL_MS 10
+
+static const char *tag = "CONSOLE";
+
+static portMUX_TYPE console_lock = portMUX_INITIALIZER_UNLOCKED;
+
+/* Written by the TinyUSB task; the console task takes the line. */
+static char rx_line[CONSOLE_LINE_LEN];
+static size_t rx_len;
+static bool rx_overflow;
+static char line[CONSOLE_LINE_LEN];
+static bool line_ready;
+static volatile bool connected;
+
+/* Only touched from the console task. */
+static struct
+{
+    TaskHandle_t task;
+    uint32_t stream_ms;
+
+    /* Source of the binary stream the port is switched to, if any. */
+    size_t (*binary_read)(uint8_t *buffer, size_t size);
+
+    /* Run time counters at the previous task report, for the deltas. */
+    TaskStatus_t tasks[CONSOLE_MAX_TASKS];
+    uint32_t prev_number[CONSOLE_MAX_TASKS];
+    uint32_t prev_runtime[CONSOLE_MAX_TASKS];
+    UBaseType_t prev_count;
+    uint32_t prev_total;
+
+#if CONFIG_DONGLE_CAPTURE || CONFIG_DONGLE_TRACE
+    uint8_t chunk[512];
+#endif
+} cs;
+
+static struct console_stats stats;
+
+static void write_out(const uint8_t *buf, size_t len)
+{
+    size_t done = 0;
+
+    while (done < len)
+    {
+        done += tinyusb_cdcacm_write_queue(TINYUSB_CDC_ACM_0, buf + done, len - done);
+        if (done < len &&
+            (!connected || tinyusb_cdcacm_write_flush(TINYUSB_CDC_ACM_0,
+                                                       pdMS_TO_TICKS(CONSOLE_FLUSH_MS)) != ESP_OK))
+        {
+            /* A flush that times out may still have sent part of it. */
+            done += tinyusb_cdcacm_write_queue(TINYUSB_CDC_ACM_0, buf + done, len - done);
+            stats.dropped += len - done;
+            return;
+        }
+    }
+}
+
+#if CONFIG_DONGLE_CAPTURE || CONFIG_DONGLE_TRACE
+/* Writes all of buf unless the terminal goes away or sends a line, which
+ * both end the binary stream anyway. */
+static bool write_all(const uint8_t *buf, size_t len)
+{
+    size_t done = 0;
+
+    while (done < len)
+    {
+        if (!connected || line_ready)
+        {
+            stats.dropped += len - done;
+            return false;
+        }
+
+        done += tinyusb_cdcacm_write_queue(TINYUSB_CDC_ACM_0, buf + done, len - done);
+        if (done < len)
+        {
+            tinyusb_cdcacm_write_flush(TINYUSB_CDC_ACM_0, pdMS_TO_TICKS(CONSOLE_FLUSH_MS));
+        }
+    }
+
+    return true;
+}
+#endif
+
+static void out(const char *fmt, ...)
+{
+    char buf[128];
+    va_list ap;
+    int n;
+
+    va_start(ap, fmt);
+    n = vsnprintf(buf, sizeof buf, fmt, ap);
+    va_end(ap);
+    if (n < 0)
+    {
+        return;
+    }
+
+    write_out((const uint8_t *)buf, (size_t)n < sizeof buf ? (size_t)n : sizeof buf - 1);
+}
+
+static uint32_t prev_runtime(UBaseType_t number)
+{
+    UBaseType_t i;
+
+    for (i = 0; i < cs.prev_count; i++)
+    {
+        if (cs.prev_number[i] == number)
+        {
+            return cs.prev_runtime[i];
+        }
+    }
+    return 0;
+}
+
+static void report_tasks(void)
+{
+    static const char states[] = {'X', 'R', 'B', 'S', 'D', '?'};
+    uint32_t total;
+    uint32_t elapsed;
+    UBaseType_t count;
+    UBaseType_t i;
+
+    count = uxTaskGetSystemState(cs.tasks, CONSOLE_MAX_TASKS, &total);
+    if (count == 0)
+    {
+        out("more than %d tasks\r\n", CONSOLE_MAX_TASKS);
+        return;
+    }
+
+#if CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS
+    /* Each core counts its own time. */
+    elapsed = (total - cs.prev_total) * portNUM_PROCESSORS;
+    out("%-16s %5s %4s %5s %s\r\n", "task", "cpu%", "prio", "state", "stack free min");
+#else
+    elapsed = 0;
+    out("%-16s %4s %5s %s\r\n", "task", "prio", "state", "stack free min");
+#endif
+
+    for (i = 0; i < count; i++)
+    {
+        const TaskStatus_t *t = &cs.tasks[i];
+        char state = states[t->eCurrentState <= eDeleted ? t->eCurrentState : eInvalid];
+
+#if CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS
+        uint32_t used = t->ulRunTimeCounter - prev_runtime(t->xTaskNumber);
+        uint32_t permille = elapsed ? (uint32_t)((uint64_t)used * 1000 / elapsed) : 0;
+
+        out("%-16s %3" PRIu32 ".%" PRIu32 " %4u %5c %" PRIu32 "\r\n", t->pcTaskName,
+            permille / 10, permille % 10, (unsigned)t->uxCurrentPriority, state,
+            (uint32_t)t->usStackHighWaterMark);
+#else
+        out("%-16s %4u %5c %" PRIu32 "\r\n", t->pcTaskName, (unsigned)t->uxCurrentPriority,
+            state, (uint32_t)t->usStackHighWaterMark);
+#endif
+    }
+
+    for (i = 0; i < count; i++)
+    {
+        cs.prev_number[i] = cs.tasks[i].xTaskNumber;
+        cs.prev_runtime[i] = cs.tasks[i].ulRunTimeCounter;
+    }
+    cs.prev_count = count;
+    cs.prev_total = total;
+}
+
+static void report_mem(void)
+{
+    struct os_mempool_info omi;
+    struct os_mempool *mp = NULL;
+
+    out("heap: free=%u min=%u largest=%u of %u\r\n",
+        (unsigned)heap_caps_get_free_size(MALLOC_CAP_8BIT),
+        (unsigned)heap_caps_get_minimum_free_size(MALLOC_CAP_8BIT),
+        (unsigned)heap_caps_get_largest_free_block(MALLOC_CAP_8BIT),
+        (unsigned)heap_caps_get_total_size(MALLOC_CAP_8BIT));
+    out("msys: %d of %d mbufs free\r\n", os_msys_num_free(), os_msys_count());
+
+    out("%-20s %5s %6s %4s %8s\r\n", "pool", "block", "blocks", "free", "min free");
+    while ((mp = os_mempool_info_get_next(mp, &omi)) != NULL)
+    {
+        out("%-20s %5d %6d %4d %8d\r\n", omi.omi_name, omi.omi_block_size, omi.omi_num_blocks,
+            omi.omi_num_free, omi.omi_min_free);
+    }
+}
+
+#if CONFIG_DONGLE_LOADGEN
+static void report_load(void)
+{
+    struct loadgen_stats s;
+
+    loadgen_stats_get(&s);
+    out("injected %" PRIu32 "/s, usb %" PRIu32 " reports/s, cpu %" PRIu32 ".%" PRIu32
+        "%% (load task %" PRIu32 ".%" PRIu32 "%%)\r\n",
+        s.notify_rate, s.usb_rate, s.cpu_permille / 10, s.cpu_permille % 10,
+        s.task_permille / 10, s.task_permille % 10);
+    out("edge depth avg %" PRIu32 ".%02" PRIu32 " max %" PRIu32 ", edge drops %" PRIu32
+        ", merged %" PRIu32 ", handler max %" PRIu32 " us\r\n",
+        s.depth_avg_x100 / 100, s.depth_avg_x100 % 100, s.depth_max, s.edge_drops, s.merged,
+        s.handler_us_max);
+    out("total injected %" PRIu32 ", alloc fails %" PRIu32 ", queue full %" PRIu32
+        ", overruns %" PRIu32 "\r\n",
+        s.injected, s.alloc_fails, s.queue_full, s.overruns);
+}
+#endif
+
+#if CONFIG_DONGLE_STALL_PROBE
+static void report_stall(void)
+{
+    static const char *const points[STALL_POINT_COUNT] = {"notify", "sof"};
+    struct stall_stats s;
+    int p;
+    int f;
+    int b;
+
+    stall_stats_get(&s);
+    out("NVS writes %s: %" PRIu32 ", errors %" PRIu32 ", longest %" PRIu32 " us\r\n",
+        stall_writes() ? "on" : "off", s.writes, s.write_errors, s.write_us_max);
+    out("%-12s %7s %8s %8s  cycles <1k <2k <4k ... >=1M\r\n", "", "count", "avg", "max");
+
+    for (p = 0; p < STALL_POINT_COUNT; p++)
+    {
+        for (f = 0; f < 2; f++)
+        {
+            const struct stall_hist *h = &s.hist[p][f];
+
+            out("%-6s %-5s %7" PRIu32 " %8" PRIu32 " %8" PRIu32 " ", points[p],
+                f ? "flash" : "quiet", h->count,
+                h->count ? (uint32_t)(h->cycles_sum / h->count) : 0, h->cycles_max);
+            for (b = 0; b < STALL_BUCKETS; b++)
+            {
+                out(" %" PRIu32, h->buckets[b]);
+            }
+            out("\r\n");
+        }
+    }
+}
+#endif
+
+static void run(char *cmd)
+{
+    char *arg = strchr(cmd, ' ');
+
+    if (arg != NULL)
+    {
+        *arg++ = '\0';
+    }
+
+    if (strcmp(cmd, "tasks") == 0)
+    {
+        report_tasks();
+    }
+    else if (strcmp(cmd, "mem") == 0)
+    {
+        report_mem();
+    }
+    else if (strcmp(cmd, "stream") == 0 && arg != NULL)
+    {
+        cs.stream_ms = strcmp(arg, "off") == 0 ? 0 : strtoul(arg, NULL, 10);
+        out(cs.stream_ms ? "streaming every %" PRIu32 " ms\r\n" : "streaming off\r\n",
+            cs.stream_ms);
+    }
+#if CONFIG_DONGLE_CAPTURE
+    else if (strcmp(cmd, "capture") == 0 && arg != NULL && strcmp(arg, "stream") == 0)
+    {
+        struct capture_file_header header;
+
+        capture_file_header(&header);
+        capture_set_enabled(true);
+        cs.binary_read = capture_read;
+        write_all((const uint8_t *)&header, sizeof header);
+    }
+    else if (strcmp(cmd, "capture") == 0 && arg != NULL &&
+             (strcmp(arg, "on") == 0 || strcmp(arg, "off") == 0))
+    {
+        capture_set_enabled(strcmp(arg, "on") == 0);
+        out("capture %s\r\n", arg);
+    }
+#endif
+#if CONFIG_DONGLE_TRACE
+    else if (strcmp(cmd, "trace") == 0 && arg != NULL && strcmp(arg, "stream") == 0)
+    {
+        size_t len = trace_file_header(cs.chunk, sizeof cs.chunk);
+
+        trace_set_enabled(true);
+        cs.binary_read = trace_read;
+        write_all(cs.chunk, len);
+    }
+    else if (strcmp(cmd, "trace") == 0 && arg != NULL &&
+             (strcmp(arg, "on") == 0 || strcmp(arg, "off") == 0))
+    {
+        trace_set_enabled(strcmp(arg, "on") == 0);
+        out("trace %s\r\n", arg);
+    }
+#endif
+#if CONFIG_DONGLE_LOADGEN
+    else if (strcmp(cmd, "load") == 0 && arg == NULL)
+    {
+        report_load();
+    }
+    else if (strcmp(cmd, "load") == 0 && loadgen_pattern_parse(strtok(arg, " ")) >= 0)
+    {
+        char *rate = strtok(NULL, " ");
+
+        loadgen_start(loadgen_pattern_parse(arg),
+                      rate != NULL ? strtoul(rate, NULL, 10) : CONFIG_DONGLE_LOADGEN_RATE);
+        out("load %s\r\n", arg);
+    }
+#endif
+#if CONFIG_DONGLE_STALL_PROBE
+    else if (strcmp(cmd, "stall") == 0 && arg == NULL)
+    {
+        report_stall();
+    }
+    else if (strcmp(cmd, "stall") == 0 && strcmp(arg, "reset") == 0)
+    {
+        stall_reset();
+        out("stall reset\r\n");
+    }
+    else if (strcmp(cmd, "stall") == 0 &&
+             (strcmp(arg, "writes on") == 0 || strcmp(arg, "writes off") == 0))
+    {
+        stall_set_writes(strcmp(arg, "writes on") == 0);
+        out("stall %s\r\n", arg);
+    }
+#endif
+    else if (cmd[0] != '\0')
+    {
+        stats.bad_commands++;
+        out("commands: tasks, mem, stream <ms>|off"
+#if CONFIG_DONGLE_CAPTURE
+            ", capture on|off|stream"
+#endif
+#if CONFIG_DONGLE_TRACE
+            ", trace on|off|stream"
+#endif
+#if CONFIG_DONGLE_LOADGEN
+            ", load [off|motion|buttons|mixed [rate]]"
+#endif
+#if CONFIG_DONGLE_STALL_PROBE
+            ", stall [reset|writes on|off]"
+#endif
+            "\r\n");
+        return;
+    }
+
+    stats.commands++;
+}
+
+#if CONFIG_DONGLE_CAPTURE || CONFIG_DONGLE_TRACE
+/* Sends what the ring holds; the stream ends when the terminal goes away. */
+static void stream_binary(void)
+{
+    size_t n;
+
+    if (!connected)
+    {
+        cs.binary_read = NULL;
+        return;
+    }
+
+    while ((n = cs.binary_read(cs.chunk, sizeof cs.chunk)) > 0)
+    {
+        if (!write_all(cs.chunk, n))
+        {
+            break;
+        }
+    }
+}
+#endif
+
+static void console_task(void *param)
+{
+    char cmd[CONSOLE_LINE_LEN];
+    bool have_cmd;
+
+    for (;;)
+    {
+        TickType_t wait = cs.binary_read ? pdMS_TO_TICKS(CONSOLE_BINARY_POLL_MS)
+                          : cs.stream_ms   ? pdMS_TO_TICKS(cs.stream_ms)
+                                           : portMAX_DELAY;
+
+        ulTaskNotifyTake(pdTRUE, wait);
+
+        portENTER_CRITICAL(&console_lock);
+        have_cmd = line_ready;
+        if (have_cmd)
+        {
+            memcpy(cmd, line, sizeof cmd);
+            line_ready = false;
+        }
+        portEXIT_CRITICAL(&console_lock);
+
+        if (have_cmd)
+        {
+            cs.binary_read = NULL;
+            run(cmd);
+        }
+#if CONFIG_DONGLE_CAPTURE || CONFIG_DONGLE_TRACE
+        else if (cs.binary_read)
+        {
+            stream_binary();
+        }
+#endif
+        else if (cs.stream_ms && connected)
+        {
+            stats.streamed++;
+            report_tasks();
+            report_mem();
+            out("\r\n");
+        }
+
+        if (connected)
+        {
+            tinyusb_cdcacm_write_flush(TINYUSB_CDC_ACM_0, pdMS_TO_TICKS(CONSOLE_FLUSH_MS));
+        }
+    }
+}
+
+/* TinyUSB task. */
+static void on_rx(int itf, cdcacm_event_t *event)
+{
+    uint8_t buf[CONFIG_TINYUSB_CDC_RX_BUFSIZE];
+    size_t len = 0;
+    size_t i;
+
+    if (tinyusb_cdcacm_read(itf, buf, sizeof buf, &len) != ESP_OK)
+    {
+        return;
+    }
+
+    for (i = 0; i < len; i++)
+    {
+        if (buf[i] != '\r' && buf[i] != '\n')
+        {
+            if (rx_len < sizeof rx_line - 1)
+            {
+                rx_line[rx_len++] = buf[i];
+            }
+            else
+            {
+                rx_overflow = true;
+            }
+            continue;
+        }
+
+        if (rx_overflow)
+        {
+            stats.bad_commands++;
+        }
+        else if (rx_len > 0)
+        {
+            rx_line[rx_len] = '\0';
+            portENTER_CRITICAL(&console_lock);
+            memcpy(line, rx_line, sizeof line);
+            line_ready = true;
+            portEXIT_CRITICAL(&console_lock);
+            xTaskNotifyGive(cs.task);
+        }
+        rx_len = 0;
+        rx_overflow = false;
+    }
+}
+
+/* TinyUSB task. */
+static void on_line_state(int itf, cdcacm_event_t *event)
+{
+    /* Terminals raise DTR when they open the port. */
+    connected = event->line_state_changed_data.dtr;
+}
+
+void console_init(void)
+{
+    const tinyusb_config_cdcacm_t acm_cfg = {
+        .usb_dev = TINYUSB_USBDEV_0,
+        .cdc_port = TINYUSB_CDC_ACM_0,
+        .rx_unread_buf_sz = CONFIG_TINYUSB_CDC_RX_BUFSIZE,
+        .callback_rx = on_rx,
+        .callback_line_state_changed = on_line_state,
+    };
+
+    if (xTaskCreate(console_task, "console", CONFIG_DONGLE_CONSOLE_STACK_SIZE, NULL,
+                    tskIDLE_PRIORITY + 1, &cs.task) != pdPASS)
+    {
+        ESP_LOGE(tag, "no memory for the console task");
+        return;
+    }
+
+    ESP_ERROR_CHECK(tusb_cdc_acm_init(&acm_cfg));
+}
+
+void console_stats_get(struct console_stats *out)
+{
+    *out = stats;
+}
+
+void console_stats_log(void)
+{
+    ESP_LOGI(tag, "%s; commands=%" PRIu32 " bad=%" PRIu32 " streamed=%" PRIu32
+                  " dropped=%" PRIu32 "B",
+             connected ? "open" : "closed", stats.commands, stats.bad_commands, stats.streamed,
+             stats.dropped);
+}
@@ -0,0 +1,39 @@
+#ifndef H_CONSOLE_
+#define H_CONSOLE_
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** First of the two CDC-ACM interfaces (control, data) after the HID ones. */
+#define CONSOLE_ITF 2
+#define CONSOLE_ITF_COUNT 2
+
+struct console_stats {
+    /** Command lines run, and lines too long or not understood. */
+    uint32_t commands;
+    uint32_t bad_commands;
+
+    /** Periodic reports written while streaming. */
+    uint32_t streamed;
+
+    /** Output bytes dropped because the terminal didn't read them. */
+    uint32_t dropped;
+};
+
+/**
+ * Starts the profiling console on the CDC-ACM interface.  Call after
+ * tinyusb_driver_install().
+ */
+void console_init(void);
+
+void console_stats_get(struct console_stats *out);
+void console_stats_log(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,307 @@
+#include <stdlib.h>
+#include <inttypes.h>
+#include "esp_log.h"
+#include "hidpp.h"
+#include "report.h"
+#include "divert.h"
+
+/*
+ * Takes the thumb wheel and the gesture button away from the mouse's own
+ * HID reports and decodes them on the dongle, so they work without vendor
+ * software on the host.  Both are diverted over HID++ at every connection
+ * (diversion doesn't survive a reconnect) and their events come back on the
+ * HID++ characteristic.
+ *
+ * Thumb wheel rotation is scaled back to the wheel's native resolution and
+ * goes out as AC Pan in the regular mouse report.  The gesture button is
+ * diverted together with the pointer motion while it's held; on release the
+ * summed motion decides between a tap and one of four swipes, and the usage
+ * configured for it is pressed and released through the edge queue, the
+ * same path the mouse buttons take.
+ */
+
+#define HIDPP_FEATURE_REPROG_CONTROLS_V4 0x1B04
+#define HIDPP_REPROG_SET_CID_REPORTING 3
+#define HIDPP_REPROG_EVENT_BUTTONS 0
+#define HIDPP_REPROG_EVENT_RAW_XY 1
+
+/* setCidReporting flags: each setting comes with a valid bit. */
+#define HIDPP_REPROG_DIVERT 0x01
+#define HIDPP_REPROG_DIVERT_VALID 0x02
+#define HIDPP_REPROG_RAW_XY 0x10
+#define HIDPP_REPROG_RAW_XY_VALID 0x20
+
+#define HIDPP_CID_GESTURE_BUTTON 0x00C3
+
+#define HIDPP_FEATURE_THUMB_WHEEL 0x2150
+#define HIDPP_THUMB_WHEEL_GET_INFO 0
+#define HIDPP_THUMB_WHEEL_SET_REPORTING 2
+#define HIDPP_THUMB_WHEEL_EVENT 0
+
+static const char *tag = "DIVERT";
+
+#if CONFIG_DONGLE_DIVERT_GESTURE
+static const uint16_t gesture_usage[DIVERT_GESTURE_COUNT] = {
+    [DIVERT_GESTURE_TAP] = CONFIG_DONGLE_GESTURE_TAP,
+    [DIVERT_GESTURE_UP] = CONFIG_DONGLE_GESTURE_UP,
+    [DIVERT_GESTURE_DOWN] = CONFIG_DONGLE_GESTURE_DOWN,
+    [DIVERT_GESTURE_LEFT] = CONFIG_DONGLE_GESTURE_LEFT,
+    [DIVERT_GESTURE_RIGHT] = CONFIG_DONGLE_GESTURE_RIGHT,
+};
+#endif
+
+/* Only touched from the NimBLE host task. */
+static struct
+{
+    /* Feature indices events arrive on, -1 while not diverted. */
+    int wheel_index;
+    int gesture_index;
+
+    /* Diverted counts per native step, and counts not sent yet. */
+    int32_t wheel_divisor;
+    int32_t wheel_rest;
+
+    bool gesture_held;
+    int32_t gesture_dx;
+    int32_t gesture_dy;
+} dv = {
+    .wheel_index = -1,
+    .gesture_index = -1,
+    .wheel_divisor = 1,
+};
+
+static struct divert_stats stats;
+
+static int16_t get_be16(const uint8_t *p)
+{
+    return (int16_t)(p[0] << 8 | p[1]);
+}
+
+static void on_diverted(int status, const uint8_t *params, size_t len, void *arg)
+{
+    uint16_t feature_id = (uint16_t)(uintptr_t)arg;
+
+    stats.last_status = status;
+    if (status != 0)
+    {
+        /* Also what a mouse without the control answers. */
+        stats.failed++;
+        ESP_LOGI(tag, "feature 0x%04X not diverted; status=%d", feature_id, status);
+        return;
+    }
+
+    stats.diverted++;
+    if (feature_id == HIDPP_FEATURE_THUMB_WHEEL)
+    {
+        dv.wheel_index = hidpp_feature_index(feature_id);
+    }
+    else
+    {
+        dv.gesture_index = hidpp_feature_index(feature_id);
+    }
+}
+
+#if CONFIG_DONGLE_DIVERT_THUMBWHEEL
+static void on_wheel_info(int status, const uint8_t *params, size_t len, void *arg)
+{
+    int32_t native;
+    int32_t diverted;
+
+    if (status != 0)
+    {
+        return;
+    }
+
+    native = (uint16_t)get_be16(&params[0]);
+    diverted = (uint16_t)get_be16(&params[2]);
+    dv.wheel_divisor = native > 0 && diverted > native ? diverted / native : 1;
+    ESP_LOGI(tag, "thumb wheel: %" PRId32 " counts per step", dv.wheel_divisor);
+}
+
+static void on_wheel_event(const uint8_t *params)
+{
+    int32_t rotation = get_be16(&params[0]);
+    int32_t steps;
+
+#if CONFIG_DONGLE_THUMBWHEEL_INVERT
+    rotation = -rotation;
+#endif
+
+    stats.wheel_events++;
+    dv.wheel_rest += rotation;
+    steps = dv.wheel_rest / dv.wheel_divisor;
+    if (steps == 0)
+    {
+        return;
+    }
+
+    /* Keep the remainder so slow turns still add up to whole steps. */
+    dv.wheel_rest -= steps * dv.wheel_divisor;
+    stats.pan_steps += abs(steps);
+    report_mouse_pan(steps);
+}
+#endif
+
+#if CONFIG_DONGLE_DIVERT_GESTURE
+static enum divert_gesture classify(int32_t dx, int32_t dy)
+{
+    if (abs(dx) < CONFIG_DONGLE_GESTURE_THRESHOLD && abs(dy) < CONFIG_DONGLE_GESTURE_THRESHOLD)
+    {
+        return DIVERT_GESTURE_TAP;
+    }
+
+    if (abs(dx) > abs(dy))
+    {
+        return dx > 0 ? DIVERT_GESTURE_RIGHT : DIVERT_GESTURE_LEFT;
+    }
+
+    return dy > 0 ? DIVERT_GESTURE_DOWN : DIVERT_GESTURE_UP;
+}
+
+/* A press and a release, queued back to back so neither can be merged away. */
+static void emit(enum divert_gesture gesture)
+{
+    uint16_t usage = gesture_usage[gesture];
+
+    stats.gestures[gesture]++;
+    if (usage == 0)
+    {
+        return;
+    }
+
+#if CONFIG_DONGLE_GESTURE_OUTPUT_KEY
+    report_keyboard_extra(CONFIG_DONGLE_GESTURE_MODIFIER, usage);
+    report_keyboard_extra(0, 0);
+#else
+    report_consumer_input(usage);
+    report_consumer_input(0);
+#endif
+}
+
+static void on_buttons_event(const uint8_t *params)
+{
+    bool held = false;
+    int i;
+
+    /* Up to four diverted controls currently down, zero padded. */
+    for (i = 0; i < 4; i++)
+    {
+        if ((uint16_t)get_be16(&params[i * 2]) == HIDPP_CID_GESTURE_BUTTON)
+        {
+            held = true;
+        }
+    }
+
+    if (held && !dv.gesture_held)
+    {
+        dv.gesture_dx = 0;
+        dv.gesture_dy = 0;
+    }
+    else if (!held && dv.gesture_held)
+    {
+        emit(classify(dv.gesture_dx, dv.gesture_dy));
+    }
+    dv.gesture_held = held;
+}
+
+static void on_raw_xy_event(const uint8_t *params)
+{
+    if (dv.gesture_held)
+    {
+        dv.gesture_dx += get_be16(&params[0]);
+        dv.gesture_dy += get_be16(&params[2]);
+    }
+}
+#endif
+
+/* Host task: HID++ messages the engine didn't claim. */
+static void on_device_msg(const uint8_t *msg, size_t len, void *arg)
+{
+    uint8_t event;
+
+    /* Events carry software ID 0. */
+    if (len < HIDPP_MSG_LEN || (msg[2] & 0x0F) != 0)
+    {
+        return;
+    }
+    event = msg[2] >> 4;
+
+#if CONFIG_DONGLE_DIVERT_THUMBWHEEL
+    if (msg[1] == dv.wheel_index && event == HIDPP_THUMB_WHEEL_EVENT)
+    {
+        on_wheel_event(&msg[3]);
+        return;
+    }
+#endif
+#if CONFIG_DONGLE_DIVERT_GESTURE
+    if (msg[1] == dv.gesture_index)
+    {
+        if (event == HIDPP_REPROG_EVENT_BUTTONS)
+        {
+            on_buttons_event(&msg[3]);
+        }
+        else if (event == HIDPP_REPROG_EVENT_RAW_XY)
+        {
+            on_raw_xy_event(&msg[3]);
+        }
+    }
+#endif
+}
+
+void divert_apply(void)
+{
+    uint8_t params[5];
+
+    dv.wheel_index = -1;
+    dv.gesture_index = -1;
+    dv.wheel_rest = 0;
+    dv.gesture_held = false;
+
+#if CONFIG_DONGLE_DIVERT_THUMBWHEEL
+    hidpp_call(HIDPP_FEATURE_THUMB_WHEEL, HIDPP_THUMB_WHEEL_GET_INFO, params, 0,
+               on_wheel_info, NULL);
+
+    /* Divert, no inversion: direction is handled here. */
+    params[0] = 1;
+    params[1] = 0;
+    hidpp_call(HIDPP_FEATURE_THUMB_WHEEL, HIDPP_THUMB_WHEEL_SET_REPORTING, params, 2,
+               on_diverted, (void *)(uintptr_t)HIDPP_FEATURE_THUMB_WHEEL);
+#endif
+
+#if CONFIG_DONGLE_DIVERT_GESTURE
+    /* Divert the button and the motion while it's held; no remapping. */
+    params[0] = HIDPP_CID_GESTURE_BUTTON >> 8;
+    params[1] = HIDPP_CID_GESTURE_BUTTON & 0xFF;
+    params[2] = HIDPP_REPROG_DIVERT | HIDPP_REPROG_DIVERT_VALID |
+                HIDPP_REPROG_RAW_XY | HIDPP_REPROG_RAW_XY_VALID;
+    params[3] = 0;
+    params[4] = 0;
+    hidpp_call(HIDPP_FEATURE_REPROG_CONTROLS_V4, HIDPP_REPROG_SET_CID_REPORTING, params, 5,
+               on_diverted, (void *)(uintptr_t)HIDPP_FEATURE_REPROG_CONTROLS_V4);
+#endif
+
+    (void)params;
+}
+
+void divert_init(void)
+{
+    hidpp_add_listener(on_device_msg, NULL);
+}
+
+void divert_stats_get(struct divert_stats *out)
+{
+    *out = stats;
+}
+
+void divert_stats_log(void)
+{
+    ESP_LOGI(tag, "diverted=%" PRIu32 " failed=%" PRIu32 " (last %d) wheel events=%" PRIu32
+                  " pan steps=%" PRIu32,
+             stats.diverted, stats.failed, stats.last_status, stats.wheel_events,
+             stats.pan_steps);
+    ESP_LOGI(tag, "gestures tap=%" PRIu32 " up=%" PRIu32 " down=%" PRIu32 " left=%" PRIu32
+                  " right=%" PRIu32,
+             stats.gestures[DIVERT_GESTURE_TAP], stats.gestures[DIVERT_GESTURE_UP],
+             stats.gestures[DIVERT_GESTURE_DOWN], stats.gestures[DIVERT_GESTURE_LEFT],
+             stats.gestures[DIVERT_GESTURE_RIGHT]);
+}
@@ -0,0 +1,47 @@
+#ifndef H_DIVERT_
+#define H_DIVERT_
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** What the gesture button did between press and release. */
+enum divert_gesture {
+    DIVERT_GESTURE_TAP,
+    DIVERT_GESTURE_UP,
+    DIVERT_GESTURE_DOWN,
+    DIVERT_GESTURE_LEFT,
+    DIVERT_GESTURE_RIGHT,
+    DIVERT_GESTURE_COUNT,
+};
+
+struct divert_stats {
+    /** Controls the mouse agreed to divert, and refused or doesn't have. */
+    uint32_t diverted;
+    uint32_t failed;
+    int last_status;
+
+    /** Thumb wheel events, and AC Pan steps made out of them. */
+    uint32_t wheel_events;
+    uint32_t pan_steps;
+
+    /** Gestures recognised, by kind. */
+    uint32_t gestures[DIVERT_GESTURE_COUNT];
+};
+
+/** Registers for HID++ events. Call after nimble_port_init(). */
+void divert_init(void);
+
+/** Diverts the thumb wheel and gesture button; call once HID++ is running. */
+void divert_apply(void);
+
+void divert_stats_get(struct divert_stats *out);
+void divert_stats_log(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -9,10 +9,39 @@
 #include "nimble/nimble_port_freertos.h"
 #include "misc.h"
 #include "peer.h"
+#include "report.h"
+#include "phase_lock.h"
+#include "conn_ctrl.h"
+#include "pointer.h"
+#include "hogp.h"
+#include "profile.h"
+#include "hidpp.h"
+#include "passthrough.h"
+#include "sensor.h"
+#include "divert.h"
+#include "remap.h"
+#include "led.h"
+#include "scan.h"
+#include "power.h"
+#include "console.h"
+#include "capture.h"
+#include "trace.h"
+#include "loadgen.h"
+#include "stall.h"
 #include "tinyusb.h"
+#include "esp_timer.h"
 #include <inttypes.h>
 
-#define TUSB_DESC_TOTAL_LEN (TUD_CONFIG_DESC_LEN + CFG_TUD_HID * TUD_HID_DESC_LEN)
+#if CONFIG_DONGLE_CONSOLE
+#define TUSB_DESC_TOTAL_LEN (TUD_CONFIG_DESC_LEN + TUD_HID_DESC_LEN + TUD_HID_INOUT_DESC_LEN + TUD_CDC_DESC_LEN)
+#define TUSB_ITF_COUNT (2 + CONSOLE_ITF_COUNT)
+#else
+#define TUSB_DESC_TOTAL_LEN (TUD_CONFIG_DESC_LEN + TUD_HID_DESC_LEN + TUD_HID_INOUT_DESC_LEN)
+#define TUSB_ITF_COUNT 2
+#endif
+
+/* Upper bound on the input reports subscribed per connection. */
+#define MAX_SUBSCRIPTIONS 8
 
 static ble_uuid_any_t hid_over_gatt_svc_uuid;
 static ble_uuid_any_t hid_over_gatt_chr_uuid;
@@ -21,47 +50,214 @@ static ble_uuid_any_t battery_chr_uuid;
 
 static const char *tag = "LOGITECH_DONGLE";
 
+/* Profile of the device being connected to, set when it is found. */
+static const struct profile *active_profile;
+
+/* CCCDs still to be written, one at a time. */
+static uint16_t cccds[MAX_SUBSCRIPTIONS];
+static int cccd_count;
+static int cccd_next;
+
+/* A notification's payload; the GAP handler only runs on the host task. */
+static uint8_t notify_buf[BLE_ATT_ATTR_MAX_LEN];
+
+/* Keyboard with one input bit per key; same LED output report as the boot keyboard. */
+#define HID_REPORT_DESC_NKRO_KEYBOARD(...)                                              \
+    HID_USAGE_PAGE(HID_USAGE_PAGE_DESKTOP),                                             \
+    HID_USAGE(HID_USAGE_DESKTOP_KEYBOARD),                                              \
+    HID_COLLECTION(HID_COLLECTION_APPLICATION),                                         \
+    __VA_ARGS__                                                                         \
+    /* 8 bits Modifier Keys (Shift, Control, Alt) */                                    \
+    HID_USAGE_PAGE(HID_USAGE_PAGE_KEYBOARD),                                            \
+    HID_USAGE_MIN(224),                                                                 \
+    HID_USAGE_MAX(231),                                                                 \
+    HID_LOGICAL_MIN(0),                                                                 \
+    HID_LOGICAL_MAX(1),                                                                 \
+    HID_REPORT_COUNT(8),                                                                \
+    HID_REPORT_SIZE(1),                                                                 \
+    HID_INPUT(HID_DATA | HID_VARIABLE | HID_ABSOLUTE),                                  \
+    /* One bit per key usage */                                                         \
+    HID_USAGE_MIN(0),                                                                   \
+    HID_USAGE_MAX(REPORT_NKRO_KEYS - 1),                                                \
+    HID_REPORT_COUNT(REPORT_NKRO_KEYS),                                                 \
+    HID_INPUT(HID_DATA | HID_VARIABLE | HID_ABSOLUTE),                                  \
+    /* Output 5-bit LED Indicator Kana | Compose | ScrollLock | CapsLock | NumLock */   \
+    HID_USAGE_PAGE(HID_USAGE_PAGE_LED),                                                 \
+    HID_USAGE_MIN(1),                                                                   \
+    HID_USAGE_MAX(5),                                                                   \
+    HID_REPORT_COUNT(5),                                                                \
+    HID_OUTPUT(HID_DATA | HID_VARIABLE | HID_ABSOLUTE),                                 \
+    /* led padding */                                                                   \
+    HID_REPORT_COUNT(1),                                                                \
+    HID_REPORT_SIZE(3),                                                                 \
+    HID_OUTPUT(HID_CONSTANT),                                                           \
+    HID_COLLECTION_END
+
+/* HID++ short and long reports in both directions, laid out like a Logitech receiver's. */
+#define HID_REPORT_DESC_HIDPP()                                                         \
+    HID_USAGE_PAGE_N(0xFF00, 2),                                                        \
+    HID_USAGE(0x01),                                                                    \
+    HID_COLLECTION(HID_COLLECTION_APPLICATION),                                         \
+    HID_LOGICAL_MIN(0),                                                                 \
+    HID_LOGICAL_MAX_N(0xFF, 2),                                                         \
+    HID_REPORT_SIZE(8),                                                                 \
+    HID_REPORT_ID(PASSTHROUGH_REPORT_SHORT)                                             \
+    HID_REPORT_COUNT(PASSTHROUGH_SHORT_LEN),                                            \
+    HID_USAGE(0x01),                                                                    \
+    HID_INPUT(HID_DATA | HID_ARRAY | HID_ABSOLUTE),                                     \
+    HID_USAGE(0x01),                                                                    \
+    HID_OUTPUT(HID_DATA | HID_ARRAY | HID_ABSOLUTE),                                    \
+    HID_REPORT_ID(PASSTHROUGH_REPORT_LONG)                                              \
+    HID_REPORT_COUNT(PASSTHROUGH_LONG_LEN),                                             \
+    HID_USAGE(0x02),                                                                    \
+    HID_INPUT(HID_DATA | HID_ARRAY | HID_ABSOLUTE),                                     \
+    HID_USAGE(0x02),                                                                    \
+    HID_OUTPUT(HID_DATA | HID_ARRAY | HID_ABSOLUTE),                                    \
+    HID_COLLECTION_END
+
+/* Sensor profile (DPI, report interval, flags) the host can read and set. */
+#define HID_REPORT_DESC_SENSOR()                                                        \
+    HID_USAGE_PAGE_N(0xFF00, 2),                                                        \
+    HID_USAGE(0x03),                                                                    \
+    HID_COLLECTION(HID_COLLECTION_APPLICATION),                                         \
+    HID_REPORT_ID(SENSOR_REPORT_ID)                                                     \
+    HID_LOGICAL_MIN(0),                                                                 \
+    HID_LOGICAL_MAX_N(0xFF, 2),                                                         \
+    HID_REPORT_SIZE(8),                                                                 \
+    HID_REPORT_COUNT(SENSOR_FEATURE_LEN),                                               \
+    HID_USAGE(0x03),                                                                    \
+    HID_FEATURE(HID_DATA | HID_VARIABLE | HID_ABSOLUTE),                                \
+    HID_COLLECTION_END
+
+/* Scan state (searching, stage); writing it restarts fast scanning. */
+#define HID_REPORT_DESC_SCAN()                                                          \
+    HID_USAGE_PAGE_N(0xFF00, 2),                                                        \
+    HID_USAGE(0x05),                                                                    \
+    HID_COLLECTION(HID_COLLECTION_APPLICATION),                                         \
+    HID_REPORT_ID(SCAN_REPORT_ID)                                                       \
+    HID_LOGICAL_MIN(0),                                                                 \
+    HID_LOGICAL_MAX_N(0xFF, 2),                                                         \
+    HID_REPORT_SIZE(8),                                                                 \
+    HID_REPORT_COUNT(SCAN_FEATURE_LEN),                                                 \
+    HID_USAGE(0x05),                                                                    \
+    HID_FEATURE(HID_DATA | HID_VARIABLE | HID_ABSOLUTE),                                \
+    HID_COLLECTION_END
+
+/* Remap table edits (op, layer, from, to, flags) and the remap state. */
+#define HID_REPORT_DESC_REMAP()                                                         \
+    HID_USAGE_PAGE_N(0xFF00, 2),                                                        \
+    HID_USAGE(0x04),                                                                    \
+    HID_COLLECTION(HID_COLLECTION_APPLICATION),                                         \
+    HID_REPORT_ID(REMAP_REPORT_ID)                                                      \
+    HID_LOGICAL_MIN(0),                                                                 \
+    HID_LOGICAL_MAX_N(0xFF, 2),                                                         \
+    HID_REPORT_SIZE(8),                                                                 \
+    HID_REPORT_COUNT(REMAP_FEATURE_LEN),                                                \
+    HID_USAGE(0x04),                                                                    \
+    HID_FEATURE(HID_DATA | HID_VARIABLE | HID_ABSOLUTE),                                \
+    HID_COLLECTION_END
+
 const uint8_t hid_report_descriptor[] = {
-    TUD_HID_REPORT_DESC_KEYBOARD(HID_REPORT_ID(HID_ITF_PROTOCOL_KEYBOARD)),
-    TUD_HID_REPORT_DESC_MOUSE(HID_REPORT_ID(HID_ITF_PROTOCOL_MOUSE))};
+    HID_REPORT_DESC_NKRO_KEYBOARD(HID_REPORT_ID(HID_ITF_PROTOCOL_KEYBOARD)),
+    TUD_HID_REPORT_DESC_MOUSE(HID_REPORT_ID(HID_ITF_PROTOCOL_MOUSE)),
+    TUD_HID_REPORT_DESC_CONSUMER(HID_REPORT_ID(REPORT_ID_CONSUMER))};
+
+const uint8_t hidpp_report_descriptor[] = {
+    HID_REPORT_DESC_HIDPP(),
+    HID_REPORT_DESC_SENSOR(),
+    HID_REPORT_DESC_REMAP(),
+    HID_REPORT_DESC_SCAN()};
 
-const char *hid_string_descriptor[5] = {
+const char *hid_string_descriptor[7] = {
     (char[]){0x09, 0x04},    // 0: is supported language is English (0x0409)
-    "Logitech",              // 1: Manufacturer
-    "MX Master 3",           // 2: Product
+    profile_usb_manufacturer, // 1: Manufacturer
+    profile_usb_product,     // 2: Product
     "123456",                // 3: Serials, should use chip ID
     "Example HID interface", // 4: HID
+    "HID++ interface",       // 5: HID++ passthrough
+    "Profiling console",     // 6: CDC-ACM console
 };
 
 static const uint8_t hid_configuration_descriptor[] = {
     // Configuration number, interface count, string index, total length, attribute, power in mA
-    TUD_CONFIG_DESCRIPTOR(1, 1, 0, TUSB_DESC_TOTAL_LEN, TUSB_DESC_CONFIG_ATT_REMOTE_WAKEUP, 100),
+    TUD_CONFIG_DESCRIPTOR(1, TUSB_ITF_COUNT, 0, TUSB_DESC_TOTAL_LEN, TUSB_DESC_CONFIG_ATT_REMOTE_WAKEUP, 100),
 
     // Interface number, string index, boot protocol, report descriptor len, EP In address, size & polling interval
-    TUD_HID_DESCRIPTOR(0, 4, false, sizeof(hid_report_descriptor), 0x81, 16, 10),
+    TUD_HID_DESCRIPTOR(0, 4, HID_ITF_PROTOCOL_KEYBOARD, sizeof(hid_report_descriptor), 0x81, 32, 1),
+
+    // Interface number, string index, protocol, report descriptor len, EP Out & In address, size & polling interval
+    TUD_HID_INOUT_DESCRIPTOR(PASSTHROUGH_ITF, 5, HID_ITF_PROTOCOL_NONE, sizeof(hidpp_report_descriptor), 0x02, 0x82, 32, 1),
+
+#if CONFIG_DONGLE_CONSOLE
+    // Interface number, string index, EP notification address and size, EP data address (out, in) and size
+    TUD_CDC_DESCRIPTOR(CONSOLE_ITF, 6, 0x83, 8, 0x04, 0x84, 64),
+#endif
 };
 
 void ble_store_config_init(void);
-static void scan(void);
+static void subscribe_next(uint16_t conn_handle);
 
 uint8_t const *tud_hid_descriptor_report_cb(uint8_t instance)
 {
-    return hid_report_descriptor;
+    return instance == PASSTHROUGH_ITF ? hidpp_report_descriptor : hid_report_descriptor;
 }
 
 uint16_t tud_hid_get_report_cb(uint8_t instance, uint8_t report_id, hid_report_type_t report_type, uint8_t *buffer, uint16_t reqlen)
 {
-    (void)instance;
-    (void)report_id;
-    (void)report_type;
-    (void)buffer;
-    (void)reqlen;
+    if (instance == PASSTHROUGH_ITF)
+    {
+        if (report_type == HID_REPORT_TYPE_FEATURE && report_id == SENSOR_REPORT_ID)
+        {
+            return sensor_get_feature(buffer, reqlen);
+        }
+        if (report_type == HID_REPORT_TYPE_FEATURE && report_id == REMAP_REPORT_ID)
+        {
+            return remap_get_feature(buffer, reqlen);
+        }
+        if (report_type == HID_REPORT_TYPE_FEATURE && report_id == SCAN_REPORT_ID)
+        {
+            return scan_get_feature(buffer, reqlen);
+        }
+        return 0;
+    }
+
+    if (report_type == HID_REPORT_TYPE_INPUT)
+    {
+        return report_get_input(report_id, buffer, reqlen);
+    }
 
     return 0;
 }
 
 void tud_hid_set_report_cb(uint8_t instance, uint8_t report_id, hid_report_type_t report_type, uint8_t const *buffer, uint16_t bufsize)
 {
+    if (instance == PASSTHROUGH_ITF)
+    {
+        if (report_type == HID_REPORT_TYPE_FEATURE && report_id == SENSOR_REPORT_ID)
+        {
+            sensor_set_feature(buffer, bufsize);
+        }
+        else if (report_type == HID_REPORT_TYPE_FEATURE && report_id == REMAP_REPORT_ID)
+        {
+            remap_set_feature(buffer, bufsize);
+        }
+        else if (report_type == HID_REPORT_TYPE_FEATURE && report_id == SCAN_REPORT_ID)
+        {
+            scan_boost();
+        }
+        else
+        {
+            passthrough_on_output(report_id, buffer, bufsize);
+        }
+        return;
+    }
+
+    /* Report ID 0 in boot protocol, the keyboard's ID otherwise. */
+    if (report_type == HID_REPORT_TYPE_OUTPUT &&
+        (report_id == 0 || report_id == HID_ITF_PROTOCOL_KEYBOARD))
+    {
+        led_on_output(buffer, bufsize);
+    }
 }
 
 static int on_characteristic_subscribe(uint16_t conn_handle,
@@ -80,6 +276,8 @@ static int on_characteristic_subscribe(uint16_t conn_handle,
         print_mbuf(attr->om);
     }
 
+    subscribe_next(conn_handle);
+
     return 0;
 }
 
@@ -143,43 +341,120 @@ static void read_battery_status(const struct peer *peer)
     return;
 }
 
-static void subscribe_to_mouse_events(const struct peer *peer, uint16_t handle)
+static void subscribe_next(uint16_t conn_handle)
 {
-    const struct peer_dsc *dsc;
     int rc;
     uint8_t value[2];
+    uint16_t handle;
 
-    dsc = peer_dsc_find_uuid(peer,
-                             (ble_uuid_t *)&hid_over_gatt_svc_uuid,
-                             (ble_uuid_t *)&hid_over_gatt_chr_uuid,
-                             BLE_UUID16_DECLARE(BLE_GATT_DSC_CLT_CFG_UUID16));
-    if (dsc == NULL)
+    if (cccd_next >= cccd_count)
     {
-        MODLOG_DFLT(ERROR, "Error: Peer lacks a CCCD for the subscribable characteristic\n");
+        /* Everything is subscribed, HID++ answers can arrive now. */
+        hidpp_start(conn_handle);
+        sensor_apply();
+        divert_apply();
+        led_start(conn_handle);
+        return;
+    }
+
+    handle = cccds[cccd_next++];
+    ESP_LOGI(tag, "subscribe to input reports, handle: 0x%02X", handle);
+
+    /*** Write 0x00 and 0x01 (The subscription code) to the CCCD ***/
+    value[0] = 1;
+    value[1] = 0;
+    rc = ble_gattc_write_flat(conn_handle, handle,
+                              value, sizeof(value), on_characteristic_subscribe, NULL);
+    if (rc != 0)
+    {
+        MODLOG_DFLT(ERROR,
+                    "Error: Failed to subscribe to the subscribable characteristic; "
+                    "rc=%d\n",
+                    rc);
         /* Terminate the connection */
-        ble_gap_terminate(peer->conn_handle, BLE_ERR_REM_USER_CONN_TERM);
+        ble_gap_terminate(conn_handle, BLE_ERR_REM_USER_CONN_TERM);
     }
-    else
+}
+
+/* Collects the CCCD of every notifying input Report of the HID service. */
+static void find_input_report_cccds(const struct peer *peer)
+{
+    const struct peer_svc *svc;
+    const struct peer_chr *chr;
+    const struct peer_dsc *dsc;
+
+    svc = peer_svc_find_uuid(peer, (ble_uuid_t *)&hid_over_gatt_svc_uuid);
+    if (svc == NULL)
     {
-        ESP_LOGI(tag, "subscribe to mouse events, handle: 0x%02X", handle);
+        return;
+    }
 
-        /*** Write 0x00 and 0x01 (The subscription code) to the CCCD ***/
-        value[0] = 1;
-        value[1] = 0;
-        rc = ble_gattc_write_flat(peer->conn_handle, handle,
-                                  value, sizeof(value), on_characteristic_subscribe, NULL);
-        if (rc != 0)
+    SLIST_FOREACH(chr, &svc->chrs, next)
+    {
+        if (ble_uuid_cmp(&chr->chr.uuid.u, (ble_uuid_t *)&hid_over_gatt_chr_uuid) != 0 ||
+            !(chr->chr.properties & BLE_GATT_CHR_PROP_NOTIFY))
         {
-            MODLOG_DFLT(ERROR,
-                        "Error: Failed to subscribe to the subscribable characteristic; "
-                        "rc=%d\n",
-                        rc);
-            /* Terminate the connection */
-            ble_gap_terminate(peer->conn_handle, BLE_ERR_REM_USER_CONN_TERM);
+            continue;
+        }
+
+        SLIST_FOREACH(dsc, &chr->dscs, next)
+        {
+            if (ble_uuid_cmp(&dsc->dsc.uuid.u, BLE_UUID16_DECLARE(BLE_GATT_DSC_CLT_CFG_UUID16)) == 0 &&
+                cccd_count < MAX_SUBSCRIPTIONS)
+            {
+                cccds[cccd_count++] = dsc->dsc.handle;
+            }
         }
     }
+}
 
-    return;
+static void on_hid_map_ready(uint16_t conn_handle, int status)
+{
+    const struct peer *peer = peer_find(conn_handle);
+    uint16_t handle;
+
+    if (peer == NULL)
+    {
+        return;
+    }
+
+    if (status != 0)
+    {
+        MODLOG_DFLT(INFO, "No HID decode table, using the profile's handles; status=%d\n", status);
+    }
+
+    /* The profile's known CCCDs, or every input report. */
+    cccd_count = 0;
+    cccd_next = 0;
+    if (active_profile != NULL && active_profile->ncccds > 0)
+    {
+        for (int i = 0; i < active_profile->ncccds && i < MAX_SUBSCRIPTIONS; i++)
+        {
+            cccds[cccd_count++] = active_profile->cccds[i];
+        }
+    }
+    else
+    {
+        find_input_report_cccds(peer);
+    }
+
+    handle = hidpp_attach(peer);
+    if (handle != 0 && cccd_count < MAX_SUBSCRIPTIONS)
+    {
+        cccds[cccd_count++] = handle;
+    }
+
+    if (cccd_count == 0)
+    {
+        MODLOG_DFLT(ERROR, "Error: Peer lacks a CCCD for the subscribable characteristic\n");
+        /* Terminate the connection */
+        ble_gap_terminate(conn_handle, BLE_ERR_REM_USER_CONN_TERM);
+        return;
+    }
+
+    /* Each write starts the next once it completes. */
+    subscribe_next(conn_handle);
+    // read_battery_status(peer);
 }
 
 static void on_service_discovery_complete(const struct peer *peer, int status, void *arg)
@@ -199,15 +474,23 @@ static void on_service_discovery_complete(const struct peer *peer, int status, v
                       "conn_handle=%d\n",
                 status, peer->conn_handle);
 
-    // Subscribe to thumb button events.
-    subscribe_to_mouse_events(peer, 0x0030);
-    vTaskDelay(pdMS_TO_TICKS(50));
-    // Subscribe to scroll and click events.
-    subscribe_to_mouse_events(peer, 0x0034);
-    // read_battery_status(peer);
+    /* Subscribe once the decode table is ready so its reads don't race the
+     * CCCD writes; without a HID service go straight to subscribing. */
+    if (hogp_start(peer, on_hid_map_ready) != 0)
+    {
+        on_hid_map_ready(peer->conn_handle, BLE_HS_ENOENT);
+    }
 }
 
-static int on_gap_event_receive(struct ble_gap_event *event, void *arg)
+/* Scale and acceleration together can take a fast stroke past int16_t. */
+static int16_t clamp16(int32_t v)
+{
+    return v > INT16_MAX ? INT16_MAX : v < -INT16_MAX ? -INT16_MAX : v;
+}
+
+static int on_gap_event_receive(struct ble_gap_event *event, void *arg);
+
+static int handle_gap_event(struct ble_gap_event *event, void *arg)
 {
     struct ble_gap_conn_desc desc;
     struct ble_hs_adv_fields fields;
@@ -226,12 +509,14 @@ static int on_gap_event_receive(struct ble_gap_event *event, void *arg)
             memcpy(s, fields.name, fields.name_len);
             s[fields.name_len] = '\0';
 
-            if (strcmp(s, "MX Master 3 Mac") == 0)
+            const struct profile *profile = profile_match(s);
+
+            if (profile != NULL)
             {
-                ESP_LOGI(tag, "Found mouse");
+                ESP_LOGI(tag, "Found %s", profile->name);
                 print_bytes(event->disc.addr.val, 6);
 
-                rc = ble_gap_disc_cancel();
+                rc = scan_found();
                 if (rc != 0)
                 {
                     MODLOG_DFLT(DEBUG, "Failed to cancel scan; rc=%d\n", rc);
@@ -269,7 +554,8 @@ static int on_gap_event_receive(struct ble_gap_event *event, void *arg)
                 }
                 else
                 {
-                    ESP_LOGI(tag, "Connected to mouse");
+                    active_profile = profile;
+                    ESP_LOGI(tag, "Connected to %s", profile->name);
                 }
             }
         }
@@ -297,6 +583,10 @@ static int on_gap_event_receive(struct ble_gap_event *event, void *arg)
                 MODLOG_DFLT(INFO, "Peer is already added; rc=%d\n", rc);
             }
 
+            conn_ctrl_start(event->connect.conn_handle);
+            pointer_reset();
+            phase_lock_start(event->connect.conn_handle);
+
             rc = ble_gap_security_initiate(event->connect.conn_handle);
             if (rc != 0)
             {
@@ -313,6 +603,7 @@ static int on_gap_event_receive(struct ble_gap_event *event, void *arg)
         {
             MODLOG_DFLT(ERROR, "Error: Connection failed; status=%d\n",
                         event->connect.status);
+            scan_start();
         }
 
         return 0;
@@ -324,13 +615,27 @@ static int on_gap_event_receive(struct ble_gap_event *event, void *arg)
     case BLE_GAP_EVENT_DISCONNECT:
         /* Connection terminated. */
         MODLOG_DFLT(INFO, "disconnect; reason=%d ", event->disconnect.reason);
-        scan();
+        hidpp_stop(event->disconnect.conn.conn_handle);
+        hogp_stop(event->disconnect.conn.conn_handle);
+        led_stop(event->disconnect.conn.conn_handle);
+        phase_lock_stop(event->disconnect.conn.conn_handle);
+        conn_ctrl_stop(event->disconnect.conn.conn_handle, event->disconnect.reason);
+        scan_start();
 
         return 0;
 
+    case BLE_GAP_EVENT_CONN_UPDATE:
+        /* The connection parameters changed, or an update we asked for failed. */
+        MODLOG_DFLT(INFO, "connection updated; status=%d ",
+                    event->conn_update.status);
+        conn_ctrl_on_conn_update(event->conn_update.conn_handle,
+                                 event->conn_update.status);
+        return 0;
+
     case BLE_GAP_EVENT_DISC_COMPLETE:
         MODLOG_DFLT(INFO, "discovery complete; reason=%d\n",
                     event->disc_complete.reason);
+        scan_on_complete(event->disc_complete.reason);
         return 0;
 
     case BLE_GAP_EVENT_ENC_CHANGE:
@@ -353,47 +658,81 @@ static int on_gap_event_receive(struct ble_gap_event *event, void *arg)
 
     case BLE_GAP_EVENT_NOTIFY_RX:
         /* Peer sent us a notification or indication. */
+        STALL_BEGIN(stall_start);
+        int64_t now = esp_timer_get_time();
+        power_on_input(now);
+        phase_lock_on_notify(event->notify_rx.conn_handle, now);
+        conn_ctrl_on_input(event->notify_rx.conn_handle, now);
+
+        /* Nothing is logged here: this runs for every report, hundreds a
+         * second.  The capture (capture.h) records them when needed. */
         int len = OS_MBUF_PKTLEN(event->notify_rx.om);
-        MODLOG_DFLT(INFO, "received %s; conn_handle=%d attr_handle=%d "
-                          "attr_len=%d\n",
-                    event->notify_rx.indication ? "indication" : "notification",
-                    event->notify_rx.conn_handle,
-                    event->notify_rx.attr_handle,
-                    len);
-
-        uint8_t *buf = malloc(len + 1);
+        uint8_t *buf = notify_buf;
+
+        if (len > (int)sizeof notify_buf)
+        {
+            len = sizeof notify_buf;
+        }
         os_mbuf_copydata(event->notify_rx.om, 0, len, buf);
+#if CONFIG_DONGLE_CAPTURE
+        capture_on_notify(now, event->notify_rx.conn_handle, event->notify_rx.attr_handle,
+                          event->notify_rx.indication, buf, len);
+#endif
 
-        if (event->notify_rx.attr_handle == 0x33)
+        if (hidpp_on_notify(event->notify_rx.conn_handle, event->notify_rx.attr_handle,
+                            buf, len))
         {
-            if (tud_hid_ready())
-            {
-                int32_t val = (buf[4] << 16) | (buf[3] << 8) | buf[2];
-                int32_t x = val >> 12;
-                if (x & 0x800)
-                {
-                    x |= 0xFFFFF000; // Sign extend if negative
-                }
+            return 0;
+        }
 
-                int32_t y = val & 0x00000FFF;
-                if (y & 0x800)
-                {
-                    y |= 0xFFFFF000; // Sign extend if negative
-                }
+        struct hid_input in;
+        const struct profile *profile = active_profile;
+        int report_id = hogp_report_id(event->notify_rx.conn_handle,
+                                       event->notify_rx.attr_handle);
 
-                tud_hid_mouse_report(HID_ITF_PROTOCOL_MOUSE, buf[0], y, x, buf[5], buf[6]);
-            }
+#if CONFIG_DONGLE_LOADGEN
+        if (event->notify_rx.conn_handle == LOADGEN_CONN_HANDLE)
+        {
+            profile = loadgen_profile();
+        }
+#endif
+
+        if (report_id < 0 && profile != NULL)
+        {
+            report_id = profile_report_id(profile, event->notify_rx.attr_handle);
         }
-        else if (event->notify_rx.attr_handle == 0x2F)
+
+        /* The profile's specialised decoder first, then the table built
+         * from the peer's Report Map for reports the profile doesn't know. */
+        TRACE_BEGIN(DECODE, report_id);
+        bool decoded = (report_id >= 0 && profile != NULL &&
+                        profile->decode(report_id, buf, len, &in)) ||
+                       hogp_decode(event->notify_rx.conn_handle, event->notify_rx.attr_handle,
+                                   buf, len, &in);
+        TRACE_END(DECODE, decoded);
+
+        if (decoded)
         {
-            int modifier = buf[0];
-            uint8_t keycode[6] = {0};
+            remap_apply(&in);
 
-            memcpy(keycode, buf + 1, (len - 1) > 6 ? 6 : (len - 1));
-            tud_hid_keyboard_report(HID_ITF_PROTOCOL_KEYBOARD, modifier, keycode);
+            if (in.has_mouse)
+            {
+                int32_t x = in.x;
+                int32_t y = in.y;
+
+                pointer_transform(&x, &y);
+
+                /* Sent on the next USB start of frame, merged with anything
+                 * else that arrives before it. */
+                report_mouse_input(in.buttons, clamp16(x), clamp16(y), in.wheel, in.pan);
+            }
+            if (in.has_keyboard)
+            {
+                report_keyboard_bitmap(in.modifier, in.keys, sizeof in.keys);
+            }
         }
 
-        free(buf);
+        STALL_END(NOTIFY, stall_start);
 
         return 0;
 
@@ -425,42 +764,15 @@ static int on_gap_event_receive(struct ble_gap_event *event, void *arg)
     }
 }
 
-static void scan(void)
+static int on_gap_event_receive(struct ble_gap_event *event, void *arg)
 {
-    uint8_t own_addr_type;
-    struct ble_gap_disc_params disc_params;
     int rc;
 
-    rc = ble_hs_id_infer_auto(0, &own_addr_type);
-    if (rc != 0)
-    {
-        MODLOG_DFLT(ERROR, "error determining address type; rc=%d\n", rc);
-        return;
-    }
-
-    /* Tell the controller to filter duplicates; we don't want to process
-     * repeated advertisements from the same device.
-     */
-    disc_params.filter_duplicates = 1;
-
-    /**
-     * Perform a passive scan.  I.e., don't send follow-up scan requests to
-     * each advertiser.
-     */
-    disc_params.passive = 1;
+    TRACE_BEGIN(GAP_EVENT, event->type);
+    rc = handle_gap_event(event, arg);
+    TRACE_END(GAP_EVENT, event->type);
 
-    disc_params.itvl = 10;
-    disc_params.window = 10;
-    disc_params.filter_policy = 0;
-    disc_params.limited = 0;
-
-    rc = ble_gap_disc(own_addr_type, BLE_HS_FOREVER, &disc_params,
-                      on_gap_event_receive, NULL);
-    if (rc != 0)
-    {
-        MODLOG_DFLT(ERROR, "Error initiating GAP discovery procedure; rc=%d\n",
-                    rc);
-    }
+    return rc;
 }
 
 static void on_reset(int reason)
@@ -476,9 +788,55 @@ static void on_sync(void)
     rc = ble_hs_util_ensure_addr(0);
     assert(rc == 0);
 
-    scan();
+    scan_start();
 }
 
+#if CONFIG_DONGLE_STATS_INTERVAL_MS > 0
+static void on_stats_timer(void *arg)
+{
+    report_stats_log();
+    phase_lock_stats_log();
+    conn_ctrl_stats_log();
+    pointer_stats_log();
+    hogp_stats_log();
+    hidpp_stats_log();
+    passthrough_stats_log();
+    sensor_stats_log();
+    divert_stats_log();
+    remap_stats_log();
+    led_stats_log();
+    scan_stats_log();
+    power_stats_log();
+#if CONFIG_DONGLE_CONSOLE
+    console_stats_log();
+#endif
+#if CONFIG_DONGLE_CAPTURE
+    capture_stats_log();
+#endif
+#if CONFIG_DONGLE_TRACE
+    trace_stats_log();
+#endif
+#if CONFIG_DONGLE_LOADGEN
+    loadgen_stats_log();
+#endif
+#if CONFIG_DONGLE_STALL_PROBE
+    stall_stats_log();
+#endif
+}
+
+static void start_stats_timer(void)
+{
+    const esp_timer_create_args_t args = {
+        .callback = on_stats_timer,
+        .name = "stats",
+    };
+    esp_timer_handle_t timer;
+
+    ESP_ERROR_CHECK(esp_timer_create(&args, &timer));
+    ESP_ERROR_CHECK(esp_timer_start_periodic(timer, CONFIG_DONGLE_STATS_INTERVAL_MS * 1000ULL));
+}
+#endif
+
 void host_task(void *param)
 {
     ESP_LOGI(tag, "BLE Host Task Started");
@@ -498,8 +856,16 @@ void app_main(void)
     };
 
     ESP_ERROR_CHECK(tinyusb_driver_install(&tusb_cfg));
+    report_init();
+#if CONFIG_DONGLE_CONSOLE
+    console_init();
+#endif
     ESP_LOGI(tag, "USB initialization DONE");
 
+#if CONFIG_DONGLE_STATS_INTERVAL_MS > 0
+    start_stats_timer();
+#endif
+
     ble_uuid_from_str(&battery_svc_uuid, "0000180f-0000-1000-8000-00805f9b34fb");
     ble_uuid_from_str(&battery_chr_uuid, "00002a19-0000-1000-8000-00805f9b34fb");
 
@@ -516,6 +882,10 @@ void app_main(void)
 
     ESP_ERROR_CHECK(ret);
 
+#if CONFIG_DONGLE_STALL_PROBE
+    stall_init();
+#endif
+
     ret = nimble_port_init();
     if (ret != ESP_OK)
     {
@@ -523,6 +893,17 @@ void app_main(void)
         return;
     }
 
+    passthrough_init();
+    sensor_init();
+    divert_init();
+    remap_init();
+    led_init();
+    scan_init(on_gap_event_receive);
+    power_init();
+#if CONFIG_DONGLE_LOADGEN
+    loadgen_init(on_gap_event_receive);
+#endif
+
     /* Configure the host. */
     ble_hs_cfg.reset_cb = on_reset;
     ble_hs_cfg.sync_cb = on_sync;
@@ -0,0 +1,56 @@
+#!/usr/bin/env python3
+#
+# Generates pointer_lut.h: the acceleration gain table and rotation
+# constants used by pointer.c.  Run from main/CMakeLists.txt with values
+# taken from Kconfig, so the curve costs one table lookup at runtime.
+
+import argparse
+import math
+
+LUT_SIZE = 128
+
+
+def gain_pct(speed, low, high, max_gain):
+    """Piecewise linear: unity up to `low`, ramp to `max_gain` at `high`."""
+    if speed <= low:
+        return 100
+    if speed >= high:
+        return max_gain
+    return 100 + (max_gain - 100) * (speed - low) / (high - low)
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument('--out', required=True)
+    parser.add_argument('--low', type=int, default=0)
+    parser.add_argument('--high', type=int, default=1)
+    parser.add_argument('--max-gain', type=int, default=100,
+                        help='gain at and above --high, in percent')
+    parser.add_argument('--rotation', type=int, default=0,
+                        help='rotation applied to motion, in degrees')
+    args = parser.parse_args()
+
+    high = max(args.high, args.low + 1)
+    lut = [round(gain_pct(s, args.low, high, args.max_gain) * 256 / 100)
+           for s in range(LUT_SIZE)]
+
+    angle = math.radians(args.rotation)
+    cos_q14 = round(math.cos(angle) * (1 << 14))
+    sin_q14 = round(math.sin(angle) * (1 << 14))
+
+    with open(args.out, 'w') as f:
+        f.write('/* Generated by gen_pointer_lut.py, do not edit. */\n\n')
+        f.write('#include <stdint.h>\n\n')
+        f.write('#define POINTER_LUT_SIZE {}\n'.format(LUT_SIZE))
+        f.write('#define POINTER_ROT_COS_Q14 {}\n'.format(cos_q14))
+        f.write('#define POINTER_ROT_SIN_Q14 {}\n\n'.format(sin_q14))
+        f.write('/* Gain in Q8 indexed by speed in counts per report. */\n')
+        f.write('static const uint16_t pointer_accel_lut[POINTER_LUT_SIZE] = {\n')
+        for i in range(0, LUT_SIZE, 8):
+            row = ', '.join('{:4d}'.format(v) for v in lut[i:i + 8])
+            f.write('    {},\n'.format(row))
+        f.write('};\n')
+
+
+if __name__ == '__main__':
+    main()
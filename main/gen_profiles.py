@@ -0,0 +1,205 @@
+#!/usr/bin/env python3
+#
+# Generates profiles_gen.h: the device profile registry used by profile.c.
+# Every supported device is described once in PROFILES below.  Only the
+# profiles enabled in Kconfig (CONFIG_DONGLE_PROFILE_<ID>) are emitted, each
+# with a decode function whose bit offsets are compile-time constants.
+
+import argparse
+import re
+
+# Field kinds understood by the generator:
+#   ('buttons', bit, size)          button bits, low 8 go to the USB report
+#   ('x' | 'y' | 'wheel' | 'pan', bit, size)   signed relative axes
+#   ('keyboard',)                   modifier byte, reserved byte, then either a
+#                                   key array (up to 8 bytes) or a key bitmap
+LOGITECH_MOUSE = [
+    ('buttons', 0, 8),
+    ('x', 16, 12),
+    ('y', 28, 12),
+    ('wheel', 40, 8),
+    ('pan', 48, 8),
+]
+
+LOGITECH_KEYBOARD = [
+    ('keyboard',),
+]
+
+PROFILES = [
+    {
+        'id': 'mx_master_3',
+        'name': 'MX Master 3',
+        'adv_names': ['MX Master 3', 'MX Master 3 Mac'],
+        'manufacturer': 'Logitech',
+        'product': 'MX Master 3',
+        # Report ID -> layout.
+        'reports': {2: LOGITECH_MOUSE, 1: LOGITECH_KEYBOARD},
+        # Known Report value handles, used until the Report References are read.
+        'handles': {0x33: 2, 0x2F: 1},
+        # CCCDs to enable; empty means every input Report of the HID service.
+        'cccds': [0x30, 0x34],
+    },
+    {
+        'id': 'mx_anywhere_3',
+        'name': 'MX Anywhere 3',
+        'adv_names': ['MX Anywhere 3', 'MX Anywhere 3 Mac'],
+        'manufacturer': 'Logitech',
+        'product': 'MX Anywhere 3',
+        'reports': {2: LOGITECH_MOUSE, 1: LOGITECH_KEYBOARD},
+        'handles': {},
+        'cccds': [],
+    },
+    {
+        'id': 'mx_keys',
+        'name': 'MX Keys',
+        'adv_names': ['MX Keys', 'MX Keys Mac'],
+        'manufacturer': 'Logitech',
+        'product': 'MX Keys',
+        'reports': {1: LOGITECH_KEYBOARD},
+        'handles': {},
+        'cccds': [],
+    },
+]
+
+
+def read_sdkconfig(path):
+    config = {}
+    with open(path) as f:
+        for line in f:
+            m = re.match(r'#define (CONFIG_\w+) (.*)', line)
+            if m:
+                config[m.group(1)] = m.group(2).strip()
+    return config
+
+
+def bits(bit, size, signed):
+    """C expression for `size` bits at `bit`, little endian, no branches."""
+    first, last = bit // 8, (bit + size - 1) // 8
+    raw = ' | '.join('(uint32_t)buf[{}] << {}'.format(i, 8 * (i - first)) if i > first
+                     else '(uint32_t)buf[{}]'.format(i)
+                     for i in range(first, last + 1))
+    shift = bit % 8
+    if signed:
+        return '(int32_t)(({}) << {}) >> {}'.format(raw, 32 - shift - size, 32 - size)
+    if shift:
+        raw = '(({}) >> {})'.format(raw, shift)
+    return '({}) & 0x{:x}'.format(raw, (1 << size) - 1)
+
+
+def emit_report(out, report_id, layout):
+    out.append('    case {}:'.format(report_id))
+
+    if layout[0][0] == 'keyboard':
+        out.append('        if (len < 2)')
+        out.append('        {')
+        out.append('            return false;')
+        out.append('        }')
+        out.append('        out->has_mouse = false;')
+        out.append('        out->has_keyboard = true;')
+        out.append('        out->modifier = buf[0];')
+        out.append('        memset(out->keys, 0, sizeof out->keys);')
+        out.append('        if (len > 8)')
+        out.append('        {')
+        out.append('            memcpy(out->keys, buf + 2, len - 2 < sizeof out->keys ? len - 2 : sizeof out->keys);')
+        out.append('        }')
+        out.append('        else')
+        out.append('        {')
+        out.append('            profile_keys_from_array(buf + 2, len - 2, out);')
+        out.append('        }')
+        out.append('        return true;')
+        return
+
+    min_len = max((f[1] + f[2] + 7) // 8 for f in layout)
+    out.append('        if (len < {})'.format(min_len))
+    out.append('        {')
+    out.append('            return false;')
+    out.append('        }')
+    out.append('        out->has_mouse = true;')
+    out.append('        out->has_keyboard = false;')
+    for kind, bit, size in layout:
+        if kind == 'buttons':
+            out.append('        out->buttons = {};'.format(bits(bit, size, False)))
+        else:
+            out.append('        out->{} = {};'.format(kind, bits(bit, size, True)))
+    out.append('        return true;')
+
+
+def emit_profile(out, p):
+    pid = p['id']
+
+    out.append('static bool profile_{}_decode(uint8_t report_id, const uint8_t *buf, size_t len,'.format(pid))
+    out.append('{}struct hid_input *out)'.format(' ' * len('static bool profile_{}_decode('.format(pid))))
+    out.append('{')
+    out.append('    switch (report_id)')
+    out.append('    {')
+    for report_id, layout in sorted(p['reports'].items()):
+        emit_report(out, report_id, layout)
+    out.append('    default:')
+    out.append('        return false;')
+    out.append('    }')
+    out.append('}')
+    out.append('')
+
+    names = ', '.join('"{}"'.format(n) for n in p['adv_names'])
+    out.append('static const char *const profile_{}_adv_names[] = {{{}, NULL}};'.format(pid, names))
+    if p['handles']:
+        handles = ', '.join('{{0x{:04x}, {}}}'.format(h, r) for h, r in sorted(p['handles'].items()))
+        out.append('static const struct profile_handle profile_{}_handles[] = {{{}}};'.format(pid, handles))
+    if p['cccds']:
+        cccds = ', '.join('0x{:04x}'.format(h) for h in p['cccds'])
+        out.append('static const uint16_t profile_{}_cccds[] = {{{}}};'.format(pid, cccds))
+    out.append('')
+
+
+def emit_entry(out, p):
+    pid = p['id']
+
+    out.append('    {')
+    out.append('        .name = "{}",'.format(p['name']))
+    out.append('        .adv_names = profile_{}_adv_names,'.format(pid))
+    if p['handles']:
+        out.append('        .handles = profile_{}_handles,'.format(pid))
+        out.append('        .nhandles = {},'.format(len(p['handles'])))
+    if p['cccds']:
+        out.append('        .cccds = profile_{}_cccds,'.format(pid))
+        out.append('        .ncccds = {},'.format(len(p['cccds'])))
+    out.append('        .decode = profile_{}_decode,'.format(pid))
+    out.append('    },')
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument('--out', required=True)
+    parser.add_argument('--sdkconfig', required=True,
+                        help='sdkconfig.h with the CONFIG_DONGLE_PROFILE_* selection')
+    args = parser.parse_args()
+
+    config = read_sdkconfig(args.sdkconfig)
+    enabled = [p for p in PROFILES
+               if config.get('CONFIG_DONGLE_PROFILE_' + p['id'].upper()) == '1']
+    usb_id = config.get('CONFIG_DONGLE_USB_IDENTITY_ID', '"{}"'.format(PROFILES[0]['id'])).strip('"')
+    usb = next((p for p in PROFILES if p['id'] == usb_id), PROFILES[0])
+
+    out = ['/* Generated by gen_profiles.py, do not edit. */', '']
+    out.append('#define PROFILE_USB_MANUFACTURER "{}"'.format(usb['manufacturer']))
+    out.append('#define PROFILE_USB_PRODUCT "{}"'.format(usb['product']))
+    out.append('#define PROFILE_COUNT {}'.format(len(enabled)))
+    out.append('')
+
+    for p in enabled:
+        emit_profile(out, p)
+
+    if enabled:
+        out.append('static const struct profile profiles[PROFILE_COUNT] = {')
+        for p in enabled:
+            emit_entry(out, p)
+        out.append('};')
+    else:
+        out.append('static const struct profile *const profiles = NULL;')
+
+    with open(args.out, 'w') as f:
+        f.write('\n'.join(out) + '\n')
+
+
+if __name__ == '__main__':
+    main()
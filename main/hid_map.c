@@ -0,0 +1,574 @@
+#include <string.h>
+#include "hid_map.h"
+
+/*
+ * HID report descriptor parser and table-driven report decoder.  The
+ * parser walks the Report Map once and keeps only what the dongle can
+ * forward: for every report ID, the bit offset, size and signedness of the
+ * fields that map onto the USB mouse and keyboard reports.  Decoding a
+ * notification is then a short loop over that table.
+ *
+ * Only short items are understood; long items are skipped.  Notifications
+ * carry no report ID byte, so bit offsets start at 0 for every report.
+ */
+
+#define HID_ITEM_MAIN 0
+#define HID_ITEM_GLOBAL 1
+#define HID_ITEM_LOCAL 2
+
+#define HID_MAIN_INPUT 0x8
+#define HID_MAIN_OUTPUT 0x9
+#define HID_MAIN_COLLECTION 0xA
+#define HID_MAIN_FEATURE 0xB
+#define HID_MAIN_END_COLLECTION 0xC
+
+#define HID_GLOBAL_USAGE_PAGE 0x0
+#define HID_GLOBAL_LOGICAL_MIN 0x1
+#define HID_GLOBAL_REPORT_SIZE 0x7
+#define HID_GLOBAL_REPORT_ID 0x8
+#define HID_GLOBAL_REPORT_COUNT 0x9
+#define HID_GLOBAL_PUSH 0xA
+#define HID_GLOBAL_POP 0xB
+
+#define HID_LOCAL_USAGE 0x0
+#define HID_LOCAL_USAGE_MIN 0x1
+#define HID_LOCAL_USAGE_MAX 0x2
+
+#define HID_INPUT_CONSTANT 0x01
+#define HID_INPUT_VARIABLE 0x02
+
+#define HID_PAGE_DESKTOP 0x01
+#define HID_PAGE_KEYBOARD 0x07
+#define HID_PAGE_BUTTON 0x09
+#define HID_PAGE_CONSUMER 0x0C
+
+#define HID_DESKTOP_X 0x30
+#define HID_DESKTOP_Y 0x31
+#define HID_DESKTOP_WHEEL 0x38
+#define HID_CONSUMER_AC_PAN 0x238
+
+#define HID_KEY_LEFT_CONTROL 0xE0
+#define HID_KEY_RIGHT_GUI 0xE7
+#define HID_KEY_ERR_ROLLOVER 0x01
+
+#define HID_MAP_MAX_USAGES 16
+#define HID_MAP_STACK_DEPTH 4
+
+struct hid_globals
+{
+    uint16_t usage_page;
+    int32_t logical_min;
+    uint8_t report_size;
+    uint8_t report_count;
+    uint8_t report_id;
+};
+
+struct hid_locals
+{
+    uint32_t usages[HID_MAP_MAX_USAGES];
+    uint8_t nusages;
+    uint32_t usage_min;
+    uint32_t usage_max;
+    bool has_range;
+};
+
+static uint32_t item_value(const uint8_t *data, uint8_t size)
+{
+    switch (size)
+    {
+    case 1:
+        return data[0];
+    case 2:
+        return data[0] | (data[1] << 8);
+    case 4:
+        return data[0] | (data[1] << 8) | (data[2] << 16) | ((uint32_t)data[3] << 24);
+    default:
+        return 0;
+    }
+}
+
+static int32_t item_signed(const uint8_t *data, uint8_t size)
+{
+    switch (size)
+    {
+    case 1:
+        return (int8_t)data[0];
+    case 2:
+        return (int16_t)(data[0] | (data[1] << 8));
+    default:
+        return (int32_t)item_value(data, size);
+    }
+}
+
+/* Full usage (page in the upper half) of element i of the current item. */
+static uint32_t local_usage(const struct hid_locals *l, const struct hid_globals *g, uint8_t i)
+{
+    uint32_t usage;
+
+    if (l->has_range)
+    {
+        usage = l->usage_min + i;
+        if (usage > l->usage_max)
+        {
+            usage = l->usage_max;
+        }
+    }
+    else if (l->nusages > 0)
+    {
+        usage = l->usages[i < l->nusages ? i : l->nusages - 1];
+    }
+    else
+    {
+        return 0;
+    }
+
+    if (usage <= 0xFFFF)
+    {
+        usage |= (uint32_t)g->usage_page << 16;
+    }
+    return usage;
+}
+
+static struct hid_report_layout *layout_for(struct hid_map *map, uint16_t *offsets, uint8_t report_id)
+{
+    uint8_t i;
+
+    for (i = 0; i < map->nreports; i++)
+    {
+        if (map->reports[i].report_id == report_id)
+        {
+            return &map->reports[i];
+        }
+    }
+
+    if (map->nreports == HID_MAP_MAX_REPORTS)
+    {
+        return NULL;
+    }
+
+    i = map->nreports++;
+    memset(&map->reports[i], 0, sizeof map->reports[i]);
+    map->reports[i].report_id = report_id;
+    offsets[i] = 0;
+    return &map->reports[i];
+}
+
+/* Adds one element, extending the previous field when it continues a bit run. */
+static void add_field(struct hid_report_layout *layout, uint8_t kind, uint16_t offset,
+                      uint8_t size, bool is_signed, uint8_t usage_min, bool run)
+{
+    struct hid_field *f;
+
+    if (run && layout->nfields > 0)
+    {
+        f = &layout->fields[layout->nfields - 1];
+        if (f->kind == kind && f->bit_size == size &&
+            f->bit_offset + f->bit_size * f->count == offset &&
+            f->usage_min + f->count == usage_min && f->count < UINT8_MAX)
+        {
+            f->count++;
+            return;
+        }
+    }
+
+    if (layout->nfields == HID_MAP_MAX_FIELDS)
+    {
+        return;
+    }
+
+    f = &layout->fields[layout->nfields++];
+    f->bit_offset = offset;
+    f->bit_size = size;
+    f->count = 1;
+    f->kind = kind;
+    f->is_signed = is_signed;
+    f->usage_min = usage_min;
+}
+
+static void add_input(struct hid_report_layout *layout, uint16_t *offset, uint32_t flags,
+                      const struct hid_globals *g, const struct hid_locals *l)
+{
+    bool is_signed = g->logical_min < 0;
+    uint32_t usage;
+    uint16_t page;
+    uint16_t id;
+    uint8_t i;
+
+    if (flags & HID_INPUT_CONSTANT)
+    {
+        *offset += g->report_size * g->report_count;
+        return;
+    }
+
+    if (!(flags & HID_INPUT_VARIABLE))
+    {
+        /* Arrays: only key arrays are useful to the dongle. */
+        usage = local_usage(l, g, 0);
+        if (usage >> 16 == HID_PAGE_KEYBOARD && g->report_size <= 8)
+        {
+            add_field(layout, HID_FIELD_KEY_ARRAY, *offset, g->report_size, false, 0, false);
+            layout->fields[layout->nfields - 1].count = g->report_count;
+        }
+        *offset += g->report_size * g->report_count;
+        return;
+    }
+
+    for (i = 0; i < g->report_count; i++, *offset += g->report_size)
+    {
+        usage = local_usage(l, g, i);
+        page = usage >> 16;
+        id = usage & 0xFFFF;
+
+        if (page == HID_PAGE_BUTTON && id >= 1)
+        {
+            add_field(layout, HID_FIELD_BUTTONS, *offset, g->report_size, false, id, true);
+        }
+        else if (page == HID_PAGE_DESKTOP && id == HID_DESKTOP_X)
+        {
+            add_field(layout, HID_FIELD_X, *offset, g->report_size, is_signed, 0, false);
+        }
+        else if (page == HID_PAGE_DESKTOP && id == HID_DESKTOP_Y)
+        {
+            add_field(layout, HID_FIELD_Y, *offset, g->report_size, is_signed, 0, false);
+        }
+        else if (page == HID_PAGE_DESKTOP && id == HID_DESKTOP_WHEEL)
+        {
+            add_field(layout, HID_FIELD_WHEEL, *offset, g->report_size, is_signed, 0, false);
+        }
+        else if (page == HID_PAGE_CONSUMER && id == HID_CONSUMER_AC_PAN)
+        {
+            add_field(layout, HID_FIELD_PAN, *offset, g->report_size, is_signed, 0, false);
+        }
+        else if (page == HID_PAGE_KEYBOARD && id >= HID_KEY_LEFT_CONTROL && id <= HID_KEY_RIGHT_GUI)
+        {
+            add_field(layout, HID_FIELD_KEY_MODS, *offset, g->report_size, false,
+                      id - HID_KEY_LEFT_CONTROL, true);
+        }
+        else if (page == HID_PAGE_KEYBOARD && id < REPORT_NKRO_KEYS)
+        {
+            add_field(layout, HID_FIELD_KEY_BITMAP, *offset, g->report_size, false, id, true);
+        }
+    }
+}
+
+int hid_map_parse(struct hid_map *map, const uint8_t *desc, size_t len)
+{
+    struct hid_globals g = {0};
+    struct hid_globals stack[HID_MAP_STACK_DEPTH];
+    struct hid_locals l = {0};
+    uint16_t offsets[HID_MAP_MAX_REPORTS];
+    struct hid_report_layout *layout;
+    uint8_t depth = 0;
+    size_t pos = 0;
+    uint32_t value;
+
+    map->version = HID_MAP_VERSION;
+    map->nreports = 0;
+
+    while (pos < len)
+    {
+        uint8_t prefix = desc[pos++];
+        uint8_t size = prefix & 0x03;
+        uint8_t type = (prefix >> 2) & 0x03;
+        uint8_t tag = prefix >> 4;
+        const uint8_t *data = &desc[pos];
+
+        if (prefix == 0xFE)
+        {
+            /* Long item: data size, long tag, data. */
+            if (pos + 2 > len)
+            {
+                return -1;
+            }
+            pos += 2 + desc[pos];
+            continue;
+        }
+
+        if (size == 3)
+        {
+            size = 4;
+        }
+        if (pos + size > len)
+        {
+            return -1;
+        }
+        pos += size;
+
+        switch (type)
+        {
+        case HID_ITEM_MAIN:
+            if (tag == HID_MAIN_INPUT)
+            {
+                layout = layout_for(map, offsets, g.report_id);
+                if (layout != NULL)
+                {
+                    add_input(layout, &offsets[layout - map->reports], item_value(data, size), &g, &l);
+                }
+            }
+            memset(&l, 0, sizeof l);
+            break;
+
+        case HID_ITEM_GLOBAL:
+            switch (tag)
+            {
+            case HID_GLOBAL_USAGE_PAGE:
+                g.usage_page = item_value(data, size);
+                break;
+            case HID_GLOBAL_LOGICAL_MIN:
+                g.logical_min = item_signed(data, size);
+                break;
+            case HID_GLOBAL_REPORT_SIZE:
+                /* get_bits() reads fields of 1 to 32 bits. */
+                value = item_value(data, size);
+                if (value == 0 || value > 32)
+                {
+                    return -1;
+                }
+                g.report_size = value;
+                break;
+            case HID_GLOBAL_REPORT_ID:
+                g.report_id = item_value(data, size);
+                break;
+            case HID_GLOBAL_REPORT_COUNT:
+                /* Key arrays keep their count in a byte (hid_field.count). */
+                value = item_value(data, size);
+                if (value > UINT8_MAX)
+                {
+                    return -1;
+                }
+                g.report_count = value;
+                break;
+            case HID_GLOBAL_PUSH:
+                if (depth == HID_MAP_STACK_DEPTH)
+                {
+                    return -1;
+                }
+                stack[depth++] = g;
+                break;
+            case HID_GLOBAL_POP:
+                if (depth == 0)
+                {
+                    return -1;
+                }
+                g = stack[--depth];
+                break;
+            default:
+                break;
+            }
+            break;
+
+        case HID_ITEM_LOCAL:
+            switch (tag)
+            {
+            case HID_LOCAL_USAGE:
+                if (l.nusages < HID_MAP_MAX_USAGES)
+                {
+                    l.usages[l.nusages++] = item_value(data, size);
+                }
+                break;
+            case HID_LOCAL_USAGE_MIN:
+                l.usage_min = item_value(data, size);
+                l.has_range = true;
+                break;
+            case HID_LOCAL_USAGE_MAX:
+                l.usage_max = item_value(data, size);
+                l.has_range = true;
+                break;
+            default:
+                break;
+            }
+            break;
+
+        default:
+            break;
+        }
+    }
+
+    return 0;
+}
+
+int hid_map_add_handle(struct hid_map *map, uint16_t val_handle, uint8_t report_id)
+{
+    if (map->nhandles == HID_MAP_MAX_HANDLES)
+    {
+        return -1;
+    }
+
+    map->handles[map->nhandles].val_handle = val_handle;
+    map->handles[map->nhandles].report_id = report_id;
+    map->nhandles++;
+    return 0;
+}
+
+static uint32_t get_bits(const uint8_t *buf, size_t len, uint16_t offset, uint8_t size, bool is_signed)
+{
+    size_t byte = offset >> 3;
+    uint8_t shift = offset & 7;
+    uint8_t nbytes = (shift + size + 7) >> 3;
+    uint64_t raw = 0;
+    uint32_t v;
+    uint8_t i;
+
+    for (i = 0; i < nbytes && byte + i < len; i++)
+    {
+        raw |= (uint64_t)buf[byte + i] << (8 * i);
+    }
+
+    v = (uint32_t)(raw >> shift);
+    if (size < 32)
+    {
+        v &= (1u << size) - 1;
+        if (is_signed && (v & (1u << (size - 1))))
+        {
+            v |= ~((1u << size) - 1);
+        }
+    }
+    return v;
+}
+
+static int32_t clamp(int32_t v, int32_t lim)
+{
+    return v > lim ? lim : v < -lim ? -lim : v;
+}
+
+int hid_map_report_id(const struct hid_map *map, uint16_t val_handle)
+{
+    uint8_t i;
+
+    for (i = 0; i < map->nhandles; i++)
+    {
+        if (map->handles[i].val_handle == val_handle)
+        {
+            return map->handles[i].report_id;
+        }
+    }
+
+    return -1;
+}
+
+bool hid_map_decode(const struct hid_map *map, uint16_t val_handle,
+                    const uint8_t *buf, size_t len, struct hid_input *out)
+{
+    const struct hid_report_layout *layout = NULL;
+    const struct hid_field *f;
+    int report_id = hid_map_report_id(map, val_handle);
+    uint32_t v;
+    uint8_t i, j;
+
+    for (i = 0; report_id >= 0 && i < map->nreports; i++)
+    {
+        if (map->reports[i].report_id == report_id)
+        {
+            layout = &map->reports[i];
+            break;
+        }
+    }
+
+    if (layout == NULL)
+    {
+        return false;
+    }
+
+    memset(out, 0, sizeof *out);
+
+    for (i = 0; i < layout->nfields; i++)
+    {
+        f = &layout->fields[i];
+
+        switch (f->kind)
+        {
+        case HID_FIELD_BUTTONS:
+            out->has_mouse = true;
+            for (j = 0; j < f->count; j++)
+            {
+                if (f->usage_min + j <= 8 &&
+                    get_bits(buf, len, f->bit_offset + j * f->bit_size, f->bit_size, false))
+                {
+                    out->buttons |= 1 << (f->usage_min + j - 1);
+                }
+            }
+            break;
+
+        case HID_FIELD_X:
+        case HID_FIELD_Y:
+            out->has_mouse = true;
+            v = get_bits(buf, len, f->bit_offset, f->bit_size, f->is_signed);
+            if (f->kind == HID_FIELD_X)
+            {
+                out->x = clamp((int32_t)v, INT16_MAX);
+            }
+            else
+            {
+                out->y = clamp((int32_t)v, INT16_MAX);
+            }
+            break;
+
+        case HID_FIELD_WHEEL:
+        case HID_FIELD_PAN:
+            out->has_mouse = true;
+            v = get_bits(buf, len, f->bit_offset, f->bit_size, f->is_signed);
+            if (f->kind == HID_FIELD_WHEEL)
+            {
+                out->wheel = clamp((int32_t)v, INT8_MAX);
+            }
+            else
+            {
+                out->pan = clamp((int32_t)v, INT8_MAX);
+            }
+            break;
+
+        case HID_FIELD_KEY_MODS:
+            out->has_keyboard = true;
+            for (j = 0; j < f->count; j++)
+            {
+                if (get_bits(buf, len, f->bit_offset + j * f->bit_size, f->bit_size, false))
+                {
+                    out->modifier |= 1 << (f->usage_min + j);
+                }
+            }
+            break;
+
+        case HID_FIELD_KEY_BITMAP:
+            out->has_keyboard = true;
+            for (j = 0; j < f->count; j++)
+            {
+                uint16_t key = f->usage_min + j;
+
+                if (key < REPORT_NKRO_KEYS &&
+                    get_bits(buf, len, f->bit_offset + j * f->bit_size, f->bit_size, false))
+                {
+                    out->keys[key / 8] |= 1 << (key % 8);
+                }
+            }
+            break;
+
+        case HID_FIELD_KEY_ARRAY:
+            out->has_keyboard = true;
+            for (j = 0; j < f->count; j++)
+            {
+                v = get_bits(buf, len, f->bit_offset + j * f->bit_size, f->bit_size, false);
+                if (v == HID_KEY_ERR_ROLLOVER)
+                {
+                    /* Phantom state: keep whatever the host has now. */
+                    out->has_keyboard = false;
+                    break;
+                }
+                if (v > HID_KEY_ERR_ROLLOVER && v < REPORT_NKRO_KEYS)
+                {
+                    out->keys[v / 8] |= 1 << (v % 8);
+                }
+            }
+            break;
+
+        default:
+            break;
+        }
+
+        if (f->kind == HID_FIELD_KEY_ARRAY && !out->has_keyboard)
+        {
+            break;
+        }
+    }
+
+    return true;
+}
@@ -0,0 +1,108 @@
+#ifndef H_HID_MAP_
+#define H_HID_MAP_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "report.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define HID_MAP_MAX_REPORTS 8
+#define HID_MAP_MAX_FIELDS 10
+#define HID_MAP_MAX_HANDLES 12
+
+/** Bump whenever struct hid_map changes; cached maps of another version are re-read. */
+#define HID_MAP_VERSION 2
+
+enum hid_field_kind {
+    HID_FIELD_BUTTONS,
+    HID_FIELD_X,
+    HID_FIELD_Y,
+    HID_FIELD_WHEEL,
+    HID_FIELD_PAN,
+    /** Modifier bits, keyboard usages 0xE0-0xE7. */
+    HID_FIELD_KEY_MODS,
+    /** Array of key usages, one per element. */
+    HID_FIELD_KEY_ARRAY,
+    /** One bit per key usage, starting at usage_min. */
+    HID_FIELD_KEY_BITMAP,
+};
+
+/** Where one field lives inside a report, as parsed from the Report Map. */
+struct hid_field {
+    uint16_t bit_offset;
+    uint8_t bit_size;
+    uint8_t count;
+    uint8_t kind;
+    uint8_t is_signed;
+    uint8_t usage_min;
+};
+
+struct hid_report_layout {
+    uint8_t report_id;
+    uint8_t nfields;
+    struct hid_field fields[HID_MAP_MAX_FIELDS];
+};
+
+/** Input report characteristic value handle and the report ID behind it. */
+struct hid_map_handle {
+    uint16_t val_handle;
+    uint8_t report_id;
+};
+
+/** Compact, position-independent decode table; stored as-is in NVS. */
+struct hid_map {
+    uint8_t version;
+    uint8_t nreports;
+    uint8_t nhandles;
+    struct hid_report_layout reports[HID_MAP_MAX_REPORTS];
+    struct hid_map_handle handles[HID_MAP_MAX_HANDLES];
+
+    /** Output report characteristic (keyboard LEDs), 0 if the peer has none. */
+    uint16_t out_handle;
+};
+
+/** One decoded input report, already in USB report terms. */
+struct hid_input {
+    bool has_mouse;
+    bool has_keyboard;
+    uint8_t buttons;
+    int16_t x;
+    int16_t y;
+    int8_t wheel;
+    int8_t pan;
+    uint8_t modifier;
+    uint8_t keys[REPORT_NKRO_BYTES];
+};
+
+/**
+ * Parses a HID report descriptor into the field table of map.  Handles
+ * are left alone.
+ *
+ * @return 0 on success, -1 if the descriptor is malformed or has a Report
+ *         Size outside 1 to 32 bits or a Report Count over 255.
+ */
+int hid_map_parse(struct hid_map *map, const uint8_t *desc, size_t len);
+
+/** Adds an input report characteristic to the handle table. */
+int hid_map_add_handle(struct hid_map *map, uint16_t val_handle, uint8_t report_id);
+
+/** @return Report ID behind an input report handle, or -1 if unknown. */
+int hid_map_report_id(const struct hid_map *map, uint16_t val_handle);
+
+/**
+ * Decodes a notification from the given characteristic.
+ *
+ * @return true if the handle belongs to a known input report.
+ */
+bool hid_map_decode(const struct hid_map *map, uint16_t val_handle,
+                    const uint8_t *buf, size_t len, struct hid_input *out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,811 @@
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "nvs.h"
+#include "host/ble_hs.h"
+#include "nimble/nimble_port.h"
+#include "peer.h"
+#include "hidpp.h"
+
+/*
+ * HID++ 2.0 over the Logitech vendor GATT service.  Requests are written
+ * without response and matched to their answers by feature index, function
+ * and the engine's software ID.  Only a small window of requests is on the
+ * air at a time; the rest wait in a FIFO, and a write the host has no buffer
+ * for is retried from a callout.
+ *
+ * Host tools reach the device through hidpp_send_raw() with software IDs of
+ * their own.  The engine keeps one ID to itself, so their answers are never
+ * taken for its own; a host request that uses it goes out under an alias
+ * that is swapped back in its answer.  Host requests under the alias ID,
+ * aliased or not, are tracked in send order, and answers are matched to the
+ * oldest one for their feature and function, so an aliased request and one
+ * natively using that ID can't take each other's answers.
+ *
+ * Every feature access needs the feature's index on this device, which
+ * normally costs an IRoot.getFeature round trip.  Indices are cached in NVS
+ * per bonded device, so after the first connection a configuration command
+ * goes out in a single round trip.  A cached index the device rejects is
+ * looked up again once.  Changes are learnt from notifications, so they are
+ * saved from a callout a little later rather than on the input path.
+ */
+
+#define HIDPP_DEVICE_INDEX 0xFF
+#define HIDPP_ERROR_FEATURE 0xFF
+
+/* Shortest notification worth decoding: up to an error message's code.
+ * Anything up to HIDPP_MSG_LEN is zero-padded. */
+#define HIDPP_MSG_MIN_LEN 5
+
+#define HIDPP_MAX_REQUESTS 8
+
+/* Engine requests on the air at once.  Devices work through requests one
+ * at a time; host requests from hidpp_send_raw() don't count against this
+ * and may be pipelined past it. */
+#define HIDPP_MAX_IN_FLIGHT 1
+
+#define HIDPP_TIMEOUT_MS 1000
+#define HIDPP_TICK_MS 250
+#define HIDPP_RETRY_MS 5
+
+#define HIDPP_MAX_LISTENERS 4
+
+/* The engine's software ID, and the one host requests using it go out under. */
+#define HIDPP_SW_ID 0x0F
+#define HIDPP_HOST_ALIAS_SW_ID 0x0E
+/* Host requests under the alias ID whose answers are still due; more wait. */
+#define HIDPP_MAX_ALIASES 4
+
+#define HIDPP_CACHE_MAX 16
+#define HIDPP_CACHE_VERSION 1
+#define HIDPP_NVS_NAMESPACE "hidpp"
+/* Changes to the cache within this long of each other are saved at once. */
+#define HIDPP_SAVE_DELAY_MS 1000
+
+static const char *tag = "HIDPP";
+
+/* 00010000-0000-1000-8000-011f2000046d and its 0001 characteristic. */
+static const ble_uuid128_t hidpp_svc_uuid =
+    BLE_UUID128_INIT(0x6d, 0x04, 0x00, 0x20, 0x1f, 0x01, 0x00, 0x80,
+                     0x00, 0x10, 0x00, 0x00, 0x00, 0x00, 0x01, 0x00);
+static const ble_uuid128_t hidpp_chr_uuid =
+    BLE_UUID128_INIT(0x6d, 0x04, 0x00, 0x20, 0x1f, 0x01, 0x00, 0x80,
+                     0x00, 0x10, 0x00, 0x00, 0x01, 0x00, 0x01, 0x00);
+
+enum hidpp_req_state
+{
+    REQ_FREE,
+    /* Waiting for the IRoot lookup of its feature. */
+    REQ_WAIT_INDEX,
+    REQ_QUEUED,
+    REQ_SENT,
+};
+
+struct hidpp_req
+{
+    uint8_t state;
+    uint16_t feature_id;
+    uint8_t index;
+    uint8_t function;
+    uint8_t params[HIDPP_PARAMS_LEN];
+    bool retried;
+    int64_t sent_us;
+    hidpp_response_fn *cb;
+    void *arg;
+};
+
+/* Stored as-is in NVS. */
+struct hidpp_cache
+{
+    uint8_t version;
+    uint8_t n;
+    struct
+    {
+        uint16_t feature_id;
+        uint8_t index;
+    } entries[HIDPP_CACHE_MAX];
+};
+
+static struct
+{
+    uint16_t conn_handle;
+    uint16_t val_handle;
+    bool started;
+    char key[16];
+
+    struct hidpp_cache cache;
+
+    struct hidpp_req reqs[HIDPP_MAX_REQUESTS];
+    /* FIFO of queued request slots. */
+    uint8_t queue[HIDPP_MAX_REQUESTS];
+    uint8_t q_head;
+    uint8_t q_len;
+    uint8_t in_flight;
+
+    struct
+    {
+        hidpp_listener_fn *fn;
+        void *arg;
+    } listeners[HIDPP_MAX_LISTENERS];
+    uint8_t nlisteners;
+
+    /* Host requests sent under the alias ID, aliased or the host's own. */
+    struct
+    {
+        uint8_t index;
+        uint8_t function;
+        bool used;
+        bool aliased;
+        uint32_t seq;
+        int64_t sent_us;
+    } aliases[HIDPP_MAX_ALIASES];
+    uint32_t next_seq;
+
+    struct ble_npl_callout timer;
+    struct ble_npl_callout save_timer;
+    bool save_pending;
+    bool timer_init;
+} hp = {
+    .conn_handle = BLE_HS_CONN_HANDLE_NONE,
+};
+
+static struct hidpp_stats stats;
+
+static void pump(void);
+
+static int cache_find(uint16_t feature_id)
+{
+    uint8_t i;
+
+    for (i = 0; i < hp.cache.n; i++)
+    {
+        if (hp.cache.entries[i].feature_id == feature_id)
+        {
+            return hp.cache.entries[i].index;
+        }
+    }
+
+    return -1;
+}
+
+static void cache_save(void)
+{
+    nvs_handle_t nvs;
+    esp_err_t err;
+
+    err = nvs_open(HIDPP_NVS_NAMESPACE, NVS_READWRITE, &nvs);
+    if (err == ESP_OK)
+    {
+        err = nvs_set_blob(nvs, hp.key, &hp.cache, sizeof hp.cache);
+        if (err == ESP_OK)
+        {
+            err = nvs_commit(nvs);
+        }
+        nvs_close(nvs);
+    }
+
+    if (err != ESP_OK)
+    {
+        ESP_LOGW(tag, "failed to save feature indices: %s", esp_err_to_name(err));
+    }
+}
+
+static void on_save_timer(struct ble_npl_event *ev)
+{
+    if (hp.save_pending)
+    {
+        hp.save_pending = false;
+        cache_save();
+    }
+}
+
+/* Called from the notification path, which must not wait on a flash write. */
+static void cache_save_later(void)
+{
+    hp.save_pending = true;
+    ble_npl_callout_reset(&hp.save_timer, ble_npl_time_ms_to_ticks32(HIDPP_SAVE_DELAY_MS));
+}
+
+static void cache_load(void)
+{
+    nvs_handle_t nvs;
+    size_t size = sizeof hp.cache;
+    esp_err_t err = ESP_FAIL;
+
+    if (nvs_open(HIDPP_NVS_NAMESPACE, NVS_READONLY, &nvs) == ESP_OK)
+    {
+        err = nvs_get_blob(nvs, hp.key, &hp.cache, &size);
+        nvs_close(nvs);
+    }
+
+    if (err != ESP_OK || size != sizeof hp.cache ||
+        hp.cache.version != HIDPP_CACHE_VERSION || hp.cache.n > HIDPP_CACHE_MAX)
+    {
+        memset(&hp.cache, 0, sizeof hp.cache);
+        hp.cache.version = HIDPP_CACHE_VERSION;
+    }
+}
+
+static void cache_store(uint16_t feature_id, uint8_t index)
+{
+    if (hp.cache.n == HIDPP_CACHE_MAX)
+    {
+        return;
+    }
+
+    hp.cache.entries[hp.cache.n].feature_id = feature_id;
+    hp.cache.entries[hp.cache.n].index = index;
+    hp.cache.n++;
+    cache_save_later();
+}
+
+static void cache_drop(uint16_t feature_id)
+{
+    uint8_t i;
+
+    for (i = 0; i < hp.cache.n; i++)
+    {
+        if (hp.cache.entries[i].feature_id == feature_id)
+        {
+            hp.cache.entries[i] = hp.cache.entries[--hp.cache.n];
+            cache_save_later();
+            return;
+        }
+    }
+}
+
+static struct hidpp_req *alloc_req(void)
+{
+    uint8_t i;
+
+    for (i = 0; i < HIDPP_MAX_REQUESTS; i++)
+    {
+        if (hp.reqs[i].state == REQ_FREE)
+        {
+            memset(&hp.reqs[i], 0, sizeof hp.reqs[i]);
+            return &hp.reqs[i];
+        }
+    }
+
+    return NULL;
+}
+
+/* Frees the slot before calling back, so the callback may queue again. */
+static void complete(struct hidpp_req *r, int status, const uint8_t *params, size_t len)
+{
+    hidpp_response_fn *cb = r->cb;
+    void *arg = r->arg;
+
+    if (r->state == REQ_SENT)
+    {
+        hp.in_flight--;
+    }
+    r->state = REQ_FREE;
+
+    if (cb != NULL)
+    {
+        cb(status, params, len, arg);
+    }
+}
+
+static void enqueue(struct hidpp_req *r)
+{
+    hp.queue[(hp.q_head + hp.q_len) % HIDPP_MAX_REQUESTS] = r - hp.reqs;
+    hp.q_len++;
+    r->state = REQ_QUEUED;
+
+    if (hp.q_len > stats.queue_depth_max)
+    {
+        stats.queue_depth_max = hp.q_len;
+    }
+
+    pump();
+}
+
+static void pump(void)
+{
+    uint8_t msg[HIDPP_MSG_LEN];
+    struct hidpp_req *r;
+    int rc;
+
+    while (hp.started && hp.q_len > 0 && hp.in_flight < HIDPP_MAX_IN_FLIGHT)
+    {
+        r = &hp.reqs[hp.queue[hp.q_head]];
+
+        msg[0] = HIDPP_DEVICE_INDEX;
+        msg[1] = r->index;
+        msg[2] = r->function << 4 | HIDPP_SW_ID;
+        memcpy(&msg[3], r->params, HIDPP_PARAMS_LEN);
+
+        rc = ble_gattc_write_no_rsp_flat(hp.conn_handle, hp.val_handle, msg, sizeof msg);
+        if (rc == BLE_HS_ENOMEM)
+        {
+            /* Out of mbufs; the request keeps its place. */
+            stats.busy_retries++;
+            ble_npl_callout_reset(&hp.timer, ble_npl_time_ms_to_ticks32(HIDPP_RETRY_MS));
+            return;
+        }
+
+        hp.q_head = (hp.q_head + 1) % HIDPP_MAX_REQUESTS;
+        hp.q_len--;
+
+        if (rc != 0)
+        {
+            complete(r, HIDPP_ERR_DISCONNECTED, NULL, 0);
+            continue;
+        }
+
+        r->state = REQ_SENT;
+        r->sent_us = esp_timer_get_time();
+        hp.in_flight++;
+        ble_npl_callout_reset(&hp.timer, ble_npl_time_ms_to_ticks32(HIDPP_TICK_MS));
+    }
+}
+
+static void on_timer(struct ble_npl_event *ev)
+{
+    int64_t now = esp_timer_get_time();
+    uint8_t i;
+
+    for (i = 0; i < HIDPP_MAX_REQUESTS; i++)
+    {
+        if (hp.reqs[i].state == REQ_SENT &&
+            now - hp.reqs[i].sent_us > HIDPP_TIMEOUT_MS * 1000LL)
+        {
+            stats.timeouts++;
+            complete(&hp.reqs[i], HIDPP_ERR_TIMEOUT, NULL, 0);
+        }
+    }
+
+    pump();
+
+    if (hp.in_flight > 0)
+    {
+        ble_npl_callout_reset(&hp.timer, ble_npl_time_ms_to_ticks32(HIDPP_TICK_MS));
+    }
+}
+
+static void on_root_response(int status, const uint8_t *params, size_t len, void *arg)
+{
+    struct hidpp_req *r = arg;
+
+    if (r->state != REQ_WAIT_INDEX)
+    {
+        return;
+    }
+
+    if (status != 0)
+    {
+        complete(r, status, NULL, 0);
+        return;
+    }
+
+    /* IRoot.getFeature: index, type, version; index 0 means not supported. */
+    if (params[0] == 0)
+    {
+        complete(r, HIDPP_ERR_NO_FEATURE, NULL, 0);
+        return;
+    }
+
+    cache_store(r->feature_id, params[0]);
+    r->index = params[0];
+    enqueue(r);
+}
+
+/* Resolves the feature index of r through IRoot, then queues r. */
+static int lookup(struct hidpp_req *r)
+{
+    struct hidpp_req *root = alloc_req();
+
+    if (root == NULL)
+    {
+        return BLE_HS_ENOMEM;
+    }
+
+    stats.root_lookups++;
+    r->state = REQ_WAIT_INDEX;
+
+    root->feature_id = HIDPP_FEATURE_ROOT;
+    root->index = 0;
+    root->function = 0;
+    root->params[0] = r->feature_id >> 8;
+    root->params[1] = r->feature_id & 0xFF;
+    root->cb = on_root_response;
+    root->arg = r;
+    enqueue(root);
+    return 0;
+}
+
+int hidpp_call(uint16_t feature_id, uint8_t function, const uint8_t *params, size_t len,
+               hidpp_response_fn *cb, void *arg)
+{
+    struct hidpp_req *r;
+    int index;
+    int rc;
+
+    if (hp.conn_handle == BLE_HS_CONN_HANDLE_NONE)
+    {
+        return BLE_HS_ENOTCONN;
+    }
+    if (len > HIDPP_PARAMS_LEN)
+    {
+        return BLE_HS_EINVAL;
+    }
+
+    r = alloc_req();
+    if (r == NULL)
+    {
+        return BLE_HS_ENOMEM;
+    }
+
+    r->feature_id = feature_id;
+    r->function = function;
+    memcpy(r->params, params, len);
+    r->cb = cb;
+    r->arg = arg;
+    stats.requests++;
+
+    index = feature_id == HIDPP_FEATURE_ROOT ? 0 : cache_find(feature_id);
+    if (index >= 0)
+    {
+        if (feature_id != HIDPP_FEATURE_ROOT)
+        {
+            stats.cache_hits++;
+        }
+        r->index = index;
+        enqueue(r);
+        return 0;
+    }
+
+    rc = lookup(r);
+    if (rc != 0)
+    {
+        r->state = REQ_FREE;
+    }
+    return rc;
+}
+
+static struct hidpp_req *find_sent(uint8_t index, uint8_t function_sw_id)
+{
+    uint8_t i;
+
+    for (i = 0; i < HIDPP_MAX_REQUESTS; i++)
+    {
+        struct hidpp_req *r = &hp.reqs[i];
+
+        if (r->state == REQ_SENT && r->index == index &&
+            (r->function << 4 | HIDPP_SW_ID) == function_sw_id)
+        {
+            return r;
+        }
+    }
+
+    return NULL;
+}
+
+/* Lets go of alias entries whose answers are overdue. */
+static void expire_aliases(int64_t now)
+{
+    uint8_t i;
+
+    for (i = 0; i < HIDPP_MAX_ALIASES; i++)
+    {
+        if (hp.aliases[i].used && now - hp.aliases[i].sent_us > HIDPP_TIMEOUT_MS * 1000LL)
+        {
+            hp.aliases[i].used = false;
+        }
+    }
+}
+
+/*
+ * Matches an answer under the alias ID to the oldest host request for its
+ * feature and function, and gives it back 0x0F if that one was aliased.
+ */
+static void unalias(uint8_t index, uint8_t *function_sw_id)
+{
+    uint8_t function = *function_sw_id >> 4;
+    int oldest = -1;
+    uint8_t i;
+
+    if ((*function_sw_id & 0x0F) != HIDPP_HOST_ALIAS_SW_ID)
+    {
+        return;
+    }
+
+    expire_aliases(esp_timer_get_time());
+    for (i = 0; i < HIDPP_MAX_ALIASES; i++)
+    {
+        if (hp.aliases[i].used && hp.aliases[i].index == index &&
+            hp.aliases[i].function == function &&
+            (oldest < 0 || (int32_t)(hp.aliases[i].seq - hp.aliases[oldest].seq) < 0))
+        {
+            oldest = i;
+        }
+    }
+
+    if (oldest < 0)
+    {
+        return;
+    }
+
+    hp.aliases[oldest].used = false;
+    if (hp.aliases[oldest].aliased)
+    {
+        *function_sw_id = function << 4 | HIDPP_SW_ID;
+    }
+}
+
+static void forward(uint8_t *msg, size_t len)
+{
+    uint8_t i;
+
+    if (msg[1] == HIDPP_ERROR_FEATURE)
+    {
+        unalias(msg[2], &msg[3]);
+    }
+    else
+    {
+        unalias(msg[1], &msg[2]);
+    }
+
+    stats.forwarded++;
+    for (i = 0; i < hp.nlisteners; i++)
+    {
+        hp.listeners[i].fn(msg, len, hp.listeners[i].arg);
+    }
+}
+
+int hidpp_send_raw(const uint8_t *msg, size_t len)
+{
+    uint8_t buf[HIDPP_MSG_LEN] = {0};
+    int64_t now = esp_timer_get_time();
+    int slot = -1;
+    bool aliased;
+    uint8_t sw_id;
+    uint8_t i;
+    int rc;
+
+    if (hp.conn_handle == BLE_HS_CONN_HANDLE_NONE || !hp.started)
+    {
+        return BLE_HS_ENOTCONN;
+    }
+    if (len > sizeof buf)
+    {
+        return BLE_HS_EINVAL;
+    }
+
+    /* Short messages are sent padded to long ones. */
+    memcpy(buf, msg, len);
+
+    sw_id = buf[2] & 0x0F;
+    aliased = sw_id == HIDPP_SW_ID;
+    if (aliased || sw_id == HIDPP_HOST_ALIAS_SW_ID)
+    {
+        /* Every answer under the alias ID must find its request. */
+        expire_aliases(now);
+        for (i = 0; i < HIDPP_MAX_ALIASES && slot < 0; i++)
+        {
+            if (!hp.aliases[i].used)
+            {
+                slot = i;
+            }
+        }
+        if (slot < 0)
+        {
+            return BLE_HS_EBUSY;
+        }
+    }
+    if (aliased)
+    {
+        buf[2] = (buf[2] & 0xF0) | HIDPP_HOST_ALIAS_SW_ID;
+    }
+
+    rc = ble_gattc_write_no_rsp_flat(hp.conn_handle, hp.val_handle, buf, sizeof buf);
+    if (rc == 0 && slot >= 0)
+    {
+        hp.aliases[slot].index = buf[1];
+        hp.aliases[slot].function = buf[2] >> 4;
+        hp.aliases[slot].aliased = aliased;
+        hp.aliases[slot].seq = hp.next_seq++;
+        hp.aliases[slot].sent_us = now;
+        hp.aliases[slot].used = true;
+    }
+
+    return rc;
+}
+
+int hidpp_feature_index(uint16_t feature_id)
+{
+    return feature_id == HIDPP_FEATURE_ROOT ? 0 : cache_find(feature_id);
+}
+
+int hidpp_add_listener(hidpp_listener_fn *fn, void *arg)
+{
+    if (hp.nlisteners == HIDPP_MAX_LISTENERS)
+    {
+        return BLE_HS_ENOMEM;
+    }
+
+    hp.listeners[hp.nlisteners].fn = fn;
+    hp.listeners[hp.nlisteners].arg = arg;
+    hp.nlisteners++;
+    return 0;
+}
+
+bool hidpp_on_notify(uint16_t conn_handle, uint16_t attr_handle,
+                     const uint8_t *data, size_t len)
+{
+    uint8_t buf[HIDPP_MSG_LEN] = {0};
+    struct hidpp_req *r;
+    uint32_t rtt;
+
+    if (conn_handle != hp.conn_handle || attr_handle != hp.val_handle)
+    {
+        return false;
+    }
+
+    if (len < HIDPP_MSG_MIN_LEN)
+    {
+        return true;
+    }
+    memcpy(buf, data, len < sizeof buf ? len : sizeof buf);
+
+    if (buf[1] == HIDPP_ERROR_FEATURE)
+    {
+        /* Error: feature index, function/sw id, error code. */
+        r = find_sent(buf[2], buf[3]);
+        if (r == NULL)
+        {
+            forward(buf, sizeof buf);
+            return true;
+        }
+
+        stats.errors++;
+
+        if (buf[4] == HIDPP_ERR_INVALID_FEATURE_INDEX && !r->retried &&
+            r->feature_id != HIDPP_FEATURE_ROOT)
+        {
+            /* The cached index is stale, e.g. after a firmware update. */
+            cache_drop(r->feature_id);
+            r->retried = true;
+            if (lookup(r) == 0)
+            {
+                hp.in_flight--;
+            }
+            else
+            {
+                complete(r, buf[4], NULL, 0);
+            }
+        }
+        else
+        {
+            complete(r, buf[4], NULL, 0);
+        }
+    }
+    else
+    {
+        r = find_sent(buf[1], buf[2]);
+        if (r == NULL)
+        {
+            /* Event, or an answer to someone else's request. */
+            forward(buf, sizeof buf);
+            return true;
+        }
+
+        stats.responses++;
+        rtt = esp_timer_get_time() - r->sent_us;
+        stats.rtt_us_last = rtt;
+        if (rtt > stats.rtt_us_max)
+        {
+            stats.rtt_us_max = rtt;
+        }
+
+        complete(r, 0, &buf[3], HIDPP_PARAMS_LEN);
+    }
+
+    pump();
+    return true;
+}
+
+uint16_t hidpp_attach(const struct peer *peer)
+{
+    const struct peer_chr *chr;
+    const struct peer_dsc *dsc;
+    struct ble_gap_conn_desc desc;
+    const uint8_t *a;
+
+    chr = peer_chr_find_uuid(peer, &hidpp_svc_uuid.u, &hidpp_chr_uuid.u);
+    if (chr == NULL || ble_gap_conn_find(peer->conn_handle, &desc) != 0)
+    {
+        return 0;
+    }
+
+    SLIST_FOREACH(dsc, &chr->dscs, next)
+    {
+        if (ble_uuid_cmp(&dsc->dsc.uuid.u, BLE_UUID16_DECLARE(BLE_GATT_DSC_CLT_CFG_UUID16)) == 0)
+        {
+            break;
+        }
+    }
+    if (dsc == NULL)
+    {
+        return 0;
+    }
+
+    if (!hp.timer_init)
+    {
+        ble_npl_callout_init(&hp.timer, nimble_port_get_dflt_eventq(), on_timer, NULL);
+        ble_npl_callout_init(&hp.save_timer, nimble_port_get_dflt_eventq(), on_save_timer, NULL);
+        hp.timer_init = true;
+    }
+
+    hp.conn_handle = peer->conn_handle;
+    hp.val_handle = chr->chr.val_handle;
+    hp.started = false;
+
+    a = desc.peer_id_addr.val;
+    snprintf(hp.key, sizeof hp.key, "%02x%02x%02x%02x%02x%02x",
+             a[5], a[4], a[3], a[2], a[1], a[0]);
+    cache_load();
+
+    ESP_LOGI(tag, "HID++ on handle 0x%02X, %u cached feature indices",
+             hp.val_handle, hp.cache.n);
+    return dsc->dsc.handle;
+}
+
+void hidpp_start(uint16_t conn_handle)
+{
+    if (conn_handle != hp.conn_handle)
+    {
+        return;
+    }
+
+    hp.started = true;
+    pump();
+}
+
+void hidpp_stop(uint16_t conn_handle)
+{
+    uint8_t i;
+
+    if (conn_handle != hp.conn_handle)
+    {
+        return;
+    }
+
+    ble_npl_callout_stop(&hp.timer);
+    /* The key names this device; save under it before the next one attaches. */
+    ble_npl_callout_stop(&hp.save_timer);
+    on_save_timer(NULL);
+    hp.conn_handle = BLE_HS_CONN_HANDLE_NONE;
+    hp.started = false;
+    hp.q_head = 0;
+    hp.q_len = 0;
+    memset(hp.aliases, 0, sizeof hp.aliases);
+
+    for (i = 0; i < HIDPP_MAX_REQUESTS; i++)
+    {
+        if (hp.reqs[i].state != REQ_FREE)
+        {
+            complete(&hp.reqs[i], HIDPP_ERR_DISCONNECTED, NULL, 0);
+        }
+    }
+    hp.in_flight = 0;
+}
+
+void hidpp_stats_get(struct hidpp_stats *out)
+{
+    *out = stats;
+}
+
+void hidpp_stats_log(void)
+{
+    ESP_LOGI(tag, "requests=%" PRIu32 " responses=%" PRIu32 " errors=%" PRIu32
+                  " timeouts=%" PRIu32 " cache hits/lookups=%" PRIu32 "/%" PRIu32
+                  " forwarded=%" PRIu32 " busy=%" PRIu32 " depth max=%" PRIu32 " rtt last/max=%" PRIu32 "/%" PRIu32 "us",
+             stats.requests, stats.responses, stats.errors, stats.timeouts,
+             stats.cache_hits, stats.root_lookups, stats.forwarded, stats.busy_retries,
+             stats.queue_depth_max, stats.rtt_us_last, stats.rtt_us_max);
+}
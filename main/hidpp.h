@@ -0,0 +1,134 @@
+#ifndef H_HIDPP_
+#define H_HIDPP_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * HID++ 2.0 long message as carried over GATT, i.e. without the report ID:
+ * device index, feature index, function/sw id, params.
+ */
+#define HIDPP_MSG_LEN 19
+#define HIDPP_PARAMS_LEN (HIDPP_MSG_LEN - 3)
+
+/** Feature IDs used by the dongle. */
+#define HIDPP_FEATURE_ROOT 0x0000
+#define HIDPP_FEATURE_FEATURE_SET 0x0001
+
+/** Errors reported by the device, passed as status to the response callback. */
+#define HIDPP_ERR_UNKNOWN 0x01
+#define HIDPP_ERR_INVALID_ARGUMENT 0x02
+#define HIDPP_ERR_OUT_OF_RANGE 0x03
+#define HIDPP_ERR_HW_ERROR 0x04
+#define HIDPP_ERR_INVALID_FEATURE_INDEX 0x06
+#define HIDPP_ERR_INVALID_FUNCTION_ID 0x07
+#define HIDPP_ERR_BUSY 0x08
+#define HIDPP_ERR_UNSUPPORTED 0x09
+
+/** Local failures, negative so they can't collide with device errors. */
+#define HIDPP_ERR_TIMEOUT (-1)
+#define HIDPP_ERR_DISCONNECTED (-2)
+#define HIDPP_ERR_NO_FEATURE (-3)
+
+/**
+ * Called with the response parameters (HIDPP_PARAMS_LEN bytes) when status
+ * is 0, or with an HIDPP_ERR_* status and no parameters.
+ */
+typedef void hidpp_response_fn(int status, const uint8_t *params, size_t len, void *arg);
+
+/** Receives HID++ messages that don't answer one of the engine's requests. */
+typedef void hidpp_listener_fn(const uint8_t *msg, size_t len, void *arg);
+
+struct hidpp_stats {
+    /** Requests queued, answered, failed by the device, and timed out. */
+    uint32_t requests;
+    uint32_t responses;
+    uint32_t errors;
+    uint32_t timeouts;
+
+    /** Feature lookups answered from the cache, and sent to IRoot. */
+    uint32_t cache_hits;
+    uint32_t root_lookups;
+
+    /** Messages handed to listeners: events and answers to raw requests. */
+    uint32_t forwarded;
+
+    /** Writes retried because the host ran out of buffers. */
+    uint32_t busy_retries;
+    uint32_t queue_depth_max;
+
+    /** Request to response time. */
+    uint32_t rtt_us_last;
+    uint32_t rtt_us_max;
+};
+
+struct peer;
+
+/**
+ * Looks up the HID++ characteristic of a freshly discovered peer and loads
+ * the peer's feature index cache.
+ *
+ * @return Handle of the CCCD to enable, 0 if the peer doesn't speak HID++.
+ */
+uint16_t hidpp_attach(const struct peer *peer);
+
+/** Notifications are enabled; starts sending queued requests. */
+void hidpp_start(uint16_t conn_handle);
+
+/** Fails every pending request with HIDPP_ERR_DISCONNECTED. */
+void hidpp_stop(uint16_t conn_handle);
+
+/**
+ * Queues a call of function on a feature.  The feature index comes from the
+ * cache when known, otherwise from an IRoot lookup first.  Requests made
+ * before hidpp_start() wait in the queue.
+ *
+ * @return 0 if cb will be called; BLE_HS_ENOMEM when the queue is full,
+ *         BLE_HS_ENOTCONN without an attached HID++ peer.
+ */
+int hidpp_call(uint16_t feature_id, uint8_t function, const uint8_t *params, size_t len,
+               hidpp_response_fn *cb, void *arg);
+
+/**
+ * Writes a complete HID++ message straight to the device, outside the
+ * engine's queue; the answer goes to the listeners.  Any software ID may be
+ * used: the one the engine keeps for itself is aliased on the air and
+ * restored in the answer.
+ *
+ * @return 0 on success; BLE_HS_ENOMEM when the host is out of buffers,
+ *         BLE_HS_EBUSY while too many answers under the alias ID are due
+ *         (both worth retrying), BLE_HS_ENOTCONN without an attached HID++
+ *         peer.
+ */
+int hidpp_send_raw(const uint8_t *msg, size_t len);
+
+/**
+ * @return Index of a feature on the attached device, -1 until a call to it
+ *         (or an earlier session) has looked it up.
+ */
+int hidpp_feature_index(uint16_t feature_id);
+
+/** Registers a listener for events and answers to raw requests. */
+int hidpp_add_listener(hidpp_listener_fn *fn, void *arg);
+
+/**
+ * Handles a notification.
+ *
+ * @return true if it came from the HID++ characteristic.
+ */
+bool hidpp_on_notify(uint16_t conn_handle, uint16_t attr_handle,
+                     const uint8_t *buf, size_t len);
+
+void hidpp_stats_get(struct hidpp_stats *out);
+void hidpp_stats_log(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,389 @@
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "nvs.h"
+#include "host/ble_hs.h"
+#include "peer.h"
+#include "hogp.h"
+
+/*
+ * HID over GATT client side: turns the peer's Report Map into the decode
+ * table used by hid_map_decode().  Reading the map and one Report
+ * Reference per Report characteristic costs a few round trips, so the
+ * table is stored in NVS keyed by the peer's identity address and read
+ * back on every later connection.
+ */
+
+#define HOGP_UUID_SVC 0x1812
+#define HOGP_UUID_REPORT_MAP 0x2A4B
+#define HOGP_UUID_REPORT 0x2A4D
+#define HOGP_UUID_REPORT_REF 0x2908
+
+#define HOGP_REPORT_TYPE_INPUT 1
+#define HOGP_REPORT_TYPE_OUTPUT 2
+
+/* The HOGP spec caps the Report Map at 512 bytes. */
+#define HOGP_REPORT_MAP_MAX 512
+
+#define HOGP_NVS_NAMESPACE "hidmap"
+
+static const char *tag = "HOGP";
+
+static struct
+{
+    uint16_t conn_handle;
+    bool ready;
+    hogp_ready_fn *ready_cb;
+
+    /* Report characteristic whose reference was read last. */
+    uint16_t cursor;
+    int64_t start_us;
+    char key[16];
+
+    uint8_t desc[HOGP_REPORT_MAP_MAX];
+    uint16_t desc_len;
+    /* The peer's Report Map didn't fit; it is refused once the read ends. */
+    bool desc_overflow;
+
+    struct hid_map map;
+} hg = {
+    .conn_handle = BLE_HS_CONN_HANDLE_NONE,
+};
+
+static struct hogp_stats stats;
+
+static void finish(int status)
+{
+    hogp_ready_fn *cb = hg.ready_cb;
+    uint16_t conn_handle = hg.conn_handle;
+
+    hg.ready = status == 0;
+    hg.ready_cb = NULL;
+
+    if (status != 0)
+    {
+        stats.map_errors++;
+        ESP_LOGW(tag, "no decode table; status=%d", status);
+    }
+
+    if (cb != NULL)
+    {
+        cb(conn_handle, status);
+    }
+}
+
+static bool valid_map(const struct hid_map *map)
+{
+    uint8_t i, j;
+
+    if (map->nreports > HID_MAP_MAX_REPORTS || map->nhandles > HID_MAP_MAX_HANDLES)
+    {
+        return false;
+    }
+
+    for (i = 0; i < map->nreports; i++)
+    {
+        if (map->reports[i].nfields > HID_MAP_MAX_FIELDS)
+        {
+            return false;
+        }
+
+        /* Field sizes as hid_map_parse() accepts them. */
+        for (j = 0; j < map->reports[i].nfields; j++)
+        {
+            if (map->reports[i].fields[j].bit_size == 0 ||
+                map->reports[i].fields[j].bit_size > 32)
+            {
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+static bool load(void)
+{
+    nvs_handle_t nvs;
+    size_t size = sizeof hg.map;
+    esp_err_t err;
+
+    if (nvs_open(HOGP_NVS_NAMESPACE, NVS_READONLY, &nvs) != ESP_OK)
+    {
+        return false;
+    }
+
+    err = nvs_get_blob(nvs, hg.key, &hg.map, &size);
+    nvs_close(nvs);
+
+    /* hid_map_decode() trusts the counts, so a damaged blob mustn't get past. */
+    return err == ESP_OK && size == sizeof hg.map && hg.map.version == HID_MAP_VERSION &&
+           valid_map(&hg.map);
+}
+
+static void save(void)
+{
+    nvs_handle_t nvs;
+    esp_err_t err;
+
+    err = nvs_open(HOGP_NVS_NAMESPACE, NVS_READWRITE, &nvs);
+    if (err == ESP_OK)
+    {
+        err = nvs_set_blob(nvs, hg.key, &hg.map, sizeof hg.map);
+        if (err == ESP_OK)
+        {
+            err = nvs_commit(nvs);
+        }
+        nvs_close(nvs);
+    }
+
+    if (err != ESP_OK)
+    {
+        ESP_LOGW(tag, "failed to cache decode table: %s", esp_err_to_name(err));
+    }
+}
+
+static const struct peer_svc *hid_svc(const struct peer *peer)
+{
+    return peer_svc_find_uuid(peer, BLE_UUID16_DECLARE(HOGP_UUID_SVC));
+}
+
+static int on_report_ref(uint16_t conn_handle, const struct ble_gatt_error *error,
+                         struct ble_gatt_attr *attr, void *arg);
+
+/* Reads the Report Reference of the next Report characteristic, if any. */
+static void read_next_ref(void)
+{
+    const struct peer *peer = peer_find(hg.conn_handle);
+    const struct peer_svc *svc;
+    const struct peer_chr *chr;
+    const struct peer_dsc *dsc;
+    int rc;
+
+    svc = peer != NULL ? hid_svc(peer) : NULL;
+    if (svc == NULL)
+    {
+        finish(BLE_HS_ENOTCONN);
+        return;
+    }
+
+    SLIST_FOREACH(chr, &svc->chrs, next)
+    {
+        if (chr->chr.val_handle <= hg.cursor ||
+            ble_uuid_cmp(&chr->chr.uuid.u, BLE_UUID16_DECLARE(HOGP_UUID_REPORT)) != 0)
+        {
+            continue;
+        }
+
+        hg.cursor = chr->chr.val_handle;
+
+        SLIST_FOREACH(dsc, &chr->dscs, next)
+        {
+            if (ble_uuid_cmp(&dsc->dsc.uuid.u, BLE_UUID16_DECLARE(HOGP_UUID_REPORT_REF)) == 0)
+            {
+                rc = ble_gattc_read(hg.conn_handle, dsc->dsc.handle, on_report_ref,
+                                    (void *)(uintptr_t)chr->chr.val_handle);
+                if (rc != 0)
+                {
+                    finish(rc);
+                }
+                return;
+            }
+        }
+    }
+
+    /* Every Report characteristic has been looked at. */
+    stats.map_reads++;
+    stats.read_us_last = esp_timer_get_time() - hg.start_us;
+    ESP_LOGI(tag, "decode table built in %" PRIu32 " us; %u reports, %u input handles",
+             stats.read_us_last, hg.map.nreports, hg.map.nhandles);
+    save();
+    finish(0);
+}
+
+static int on_report_ref(uint16_t conn_handle, const struct ble_gatt_error *error,
+                         struct ble_gatt_attr *attr, void *arg)
+{
+    uint8_t ref[2];
+
+    if (conn_handle != hg.conn_handle)
+    {
+        return 0;
+    }
+
+    if (error->status != 0)
+    {
+        finish(error->status);
+        return 0;
+    }
+
+    /* Report ID, Report Type. */
+    if (OS_MBUF_PKTLEN(attr->om) >= sizeof ref &&
+        os_mbuf_copydata(attr->om, 0, sizeof ref, ref) == 0)
+    {
+        if (ref[1] == HOGP_REPORT_TYPE_INPUT)
+        {
+            hid_map_add_handle(&hg.map, (uint16_t)(uintptr_t)arg, ref[0]);
+        }
+        else if (ref[1] == HOGP_REPORT_TYPE_OUTPUT && hg.map.out_handle == 0)
+        {
+            /* Keyboards have a single output report, the LEDs. */
+            hg.map.out_handle = (uint16_t)(uintptr_t)arg;
+        }
+    }
+
+    read_next_ref();
+    return 0;
+}
+
+static int on_report_map(uint16_t conn_handle, const struct ble_gatt_error *error,
+                         struct ble_gatt_attr *attr, void *arg)
+{
+    uint16_t len;
+
+    if (conn_handle != hg.conn_handle)
+    {
+        return 0;
+    }
+
+    switch (error->status)
+    {
+    case 0:
+        /* One chunk of the long read. */
+        len = OS_MBUF_PKTLEN(attr->om);
+        if (attr->offset >= sizeof hg.desc || len > sizeof hg.desc - attr->offset)
+        {
+            hg.desc_overflow = true;
+            return 0;
+        }
+        os_mbuf_copydata(attr->om, 0, len, hg.desc + attr->offset);
+        hg.desc_len = attr->offset + len;
+        return 0;
+
+    case BLE_HS_EDONE:
+        if (hg.desc_overflow)
+        {
+            ESP_LOGW(tag, "Report Map over %u bytes", HOGP_REPORT_MAP_MAX);
+            finish(BLE_HS_EMSGSIZE);
+            return 0;
+        }
+        if (hid_map_parse(&hg.map, hg.desc, hg.desc_len) != 0)
+        {
+            finish(BLE_HS_EINVAL);
+            return 0;
+        }
+        hg.cursor = 0;
+        read_next_ref();
+        return 0;
+
+    default:
+        finish(error->status);
+        return 0;
+    }
+}
+
+int hogp_start(const struct peer *peer, hogp_ready_fn *ready)
+{
+    const struct peer_chr *chr;
+    struct ble_gap_conn_desc desc;
+    const uint8_t *a;
+    int rc;
+
+    chr = peer_chr_find_uuid(peer, BLE_UUID16_DECLARE(HOGP_UUID_SVC),
+                             BLE_UUID16_DECLARE(HOGP_UUID_REPORT_MAP));
+    if (chr == NULL || ble_gap_conn_find(peer->conn_handle, &desc) != 0)
+    {
+        return BLE_HS_ENOENT;
+    }
+
+    hg.conn_handle = peer->conn_handle;
+    hg.ready = false;
+    hg.ready_cb = ready;
+    hg.start_us = esp_timer_get_time();
+    memset(&hg.map, 0, sizeof hg.map);
+
+    a = desc.peer_id_addr.val;
+    snprintf(hg.key, sizeof hg.key, "%02x%02x%02x%02x%02x%02x",
+             a[5], a[4], a[3], a[2], a[1], a[0]);
+
+    if (load())
+    {
+        stats.cache_hits++;
+        ESP_LOGI(tag, "decode table loaded from NVS; %u reports, %u input handles",
+                 hg.map.nreports, hg.map.nhandles);
+        finish(0);
+        return 0;
+    }
+
+    memset(&hg.map, 0, sizeof hg.map);
+    hg.desc_len = 0;
+    hg.desc_overflow = false;
+    rc = ble_gattc_read_long(hg.conn_handle, chr->chr.val_handle, 0, on_report_map, NULL);
+    if (rc != 0)
+    {
+        hg.conn_handle = BLE_HS_CONN_HANDLE_NONE;
+        hg.ready_cb = NULL;
+    }
+    return rc;
+}
+
+void hogp_stop(uint16_t conn_handle)
+{
+    if (conn_handle != hg.conn_handle)
+    {
+        return;
+    }
+
+    hg.conn_handle = BLE_HS_CONN_HANDLE_NONE;
+    hg.ready = false;
+    hg.ready_cb = NULL;
+}
+
+int hogp_report_id(uint16_t conn_handle, uint16_t attr_handle)
+{
+    if (!hg.ready || conn_handle != hg.conn_handle)
+    {
+        return -1;
+    }
+
+    return hid_map_report_id(&hg.map, attr_handle);
+}
+
+uint16_t hogp_output_handle(uint16_t conn_handle)
+{
+    if (!hg.ready || conn_handle != hg.conn_handle)
+    {
+        return 0;
+    }
+
+    return hg.map.out_handle;
+}
+
+bool hogp_decode(uint16_t conn_handle, uint16_t attr_handle,
+                 const uint8_t *buf, size_t len, struct hid_input *out)
+{
+    if (!hg.ready || conn_handle != hg.conn_handle ||
+        !hid_map_decode(&hg.map, attr_handle, buf, len, out))
+    {
+        stats.unmapped++;
+        return false;
+    }
+
+    stats.decoded++;
+    return true;
+}
+
+void hogp_stats_get(struct hogp_stats *out)
+{
+    *out = stats;
+}
+
+void hogp_stats_log(void)
+{
+    ESP_LOGI(tag, "tables: %" PRIu32 " from NVS, %" PRIu32 " read (%" PRIu32 " us last), "
+                  "%" PRIu32 " failed; notifications: %" PRIu32 " decoded, %" PRIu32 " unmapped",
+             stats.cache_hits, stats.map_reads, stats.read_us_last, stats.map_errors,
+             stats.decoded, stats.unmapped);
+}
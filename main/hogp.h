@@ -0,0 +1,65 @@
+#ifndef H_HOGP_
+#define H_HOGP_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "hid_map.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct peer;
+
+/** Called once the decode table of a connection is ready, or failed. */
+typedef void hogp_ready_fn(uint16_t conn_handle, int status);
+
+struct hogp_stats {
+    /** Tables loaded from NVS, and read from the peer's Report Map. */
+    uint32_t cache_hits;
+    uint32_t map_reads;
+    uint32_t map_errors;
+
+    /** Time to read the Report Map and all Report References. */
+    uint32_t read_us_last;
+
+    /** Notifications decoded through the table, and left to the caller. */
+    uint32_t decoded;
+    uint32_t unmapped;
+};
+
+/**
+ * Builds the decode table for a peer whose services have been discovered.
+ * The table is loaded from NVS when this peer has been seen before;
+ * otherwise the HID Report Map and the Report Reference of every Report
+ * characteristic are read and the result is cached.
+ *
+ * @return 0 if ready will be called; nonzero if the peer has no HID service.
+ */
+int hogp_start(const struct peer *peer, hogp_ready_fn *ready);
+
+void hogp_stop(uint16_t conn_handle);
+
+/** @return Report ID behind an input report handle, -1 if not known (yet). */
+int hogp_report_id(uint16_t conn_handle, uint16_t attr_handle);
+
+/** @return Value handle of the output report, 0 if there is none (yet). */
+uint16_t hogp_output_handle(uint16_t conn_handle);
+
+/**
+ * Decodes a notification with the table of conn_handle.
+ *
+ * @return false if there is no table yet or the handle isn't an input report.
+ */
+bool hogp_decode(uint16_t conn_handle, uint16_t attr_handle,
+                 const uint8_t *buf, size_t len, struct hid_input *out);
+
+void hogp_stats_get(struct hogp_stats *out);
+void hogp_stats_log(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,176 @@
+#include <inttypes.h>
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "host/ble_hs.h"
+#include "nimble/nimble_port.h"
+#include "hogp.h"
+#include "led.h"
+
+/*
+ * Forwards the host's keyboard LED state (Caps/Num/Scroll Lock) to the
+ * output report of a bridged BLE keyboard.
+ *
+ * SET_REPORT arrives in the TinyUSB task and only replaces a one-slot
+ * mailbox: LED reports are states, so when several arrive before the host
+ * task gets to them only the latest matters.  The host task writes it
+ * without response, so a slow keyboard never holds up notifications, and
+ * skips writes that wouldn't change what the keyboard already shows.
+ */
+
+#define LED_RETRY_MS 5
+
+static const char *tag = "LED";
+
+static portMUX_TYPE led_lock = portMUX_INITIALIZER_UNLOCKED;
+
+/* Latest state from the USB host; dirty until handed to the host task. */
+static uint8_t pending;
+static bool dirty;
+static bool host_set;
+
+/* Only touched from the NimBLE host task. */
+static struct
+{
+    uint16_t conn_handle;
+    uint16_t handle;
+    bool sent_valid;
+    uint8_t sent;
+} ld = {
+    .conn_handle = BLE_HS_CONN_HANDLE_NONE,
+};
+
+static bool initialized;
+static struct ble_npl_event out_ev;
+static struct ble_npl_callout retry;
+
+static struct led_stats stats;
+
+/* Host task: writes the latest LED state, if it changed. */
+static void on_out_event(struct ble_npl_event *ev)
+{
+    uint8_t leds;
+    int rc;
+
+    if (ld.conn_handle == BLE_HS_CONN_HANDLE_NONE || ld.handle == 0)
+    {
+        /* Stays dirty; led_start() sends it. */
+        return;
+    }
+
+    portENTER_CRITICAL(&led_lock);
+    if (!dirty)
+    {
+        portEXIT_CRITICAL(&led_lock);
+        return;
+    }
+    leds = pending;
+    dirty = false;
+    portEXIT_CRITICAL(&led_lock);
+
+    if (ld.sent_valid && leds == ld.sent)
+    {
+        return;
+    }
+
+    rc = ble_gattc_write_no_rsp_flat(ld.conn_handle, ld.handle, &leds, sizeof leds);
+    if (rc == BLE_HS_ENOMEM)
+    {
+        /* Put it back unless the host has moved on already. */
+        portENTER_CRITICAL(&led_lock);
+        if (!dirty)
+        {
+            pending = leds;
+            dirty = true;
+        }
+        portEXIT_CRITICAL(&led_lock);
+
+        stats.retries++;
+        ble_npl_callout_reset(&retry, ble_npl_time_ms_to_ticks32(LED_RETRY_MS));
+        return;
+    }
+
+    if (rc != 0)
+    {
+        stats.errors++;
+        ESP_LOGW(tag, "LED write failed; rc=%d", rc);
+        return;
+    }
+
+    ld.sent = leds;
+    ld.sent_valid = true;
+    stats.writes++;
+}
+
+void led_on_output(const uint8_t *buffer, uint16_t len)
+{
+    if (!initialized || len < 1)
+    {
+        return;
+    }
+
+    portENTER_CRITICAL(&led_lock);
+    if (dirty)
+    {
+        stats.coalesced++;
+    }
+    pending = buffer[0];
+    dirty = true;
+    host_set = true;
+    portEXIT_CRITICAL(&led_lock);
+
+    stats.outputs++;
+    /* A no-op while the event is still queued: the handler reads the latest state. */
+    ble_npl_eventq_put(nimble_port_get_dflt_eventq(), &out_ev);
+}
+
+void led_start(uint16_t conn_handle)
+{
+    ld.conn_handle = conn_handle;
+    ld.handle = hogp_output_handle(conn_handle);
+    ld.sent_valid = false;
+
+    if (ld.handle == 0)
+    {
+        return;
+    }
+
+    /* A keyboard that reconnects comes back with its LEDs off. */
+    portENTER_CRITICAL(&led_lock);
+    dirty = host_set;
+    portEXIT_CRITICAL(&led_lock);
+
+    ESP_LOGI(tag, "LED output report on handle 0x%02X", ld.handle);
+    on_out_event(NULL);
+}
+
+void led_stop(uint16_t conn_handle)
+{
+    if (conn_handle != ld.conn_handle)
+    {
+        return;
+    }
+
+    ld.conn_handle = BLE_HS_CONN_HANDLE_NONE;
+    ld.handle = 0;
+    ble_npl_callout_stop(&retry);
+}
+
+void led_init(void)
+{
+    ble_npl_event_init(&out_ev, on_out_event, NULL);
+    ble_npl_callout_init(&retry, nimble_port_get_dflt_eventq(), on_out_event, NULL);
+    initialized = true;
+}
+
+void led_stats_get(struct led_stats *out)
+{
+    *out = stats;
+}
+
+void led_stats_log(void)
+{
+    ESP_LOGI(tag, "outputs=%" PRIu32 " coalesced=%" PRIu32 " writes=%" PRIu32
+                  " retries=%" PRIu32 " errors=%" PRIu32 " (state 0x%02X)",
+             stats.outputs, stats.coalesced, stats.writes, stats.retries, stats.errors,
+             pending);
+}
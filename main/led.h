@@ -0,0 +1,47 @@
+#ifndef H_LED_
+#define H_LED_
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct led_stats {
+    /** LED output reports received from the USB host. */
+    uint32_t outputs;
+
+    /** Reports replaced by a newer one before they were written. */
+    uint32_t coalesced;
+
+    /** Writes to the keyboard, retried for lack of buffers, and failed. */
+    uint32_t writes;
+    uint32_t retries;
+    uint32_t errors;
+};
+
+/** Call after nimble_port_init(). */
+void led_init(void);
+
+/**
+ * The link is subscribed: looks up the peer's output report and sends it
+ * the host's current LED state, if the host has set one.
+ */
+void led_start(uint16_t conn_handle);
+
+void led_stop(uint16_t conn_handle);
+
+/**
+ * SET_REPORT(Output) on the keyboard interface, from the TinyUSB task.
+ * Only the latest state is kept; it is written from the host task.
+ */
+void led_on_output(const uint8_t *buffer, uint16_t len);
+
+void led_stats_get(struct led_stats *out);
+void led_stats_log(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,423 @@
+#include <inttypes.h>
+#include <string.h>
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "host/ble_hs.h"
+#include "nimble/nimble_port.h"
+#include "report.h"
+#include "loadgen.h"
+
+/*
+ * Test mode measuring how much input the USB side sustains, without a BLE
+ * device.  A high-priority task wakes every tick and posts as many
+ * synthetic notifications as the rate asks for to the NimBLE host's event
+ * queue.  The host task hands them to the GAP event handler in mbufs like
+ * its own, so they take exactly the path of real ones, on the same task:
+ * capture, decoding with the MX Master 3 profile, remapping, the pointer
+ * transform and the report scheduler.  Once a second the load task logs
+ * what came out of that window: USB reports a second, the edge queue's
+ * depth and drops, and the CPU use of all cores.
+ *
+ * Synthetic notifications carry their own connection handle, so the
+ * modules following the real link ignore them.  Keep the real device off
+ * meanwhile: its notifications would mix into the same pointer and report
+ * state.
+ */
+
+#define LOADGEN_WINDOW_US 1000000
+#define LOADGEN_MAX_TASKS 24
+#define LOADGEN_STACK_SIZE 3072
+/* Notifications posted and not yet handled by the host task. */
+#define LOADGEN_POOL 32
+
+/* MX Master 3 report handles (see gen_profiles.py). */
+#define LOADGEN_MOUSE_HANDLE 0x33
+#define LOADGEN_MOUSE_LEN 7
+#define LOADGEN_KEYBOARD_HANDLE 0x2F
+#define LOADGEN_KEYBOARD_LEN 8
+#define LOADGEN_MAX_LEN LOADGEN_KEYBOARD_LEN
+
+/* Button 5, the highest the USB mouse descriptor declares (most hosts take it
+ * as "forward", so run the button patterns away from a browser), and F24,
+ * which hosts rarely bind to anything. */
+#define LOADGEN_BUTTON 0x10
+#define LOADGEN_KEY 0x73
+
+#if CONFIG_DONGLE_LOADGEN_BOOT_MOTION
+#define LOADGEN_BOOT_PATTERN LOADGEN_MOTION
+#elif CONFIG_DONGLE_LOADGEN_BOOT_BUTTONS
+#define LOADGEN_BOOT_PATTERN LOADGEN_BUTTONS
+#elif CONFIG_DONGLE_LOADGEN_BOOT_MIXED
+#define LOADGEN_BOOT_PATTERN LOADGEN_MIXED
+#else
+#define LOADGEN_BOOT_PATTERN LOADGEN_OFF
+#endif
+
+static const char *tag = "LOADGEN";
+
+static const char *const pattern_names[] = {
+    [LOADGEN_OFF] = "off",
+    [LOADGEN_MOTION] = "motion",
+    [LOADGEN_BUTTONS] = "buttons",
+    [LOADGEN_MIXED] = "mixed",
+};
+
+/* Sixteen steps around a circle; they add up to no motion. */
+static const int8_t circle[16][2] = {
+    {4, 0}, {4, 2}, {3, 3}, {2, 4}, {0, 4}, {-2, 4}, {-3, 3}, {-4, 2},
+    {-4, 0}, {-4, -2}, {-3, -3}, {-2, -4}, {0, -4}, {2, -4}, {3, -3}, {4, -2},
+};
+
+/* A synthetic notification on its way through the host's event queue. */
+struct loadgen_msg
+{
+    struct ble_npl_event ev;
+    /* Filled by the load task, released by the host task. */
+    volatile bool busy;
+    uint16_t attr_handle;
+    uint16_t len;
+    uint8_t data[LOADGEN_MAX_LEN];
+};
+
+static struct
+{
+    ble_gap_event_fn *cb;
+    const struct profile *profile;
+    TaskHandle_t task;
+
+    /* Set from other tasks by loadgen_start(). */
+    volatile enum loadgen_pattern pattern;
+    volatile uint32_t rate;
+
+    uint32_t step;
+    uint32_t dir;
+    /* Thousandths of a notification owed to the next tick. */
+    uint32_t credit;
+
+    struct loadgen_msg pool[LOADGEN_POOL];
+    uint32_t next_msg;
+
+    /* The window being measured; the host task adds to the counts. */
+    int64_t window_start;
+    uint32_t injected;
+    uint32_t handler_us_max;
+    uint32_t depth_sum;
+    uint32_t depth_samples;
+    uint32_t depth_max;
+    struct report_stats report;
+    uint32_t total_runtime;
+    uint32_t idle_runtime;
+    uint32_t task_runtime;
+} lg;
+
+/* Only used from the load task. */
+static TaskStatus_t tasks[LOADGEN_MAX_TASKS];
+
+static struct loadgen_stats stats;
+
+/* Runs on the host task, like the GAP events of a real link. */
+static void on_msg(struct ble_npl_event *ev)
+{
+    struct loadgen_msg *m = ble_npl_event_get_arg(ev);
+    struct ble_gap_event event = {
+        .type = BLE_GAP_EVENT_NOTIFY_RX,
+    };
+    struct report_stats rs;
+    int64_t start;
+    uint32_t took;
+
+    event.notify_rx.om = ble_hs_mbuf_from_flat(m->data, m->len);
+    if (event.notify_rx.om == NULL)
+    {
+        stats.alloc_fails++;
+        m->busy = false;
+        return;
+    }
+    event.notify_rx.conn_handle = LOADGEN_CONN_HANDLE;
+    event.notify_rx.attr_handle = m->attr_handle;
+    event.notify_rx.indication = 0;
+    m->busy = false;
+
+    start = esp_timer_get_time();
+    lg.cb(&event, NULL);
+    took = esp_timer_get_time() - start;
+
+    /* The host frees a notification's mbuf once the callback returns. */
+    os_mbuf_free_chain(event.notify_rx.om);
+
+    if (took > lg.handler_us_max)
+    {
+        lg.handler_us_max = took;
+    }
+    lg.injected++;
+    stats.injected++;
+
+    /* Right after each notification, when the queue is deepest. */
+    report_stats_get(&rs);
+    lg.depth_sum += rs.edge_depth;
+    lg.depth_samples++;
+    if (rs.edge_depth > lg.depth_max)
+    {
+        lg.depth_max = rs.edge_depth;
+    }
+}
+
+static void inject(uint16_t attr_handle, const uint8_t *data, uint16_t len)
+{
+    struct loadgen_msg *m = &lg.pool[lg.next_msg];
+
+    /* Slots are taken in order, so the oldest still busy means all are. */
+    if (m->busy)
+    {
+        stats.queue_full++;
+        return;
+    }
+    lg.next_msg = (lg.next_msg + 1) % LOADGEN_POOL;
+
+    m->attr_handle = attr_handle;
+    m->len = len;
+    memcpy(m->data, data, len);
+    m->busy = true;
+    ble_npl_eventq_put(nimble_port_get_dflt_eventq(), &m->ev);
+}
+
+static void inject_mouse(uint8_t buttons, int16_t x, int16_t y)
+{
+    uint8_t buf[LOADGEN_MOUSE_LEN] = {0};
+
+    buf[0] = buttons;
+    buf[2] = x & 0xFF;
+    buf[3] = ((x >> 8) & 0x0F) | (y & 0x0F) << 4;
+    buf[4] = (y >> 4) & 0xFF;
+    inject(LOADGEN_MOUSE_HANDLE, buf, sizeof buf);
+}
+
+static void inject_next(void)
+{
+    uint8_t keys[LOADGEN_KEYBOARD_LEN] = {0};
+    const int8_t *d;
+
+    switch (lg.pattern)
+    {
+    case LOADGEN_MOTION:
+        d = circle[lg.dir++ % 16];
+        inject_mouse(0, d[0], d[1]);
+        break;
+
+    case LOADGEN_BUTTONS:
+        inject_mouse(lg.step & 1 ? 0 : LOADGEN_BUTTON, 0, 0);
+        break;
+
+    case LOADGEN_MIXED:
+        if (lg.step & 1)
+        {
+            /* Modifier, reserved, then the key array. */
+            keys[2] = lg.step & 2 ? LOADGEN_KEY : 0;
+            inject(LOADGEN_KEYBOARD_HANDLE, keys, sizeof keys);
+        }
+        else
+        {
+            d = circle[lg.dir++ % 16];
+            inject_mouse(0, d[0], d[1]);
+        }
+        break;
+
+    default:
+        break;
+    }
+
+    lg.step++;
+}
+
+/* Runtime counters of all tasks: the total, the idle tasks' and our own. */
+static bool read_runtime(uint32_t *total, uint32_t *idle, uint32_t *own)
+{
+    UBaseType_t n;
+    UBaseType_t i;
+
+    n = uxTaskGetSystemState(tasks, LOADGEN_MAX_TASKS, total);
+    *idle = 0;
+    *own = 0;
+
+    for (i = 0; i < n; i++)
+    {
+        /* One idle task per core, "IDLE0", "IDLE1" (or "IDLE" before IDF 5). */
+        if (strncmp(tasks[i].pcTaskName, "IDLE", 4) == 0)
+        {
+            *idle += tasks[i].ulRunTimeCounter;
+        }
+        if (tasks[i].xHandle == lg.task)
+        {
+            *own = tasks[i].ulRunTimeCounter;
+        }
+    }
+
+    return n > 0;
+}
+
+static void window_open(int64_t now)
+{
+    lg.window_start = now;
+    lg.injected = 0;
+    lg.handler_us_max = 0;
+    lg.depth_sum = 0;
+    lg.depth_samples = 0;
+    lg.depth_max = 0;
+    report_stats_get(&lg.report);
+    read_runtime(&lg.total_runtime, &lg.idle_runtime, &lg.task_runtime);
+}
+
+static void window_close(int64_t now)
+{
+    struct report_stats rs;
+    uint32_t us = now - lg.window_start;
+    uint32_t total;
+    uint32_t idle;
+    uint32_t own;
+    uint32_t elapsed;
+    uint32_t sent;
+
+    report_stats_get(&rs);
+    sent = (rs.mouse_sent - lg.report.mouse_sent) + (rs.keyboard_sent - lg.report.keyboard_sent) +
+           (rs.consumer_sent - lg.report.consumer_sent);
+
+    stats.notify_rate = (uint64_t)lg.injected * 1000000 / us;
+    stats.usb_rate = (uint64_t)sent * 1000000 / us;
+    stats.depth_avg_x100 = lg.depth_samples ? lg.depth_sum * 100 / lg.depth_samples : 0;
+    stats.depth_max = lg.depth_max;
+    stats.edge_drops = rs.edge_drops - lg.report.edge_drops;
+    stats.merged = rs.merged - lg.report.merged;
+    stats.handler_us_max = lg.handler_us_max;
+
+    stats.cpu_permille = 0;
+    stats.task_permille = 0;
+    if (read_runtime(&total, &idle, &own))
+    {
+        /* Each core counts its own time. */
+        elapsed = (total - lg.total_runtime) * portNUM_PROCESSORS;
+        if (elapsed > 0)
+        {
+            stats.cpu_permille = 1000 - (uint64_t)(idle - lg.idle_runtime) * 1000 / elapsed;
+            stats.task_permille = (uint64_t)(own - lg.task_runtime) * 1000 / elapsed;
+        }
+    }
+
+    ESP_LOGI(tag, "%s: injected=%" PRIu32 "/s usb=%" PRIu32 "/s depth avg=%" PRIu32 ".%02" PRIu32
+                  " max=%" PRIu32 " edge drops=%" PRIu32 " merged=%" PRIu32
+                  " handler max=%" PRIu32 "us cpu=%" PRIu32 ".%" PRIu32 "%% (load task %" PRIu32
+                  ".%" PRIu32 "%%)",
+             pattern_names[lg.pattern], stats.notify_rate, stats.usb_rate,
+             stats.depth_avg_x100 / 100, stats.depth_avg_x100 % 100, stats.depth_max,
+             stats.edge_drops, stats.merged, stats.handler_us_max, stats.cpu_permille / 10,
+             stats.cpu_permille % 10, stats.task_permille / 10, stats.task_permille % 10);
+
+    window_open(now);
+}
+
+static void load_task(void *param)
+{
+    TickType_t wake = xTaskGetTickCount();
+    int64_t now;
+
+    for (;;)
+    {
+        if (lg.pattern == LOADGEN_OFF)
+        {
+            ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+            wake = xTaskGetTickCount();
+            lg.credit = 0;
+            window_open(esp_timer_get_time());
+            continue;
+        }
+
+        /* Whole notifications this tick; the remainder carries over. */
+        lg.credit += lg.rate * portTICK_PERIOD_MS;
+        while (lg.credit >= 1000)
+        {
+            inject_next();
+            lg.credit -= 1000;
+        }
+
+        now = esp_timer_get_time();
+        if (now - lg.window_start >= LOADGEN_WINDOW_US)
+        {
+            window_close(now);
+        }
+
+        /* Late: the notifications owed are made up on the next passes. */
+        if (xTaskDelayUntil(&wake, 1) == pdFALSE)
+        {
+            stats.overruns++;
+        }
+    }
+}
+
+void loadgen_start(enum loadgen_pattern pattern, uint32_t rate)
+{
+    lg.rate = rate;
+    lg.pattern = pattern;
+    ESP_LOGI(tag, "%s at %" PRIu32 "/s", pattern_names[pattern], rate);
+
+    if (lg.task != NULL)
+    {
+        xTaskNotifyGive(lg.task);
+    }
+}
+
+const struct profile *loadgen_profile(void)
+{
+    return lg.profile;
+}
+
+int loadgen_pattern_parse(const char *name)
+{
+    int i;
+
+    for (i = 0; i < (int)(sizeof pattern_names / sizeof pattern_names[0]); i++)
+    {
+        if (strcmp(name, pattern_names[i]) == 0)
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+void loadgen_init(ble_gap_event_fn *cb)
+{
+    int i;
+
+    lg.cb = cb;
+    for (i = 0; i < LOADGEN_POOL; i++)
+    {
+        ble_npl_event_init(&lg.pool[i].ev, on_msg, &lg.pool[i]);
+    }
+
+    lg.profile = profile_match("MX Master 3");
+    if (xTaskCreate(load_task, "loadgen", LOADGEN_STACK_SIZE, NULL,
+                    CONFIG_DONGLE_LOADGEN_PRIORITY, &lg.task) != pdPASS)
+    {
+        ESP_LOGE(tag, "no memory for the load task");
+        return;
+    }
+
+    if (LOADGEN_BOOT_PATTERN != LOADGEN_OFF)
+    {
+        loadgen_start(LOADGEN_BOOT_PATTERN, CONFIG_DONGLE_LOADGEN_RATE);
+    }
+}
+
+void loadgen_stats_get(struct loadgen_stats *out)
+{
+    *out = stats;
+}
+
+void loadgen_stats_log(void)
+{
+    ESP_LOGI(tag, "%s at %" PRIu32 "/s; injected=%" PRIu32 " alloc fails=%" PRIu32
+                  " queue full=%" PRIu32 " overruns=%" PRIu32,
+             pattern_names[lg.pattern], lg.rate, stats.injected, stats.alloc_fails,
+             stats.queue_full, stats.overruns);
+}
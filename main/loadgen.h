@@ -0,0 +1,80 @@
+#ifndef H_LOADGEN_
+#define H_LOADGEN_
+
+#include <stdint.h>
+#include "host/ble_hs.h"
+#include "profile.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Connection handle of synthetic notifications; above any NimBLE hands out. */
+#define LOADGEN_CONN_HANDLE 0x0EFF
+
+enum loadgen_pattern {
+    LOADGEN_OFF,
+    /** Steady motion along a circle, so the cursor stays put on average. */
+    LOADGEN_MOTION,
+    /** A button pressed and released on every notification. */
+    LOADGEN_BUTTONS,
+    /** Mouse motion and key presses, alternating. */
+    LOADGEN_MIXED,
+};
+
+struct loadgen_stats {
+    /** Notifications injected since boot. */
+    uint32_t injected;
+
+    /** Notifications lost for want of an mbuf, and ticks the task ran late. */
+    uint32_t alloc_fails;
+    uint32_t overruns;
+
+    /** Notifications not posted: the host task was still behind on earlier ones. */
+    uint32_t queue_full;
+
+    /** The last full window: rates per second. */
+    uint32_t notify_rate;
+    uint32_t usb_rate;
+
+    /** The last full window: edge queue depth, average (x100) and peak. */
+    uint32_t depth_avg_x100;
+    uint32_t depth_max;
+
+    /** The last full window: edges lost to a full queue, motion merged. */
+    uint32_t edge_drops;
+    uint32_t merged;
+
+    /** The last full window: CPU use of all cores, and of the load task, in ‰. */
+    uint32_t cpu_permille;
+    uint32_t task_permille;
+
+    /** The last full window: longest GAP handler run for one notification. */
+    uint32_t handler_us_max;
+};
+
+/**
+ * Creates the load task, which posts synthetic notifications to the NimBLE
+ * host's default event queue; the host task hands them to cb as
+ * BLE_GAP_EVENT_NOTIFY_RX events.  Starts the pattern chosen in Kconfig.
+ * Call after nimble_port_init().
+ */
+void loadgen_init(ble_gap_event_fn *cb);
+
+/** Switches to pattern at rate notifications a second; LOADGEN_OFF stops. */
+void loadgen_start(enum loadgen_pattern pattern, uint32_t rate);
+
+/** @return Profile decoding synthetic notifications. */
+const struct profile *loadgen_profile(void);
+
+/** @return The pattern named name ("off", "motion", ...), or -1. */
+int loadgen_pattern_parse(const char *name);
+
+void loadgen_stats_get(struct loadgen_stats *out);
+void loadgen_stats_log(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,246 @@
+#include <string.h>
+#include <inttypes.h>
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "tinyusb.h"
+#include "class/hid/hid_device.h"
+#include "host/ble_hs.h"
+#include "nimble/nimble_port.h"
+#include "hidpp.h"
+#include "passthrough.h"
+#include "trace.h"
+
+/*
+ * Tunnels HID++ between a vendor-defined USB HID interface and the mouse's
+ * HID++ characteristic, so host tools can talk to the device as if it were
+ * behind a Logitech receiver.
+ *
+ * Host requests are queued in the TinyUSB task and written from the NimBLE
+ * host task without response, as fast as the host hands out buffers, so
+ * several requests can share one connection event.  Device messages the
+ * HID++ engine doesn't claim are queued for the vendor IN endpoint, which
+ * is driven one report at a time from its completion callback.  Nothing
+ * here touches the keyboard/mouse interface or its scheduler.
+ */
+
+#define PASSTHROUGH_DEPTH 8
+#define PASSTHROUGH_RETRY_MS 5
+
+static const char *tag = "PASSTHROUGH";
+
+struct msg_ring
+{
+    uint8_t msg[PASSTHROUGH_DEPTH][PASSTHROUGH_LONG_LEN];
+    uint8_t len[PASSTHROUGH_DEPTH];
+    uint8_t head;
+    uint8_t count;
+};
+
+static portMUX_TYPE passthrough_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static struct msg_ring to_device;
+static struct msg_ring to_host;
+
+/* An input report is on the vendor endpoint; its completion sends the next. */
+static bool in_busy;
+
+static bool initialized;
+static struct ble_npl_event out_ev;
+static struct ble_npl_callout retry;
+
+static struct passthrough_stats stats;
+
+/* Caller holds passthrough_lock. */
+static bool ring_push(struct msg_ring *ring, const uint8_t *msg, uint8_t len)
+{
+    uint8_t slot;
+
+    if (ring->count == PASSTHROUGH_DEPTH)
+    {
+        return false;
+    }
+
+    slot = (ring->head + ring->count) % PASSTHROUGH_DEPTH;
+    memcpy(ring->msg[slot], msg, len);
+    ring->len[slot] = len;
+    ring->count++;
+
+    if (ring->count > stats.depth_max)
+    {
+        stats.depth_max = ring->count;
+    }
+    return true;
+}
+
+/* Caller holds passthrough_lock. */
+static void ring_pop(struct msg_ring *ring)
+{
+    ring->head = (ring->head + 1) % PASSTHROUGH_DEPTH;
+    ring->count--;
+}
+
+/* Host task: drains host requests into the HID++ characteristic. */
+static void on_out_event(struct ble_npl_event *ev)
+{
+    uint8_t msg[PASSTHROUGH_LONG_LEN];
+    uint8_t len;
+    int rc;
+
+    for (;;)
+    {
+        portENTER_CRITICAL(&passthrough_lock);
+        if (to_device.count == 0)
+        {
+            portEXIT_CRITICAL(&passthrough_lock);
+            return;
+        }
+        len = to_device.len[to_device.head];
+        memcpy(msg, to_device.msg[to_device.head], len);
+        portEXIT_CRITICAL(&passthrough_lock);
+
+        rc = hidpp_send_raw(msg, len);
+        if (rc == BLE_HS_ENOMEM || rc == BLE_HS_EBUSY)
+        {
+            /* Keep the request at the head and try again shortly. */
+            stats.retries++;
+            ble_npl_callout_reset(&retry, ble_npl_time_ms_to_ticks32(PASSTHROUGH_RETRY_MS));
+            return;
+        }
+
+        portENTER_CRITICAL(&passthrough_lock);
+        ring_pop(&to_device);
+        portEXIT_CRITICAL(&passthrough_lock);
+
+        if (rc == 0)
+        {
+            stats.to_device++;
+        }
+        else
+        {
+            stats.device_drops++;
+        }
+    }
+}
+
+/* Sends the oldest queued device message, or marks the endpoint idle. */
+static void send_next(void)
+{
+    uint8_t msg[PASSTHROUGH_LONG_LEN];
+    bool sent;
+
+    portENTER_CRITICAL(&passthrough_lock);
+    if (to_host.count == 0)
+    {
+        in_busy = false;
+        portEXIT_CRITICAL(&passthrough_lock);
+        return;
+    }
+    memcpy(msg, to_host.msg[to_host.head], sizeof msg);
+    ring_pop(&to_host);
+    portEXIT_CRITICAL(&passthrough_lock);
+
+    TRACE_BEGIN(USB_SUBMIT, PASSTHROUGH_REPORT_LONG);
+    sent = tud_hid_n_report(PASSTHROUGH_ITF, PASSTHROUGH_REPORT_LONG, msg, sizeof msg);
+    TRACE_END(USB_SUBMIT, PASSTHROUGH_REPORT_LONG);
+
+    if (sent)
+    {
+        stats.to_host++;
+        return;
+    }
+
+    stats.host_drops++;
+    portENTER_CRITICAL(&passthrough_lock);
+    in_busy = false;
+    portEXIT_CRITICAL(&passthrough_lock);
+}
+
+/* Host task: a device message nobody else claimed. */
+static void on_device_msg(const uint8_t *msg, size_t len, void *arg)
+{
+    uint8_t buf[PASSTHROUGH_LONG_LEN] = {0};
+    bool start = false;
+    bool queued;
+
+    memcpy(buf, msg, len < sizeof buf ? len : sizeof buf);
+
+    portENTER_CRITICAL(&passthrough_lock);
+    queued = ring_push(&to_host, buf, sizeof buf);
+    if (queued && !in_busy)
+    {
+        in_busy = true;
+        start = true;
+    }
+    portEXIT_CRITICAL(&passthrough_lock);
+
+    if (!queued)
+    {
+        stats.host_drops++;
+    }
+    if (start)
+    {
+        send_next();
+    }
+}
+
+void passthrough_on_output(uint8_t report_id, const uint8_t *buf, uint16_t len)
+{
+    bool queued;
+
+    /* Interrupt OUT transfers arrive with the report ID still in front. */
+    if (report_id == 0 && len > 0)
+    {
+        report_id = buf[0];
+        buf++;
+        len--;
+    }
+
+    if (!initialized ||
+        (report_id == PASSTHROUGH_REPORT_SHORT && len < PASSTHROUGH_SHORT_LEN) ||
+        (report_id == PASSTHROUGH_REPORT_LONG && len < PASSTHROUGH_LONG_LEN) ||
+        (report_id != PASSTHROUGH_REPORT_SHORT && report_id != PASSTHROUGH_REPORT_LONG))
+    {
+        stats.device_drops++;
+        return;
+    }
+
+    portENTER_CRITICAL(&passthrough_lock);
+    queued = ring_push(&to_device, buf,
+                       report_id == PASSTHROUGH_REPORT_SHORT ? PASSTHROUGH_SHORT_LEN
+                                                             : PASSTHROUGH_LONG_LEN);
+    portEXIT_CRITICAL(&passthrough_lock);
+
+    if (!queued)
+    {
+        stats.device_drops++;
+        return;
+    }
+
+    ble_npl_eventq_put(nimble_port_get_dflt_eventq(), &out_ev);
+}
+
+void passthrough_on_complete(void)
+{
+    send_next();
+}
+
+void passthrough_init(void)
+{
+    ble_npl_event_init(&out_ev, on_out_event, NULL);
+    ble_npl_callout_init(&retry, nimble_port_get_dflt_eventq(), on_out_event, NULL);
+    hidpp_add_listener(on_device_msg, NULL);
+    initialized = true;
+}
+
+void passthrough_stats_get(struct passthrough_stats *out)
+{
+    *out = stats;
+}
+
+void passthrough_stats_log(void)
+{
+    ESP_LOGI(tag, "to device=%" PRIu32 " to host=%" PRIu32 " drops device/host=%" PRIu32 "/%" PRIu32
+                  " retries=%" PRIu32 " depth max=%" PRIu32,
+             stats.to_device, stats.to_host, stats.device_drops, stats.host_drops,
+             stats.retries, stats.depth_max);
+}
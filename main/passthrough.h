@@ -0,0 +1,52 @@
+#ifndef H_PASSTHROUGH_
+#define H_PASSTHROUGH_
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** TinyUSB HID instance of the vendor interface. */
+#define PASSTHROUGH_ITF 1
+
+/** HID++ short and long report IDs, as used by Logitech receivers. */
+#define PASSTHROUGH_REPORT_SHORT 0x10
+#define PASSTHROUGH_REPORT_LONG 0x11
+
+/** Report payload sizes, without the report ID. */
+#define PASSTHROUGH_SHORT_LEN 6
+#define PASSTHROUGH_LONG_LEN 19
+
+struct passthrough_stats {
+    /** Host requests written to the device, and device messages sent to the host. */
+    uint32_t to_device;
+    uint32_t to_host;
+
+    /** Messages lost to a full queue, a missing link or an unmounted host. */
+    uint32_t device_drops;
+    uint32_t host_drops;
+
+    /** Writes retried because the BLE host ran out of buffers. */
+    uint32_t retries;
+
+    uint32_t depth_max;
+};
+
+/** Must be called after nimble_port_init(). */
+void passthrough_init(void);
+
+/** Output report from the host on the vendor interface (TinyUSB task). */
+void passthrough_on_output(uint8_t report_id, const uint8_t *buf, uint16_t len);
+
+/** The previous input report on the vendor interface went out (TinyUSB task). */
+void passthrough_on_complete(void);
+
+void passthrough_stats_get(struct passthrough_stats *out);
+void passthrough_stats_log(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
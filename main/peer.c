@@ -8,6 +8,7 @@
 #include <string.h>
 #include "host/ble_hs.h"
 #include "esp_central.h"
+#include "trace.h"
 
 static const char *TAG = "USB_DONGLE";
 
@@ -227,6 +228,8 @@ peer_dsc_disced(uint16_t conn_handle, const struct ble_gatt_error *error,
     struct peer *peer;
     int rc;
 
+    TRACE_BEGIN(DISC_DSC, error->status);
+
     peer = arg;
     assert(peer->conn_handle == conn_handle);
 
@@ -259,6 +262,7 @@ peer_dsc_disced(uint16_t conn_handle, const struct ble_gatt_error *error,
         peer_disc_complete(peer, rc);
     }
 
+    TRACE_END(DISC_DSC, error->status);
     return rc;
 }
 
@@ -400,6 +404,8 @@ peer_chr_disced(uint16_t conn_handle, const struct ble_gatt_error *error,
     struct peer *peer;
     int rc;
 
+    TRACE_BEGIN(DISC_CHR, error->status);
+
     peer = arg;
     assert(peer->conn_handle == conn_handle);
 
@@ -438,6 +444,7 @@ peer_chr_disced(uint16_t conn_handle, const struct ble_gatt_error *error,
         peer_disc_complete(peer, rc);
     }
 
+    TRACE_END(DISC_CHR, error->status);
     return rc;
 }
 
@@ -665,6 +672,8 @@ peer_svc_disced(uint16_t conn_handle, const struct ble_gatt_error *error,
     struct peer *peer;
     int rc;
 
+    TRACE_BEGIN(DISC_SVC, error->status);
+
     peer = arg;
     assert(peer->conn_handle == conn_handle);
 
@@ -702,6 +711,7 @@ peer_svc_disced(uint16_t conn_handle, const struct ble_gatt_error *error,
         peer_disc_complete(peer, rc);
     }
 
+    TRACE_END(DISC_SVC, error->status);
     return rc;
 }
 
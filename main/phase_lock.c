@@ -0,0 +1,339 @@
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include "esp_log.h"
+#include "host/ble_hs.h"
+#include "nimble/nimble_port.h"
+#include "report.h"
+#include "conn_ctrl.h"
+#include "phase_lock.h"
+
+/*
+ * The BLE connection clock and the USB frame clock are independent, so the
+ * point inside a USB frame where a connection event's notifications land
+ * slowly walks around.  Reports that land right after a start of frame wait
+ * almost a whole frame; reports that land right before one go out at once.
+ *
+ * This loop samples the arrival phase of every connection event and, when
+ * it drifts outside a deadband around the target, temporarily runs the link
+ * one interval step (1.25 ms) longer or shorter.  Every event at the
+ * shifted interval moves the anchor by 1250 us modulo the phase period, so
+ * holding it for a computed number of events walks the anchor back to the
+ * target.  The ESP controller has no public anchor-move command, so a
+ * connection parameter update is the only lever available to the host.
+ * Updates go through conn_ctrl, and the loop only steers while the link is
+ * in its fast state.
+ */
+
+#define PHASE_LOCK_ITVL_UNIT_US 1250
+#define PHASE_LOCK_FRAME_US 1000
+
+/* Events between requesting an update and the controller applying it. */
+#define PHASE_LOCK_UPDATE_LAG 7
+
+/* Samples used for one RMS jitter window. */
+#define PHASE_LOCK_WINDOW 64
+
+/* Fresh samples required after a nudge before the error is trusted. */
+#define PHASE_LOCK_SETTLE_SAMPLES 16
+
+static const char *tag = "PHASE_LOCK";
+
+static struct
+{
+    uint16_t conn_handle;
+    uint16_t base_itvl;
+    uint32_t period_us;
+    uint32_t step_us;
+
+    int64_t last_sample_us;
+    int64_t last_nudge_us;
+    uint32_t settle;
+
+    /* A shifted interval is requested or live. */
+    bool nudging;
+    /* Events to spend at the shifted interval. */
+    uint32_t nudge_events;
+
+    uint64_t win_sq_sum;
+    uint32_t win_n;
+    bool have_initial;
+
+    struct ble_npl_callout revert;
+    bool revert_init;
+} pl = {
+    .conn_handle = BLE_HS_CONN_HANDLE_NONE,
+};
+
+static struct phase_lock_stats stats;
+
+static uint32_t gcd(uint32_t a, uint32_t b)
+{
+    while (b != 0)
+    {
+        uint32_t t = a % b;
+        a = b;
+        b = t;
+    }
+
+    return a;
+}
+
+static void on_revert(struct ble_npl_event *ev)
+{
+    if (pl.conn_handle == BLE_HS_CONN_HANDLE_NONE)
+    {
+        return;
+    }
+
+    if (conn_ctrl_nudge(pl.base_itvl, 0) != 0)
+    {
+        /* Another update is in flight; try again shortly. */
+        ble_npl_callout_reset(&pl.revert, ble_npl_time_ms_to_ticks32(10));
+    }
+}
+
+static void set_base(uint16_t itvl)
+{
+    pl.base_itvl = itvl;
+    pl.period_us = gcd(itvl * PHASE_LOCK_ITVL_UNIT_US, PHASE_LOCK_FRAME_US);
+    pl.step_us = PHASE_LOCK_ITVL_UNIT_US % pl.period_us;
+    pl.settle = PHASE_LOCK_SETTLE_SAMPLES;
+    pl.win_sq_sum = 0;
+    pl.win_n = 0;
+    pl.have_initial = false;
+
+    stats.period_us = pl.period_us;
+    stats.err_avg_us = 0;
+}
+
+#if CONFIG_DONGLE_PHASE_LOCK
+/* Plans a nudge that walks the anchor by -err (mod period). */
+static void nudge(int32_t err, int64_t now)
+{
+    uint32_t shift;
+    uint32_t cycle;
+    int dir;
+
+    if (pl.step_us == 0)
+    {
+        /* Interval is a whole number of frames plus a multiple of the
+         * period; one step can't move the phase. */
+        return;
+    }
+
+    /* Within half a step of the target is as close as a nudge gets. */
+    shift = (uint32_t)abs(err);
+    if (2 * shift <= pl.step_us)
+    {
+        return;
+    }
+
+    /* A longer interval delays the anchor: use it when arriving early. */
+    dir = err < 0 ? 1 : -1;
+    pl.nudge_events = (shift + pl.step_us / 2) / pl.step_us;
+    cycle = pl.period_us / gcd(pl.period_us, pl.step_us);
+
+    /* Already at the shortest interval: delay the anchor the long way
+     * round instead. */
+    if (dir < 0 && pl.base_itvl <= BLE_HCI_CONN_ITVL_MIN)
+    {
+        dir = 1;
+        pl.nudge_events = cycle - pl.nudge_events;
+    }
+
+    /* The change only lands PHASE_LOCK_UPDATE_LAG events after the
+     * request, so the shortest possible nudge is that long.  Pad it with
+     * whole trips round the period, which leave the net shift alone. */
+    while (pl.nudge_events < PHASE_LOCK_UPDATE_LAG)
+    {
+        pl.nudge_events += cycle;
+    }
+
+    pl.last_nudge_us = now;
+    if (conn_ctrl_nudge(pl.base_itvl, dir) != 0)
+    {
+        stats.rejected++;
+        return;
+    }
+
+    pl.nudging = true;
+    stats.nudges++;
+}
+#endif
+
+void phase_lock_on_notify(uint16_t conn_handle, int64_t now)
+{
+    int64_t sof;
+    int32_t phase;
+    int32_t err;
+
+    if (conn_handle != pl.conn_handle || pl.period_us == 0)
+    {
+        return;
+    }
+
+    sof = report_last_sof_us();
+    if (sof == 0)
+    {
+        return;
+    }
+
+    /* Several notifications can share one connection event; only the
+     * first one marks the anchor. */
+    if (now - pl.last_sample_us < pl.base_itvl * PHASE_LOCK_ITVL_UNIT_US / 2)
+    {
+        pl.last_sample_us = now;
+        return;
+    }
+    pl.last_sample_us = now;
+
+    phase = (int32_t)((now - sof) % pl.period_us);
+    err = phase - (int32_t)(pl.period_us * CONFIG_DONGLE_PHASE_LOCK_TARGET_US / PHASE_LOCK_FRAME_US);
+    if (err >= (int32_t)pl.period_us / 2)
+    {
+        err -= pl.period_us;
+    }
+    else if (err < -(int32_t)pl.period_us / 2)
+    {
+        err += pl.period_us;
+    }
+
+    stats.samples++;
+    stats.err_avg_us += (err - stats.err_avg_us) / 8;
+
+    pl.win_sq_sum += (uint64_t)((int64_t)err * err);
+    if (++pl.win_n == PHASE_LOCK_WINDOW)
+    {
+        uint32_t mean = (uint32_t)(pl.win_sq_sum / PHASE_LOCK_WINDOW);
+        uint32_t rms = 0;
+
+        while ((rms + 1) * (rms + 1) <= mean)
+        {
+            rms++;
+        }
+
+        stats.jitter_us = rms;
+        if (!pl.have_initial)
+        {
+            stats.jitter_initial_us = rms;
+            pl.have_initial = true;
+        }
+        pl.win_sq_sum = 0;
+        pl.win_n = 0;
+    }
+
+    if (pl.settle > 0)
+    {
+        if (--pl.settle == 0)
+        {
+            stats.err_avg_us = err;
+        }
+        return;
+    }
+
+#if CONFIG_DONGLE_PHASE_LOCK
+    if (pl.nudging || !conn_ctrl_is_fast())
+    {
+        return;
+    }
+
+    if (abs(stats.err_avg_us) <= CONFIG_DONGLE_PHASE_LOCK_DEADBAND_US)
+    {
+        return;
+    }
+
+    if (now - pl.last_nudge_us < CONFIG_DONGLE_PHASE_LOCK_HOLDOFF_MS * 1000LL)
+    {
+        return;
+    }
+
+    nudge(stats.err_avg_us, now);
+#endif
+}
+
+void phase_lock_on_params(uint16_t conn_handle, const struct ble_gap_conn_desc *desc, int nudge)
+{
+    if (conn_handle != pl.conn_handle)
+    {
+        return;
+    }
+
+    if (nudge != 0)
+    {
+        /* Shifted interval is live; come back once the anchor has moved
+         * far enough, minus the events the revert itself takes to land.
+         * Aim between two events: a whole-ms timer aimed at an event fires
+         * just before it and would cost a step. */
+        uint32_t itvl_us = desc->conn_itvl * PHASE_LOCK_ITVL_UNIT_US;
+        uint32_t ms = ((pl.nudge_events - PHASE_LOCK_UPDATE_LAG) * itvl_us + itvl_us / 2) / 1000;
+
+        ble_npl_callout_reset(&pl.revert, ble_npl_time_ms_to_ticks32(ms));
+        return;
+    }
+
+    pl.nudging = false;
+    if (desc->conn_itvl != pl.base_itvl)
+    {
+        set_base(desc->conn_itvl);
+    }
+    else
+    {
+        pl.settle = PHASE_LOCK_SETTLE_SAMPLES;
+    }
+}
+
+void phase_lock_start(uint16_t conn_handle)
+{
+    struct ble_gap_conn_desc desc;
+    int rc;
+
+    rc = ble_gap_conn_find(conn_handle, &desc);
+    if (rc != 0)
+    {
+        return;
+    }
+
+    if (!pl.revert_init)
+    {
+        ble_npl_callout_init(&pl.revert, nimble_port_get_dflt_eventq(), on_revert, NULL);
+        pl.revert_init = true;
+    }
+
+    pl.conn_handle = conn_handle;
+    pl.nudging = false;
+    pl.last_sample_us = 0;
+    pl.last_nudge_us = 0;
+    set_base(desc.conn_itvl);
+    stats.jitter_initial_us = 0;
+    stats.jitter_us = 0;
+}
+
+void phase_lock_stop(uint16_t conn_handle)
+{
+    if (conn_handle != pl.conn_handle)
+    {
+        return;
+    }
+
+    ble_npl_callout_stop(&pl.revert);
+    pl.conn_handle = BLE_HS_CONN_HANDLE_NONE;
+    pl.period_us = 0;
+}
+
+void phase_lock_stats_get(struct phase_lock_stats *out)
+{
+    *out = stats;
+}
+
+void phase_lock_stats_log(void)
+{
+    struct phase_lock_stats s;
+
+    phase_lock_stats_get(&s);
+
+    ESP_LOGI(tag, "samples=%" PRIu32 " nudges=%" PRIu32 " rejected=%" PRIu32
+                  " period=%" PRIu32 "us err=%" PRId32 "us jitter initial/now=%" PRIu32 "/%" PRIu32 "us",
+             s.samples, s.nudges, s.rejected, s.period_us, s.err_avg_us,
+             s.jitter_initial_us, s.jitter_us);
+}
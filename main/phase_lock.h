@@ -0,0 +1,57 @@
+#ifndef H_PHASE_LOCK_
+#define H_PHASE_LOCK_
+
+#include <stdint.h>
+#include "host/ble_gap.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct phase_lock_stats {
+    /** Connection events sampled (first notification of each event). */
+    uint32_t samples;
+
+    /** Interval nudges requested to move the anchor. */
+    uint32_t nudges;
+
+    /** Nudges that couldn't be requested. */
+    uint32_t rejected;
+
+    /** Repeat period of the arrival phase, gcd(BLE interval, 1 ms). */
+    uint32_t period_us;
+
+    /** Smoothed signed distance from the target phase. */
+    int32_t err_avg_us;
+
+    /** RMS phase error over the first complete window of the connection. */
+    uint32_t jitter_initial_us;
+
+    /** RMS phase error over the most recent complete window. */
+    uint32_t jitter_us;
+};
+
+/** Starts tracking a freshly established connection. */
+void phase_lock_start(uint16_t conn_handle);
+
+/** Stops tracking; called on disconnect. */
+void phase_lock_stop(uint16_t conn_handle);
+
+/** Feeds the arrival time (esp_timer clock, us) of a notification. */
+void phase_lock_on_notify(uint16_t conn_handle, int64_t now);
+
+/**
+ * Called by conn_ctrl whenever the link's parameters may have changed.
+ *
+ * @param nudge  Interval step offset now live on the link, 0 at nominal.
+ */
+void phase_lock_on_params(uint16_t conn_handle, const struct ble_gap_conn_desc *desc, int nudge);
+
+void phase_lock_stats_get(struct phase_lock_stats *out);
+void phase_lock_stats_log(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
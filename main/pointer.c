@@ -0,0 +1,119 @@
+#include <stdlib.h>
+#include <inttypes.h>
+#include "esp_log.h"
+#include "esp_cpu.h"
+#include "sdkconfig.h"
+#include "pointer.h"
+#include "pointer_lut.h"
+
+/*
+ * Motion transform between the BLE decode and the USB report, so pointer
+ * feel is the same on every host OS without host-side drivers.  Values run
+ * through the pipeline in Q8 (1/256 count); whatever doesn't make a whole
+ * count is carried into the next sample instead of being rounded away.
+ *
+ * The acceleration curve and the rotation constants come from
+ * pointer_lut.h, generated at build time from Kconfig by
+ * gen_pointer_lut.py.
+ */
+
+#define POINTER_Q 8
+
+static const char *tag = "POINTER";
+
+static int32_t smooth_x;
+static int32_t smooth_y;
+static int32_t rem_x;
+static int32_t rem_y;
+
+static struct pointer_stats stats;
+
+void pointer_reset(void)
+{
+    smooth_x = 0;
+    smooth_y = 0;
+    rem_x = 0;
+    rem_y = 0;
+}
+
+void pointer_transform(int32_t *dx, int32_t *dy)
+{
+    uint32_t start = esp_cpu_get_cycle_count();
+    int32_t x = *dx * (1 << POINTER_Q);
+    int32_t y = *dy * (1 << POINTER_Q);
+    uint32_t ax, ay, speed;
+    int32_t gain;
+
+#if CONFIG_DONGLE_POINTER_ROTATION_DEG != 0
+    {
+        int32_t rx = (int32_t)(((int64_t)x * POINTER_ROT_COS_Q14 - (int64_t)y * POINTER_ROT_SIN_Q14) >> 14);
+        int32_t ry = (int32_t)(((int64_t)x * POINTER_ROT_SIN_Q14 + (int64_t)y * POINTER_ROT_COS_Q14) >> 14);
+
+        x = rx;
+        y = ry;
+    }
+#endif
+
+#if CONFIG_DONGLE_POINTER_SMOOTHING > 0
+    /* One-pole low-pass; what it holds back comes out with later samples. */
+    smooth_x += (x - smooth_x) >> CONFIG_DONGLE_POINTER_SMOOTHING;
+    smooth_y += (y - smooth_y) >> CONFIG_DONGLE_POINTER_SMOOTHING;
+    x = smooth_x;
+    y = smooth_y;
+#endif
+
+    /* Octagonal approximation of the vector length. */
+    ax = abs(x);
+    ay = abs(y);
+    speed = (ax > ay ? ax + ay / 2 : ay + ax / 2) >> POINTER_Q;
+    if (speed >= POINTER_LUT_SIZE)
+    {
+        speed = POINTER_LUT_SIZE - 1;
+    }
+
+    gain = pointer_accel_lut[speed] * CONFIG_DONGLE_POINTER_SCALE_PCT / 100;
+    x = (int32_t)(((int64_t)x * gain) >> POINTER_Q);
+    y = (int32_t)(((int64_t)y * gain) >> POINTER_Q);
+
+#if CONFIG_DONGLE_POINTER_ANGLE_SNAP
+    /* Drop the minor axis of nearly straight strokes. */
+    if (abs(y) * CONFIG_DONGLE_POINTER_SNAP_RATIO < abs(x))
+    {
+        y = 0;
+    }
+    else if (abs(x) * CONFIG_DONGLE_POINTER_SNAP_RATIO < abs(y))
+    {
+        x = 0;
+    }
+#endif
+
+    rem_x += x;
+    rem_y += y;
+    *dx = rem_x >> POINTER_Q;
+    *dy = rem_y >> POINTER_Q;
+    rem_x -= *dx * (1 << POINTER_Q);
+    rem_y -= *dy * (1 << POINTER_Q);
+
+    uint32_t cycles = esp_cpu_get_cycle_count() - start;
+    stats.samples++;
+    stats.cycles_sum += cycles;
+    if (cycles > stats.cycles_max)
+    {
+        stats.cycles_max = cycles;
+    }
+}
+
+void pointer_stats_get(struct pointer_stats *out)
+{
+    *out = stats;
+}
+
+void pointer_stats_log(void)
+{
+    struct pointer_stats s;
+
+    pointer_stats_get(&s);
+
+    ESP_LOGI(tag, "samples=%" PRIu32 " cycles avg=%" PRIu32 " max=%" PRIu32,
+             s.samples, s.samples ? (uint32_t)(s.cycles_sum / s.samples) : 0, s.cycles_max);
+}
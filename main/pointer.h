@@ -0,0 +1,38 @@
+#ifndef H_POINTER_
+#define H_POINTER_
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct pointer_stats {
+    /** Motion samples transformed. */
+    uint32_t samples;
+
+    /** CPU cycles spent in pointer_transform(). */
+    uint64_t cycles_sum;
+    uint32_t cycles_max;
+};
+
+/** Clears the filter state and sub-pixel remainders, e.g. on reconnect. */
+void pointer_reset(void);
+
+/**
+ * Runs one motion sample through the transform pipeline: rotation,
+ * smoothing, acceleration, scaling, angle snapping and sub-pixel
+ * accumulation.  All arithmetic is fixed point.
+ *
+ * @param dx, dy  Sensor counts in, pointer counts out.
+ */
+void pointer_transform(int32_t *dx, int32_t *dy);
+
+void pointer_stats_get(struct pointer_stats *out);
+void pointer_stats_log(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,341 @@
+#include <inttypes.h>
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_cpu.h"
+#include "esp_pm.h"
+#include "freertos/FreeRTOS.h"
+#include "tinyusb.h"
+#include "nimble/nimble_port.h"
+#include "report.h"
+#include "conn_ctrl.h"
+#include "scan.h"
+#include "power.h"
+
+/*
+ * Power management.  The chip runs under esp_pm dynamic frequency scaling
+ * with automatic light sleep, and the code that needs speed says so with
+ * power management locks:
+ *
+ * - While USB is active the controller needs its clocks, so an APB lock is
+ *   held from resume to suspend.  The CPU itself may still drop to the
+ *   lowest frequency between inputs.
+ * - The USB controller is no light sleep wakeup source: asleep, the chip
+ *   could miss the host's resume or bus reset.  So a no-light-sleep lock is
+ *   held from boot, suspended or not.
+ * - Input holds the CPU at full speed and keeps the chip out of light
+ *   sleep from the first notification until CONFIG_DONGLE_PM_IDLE_MS after
+ *   the last one.  The notify path only stores a timestamp while the locks
+ *   are already held; taking them happens once per burst of activity, and
+ *   letting them go is left to a timer.  Without
+ *   CONFIG_DONGLE_PM_ACTIVITY_LOCKS they are held instead from resume to
+ *   suspend, like the USB APB lock.
+ *
+ * While the host sleeps nobody reads the reports, so the APB lock goes, the
+ * BLE link drops to the longest interval with peripheral latency, and the
+ * CPU idles at the lowest frequency between connection events.  Input
+ * isn't thrown away when the host allowed remote wakeup: the first button
+ * or key press signals resume and the queued edges go out once frames are
+ * back (see report_set_suspended()).
+ *
+ * The TinyUSB callbacks only record the new state; the link and lock
+ * changes are made from the NimBLE host task, which owns the connection.
+ */
+
+static const char *tag = "POWER";
+
+static portMUX_TYPE power_lock = portMUX_INITIALIZER_UNLOCKED;
+
+/* Latest USB state, written by the TinyUSB task. */
+static bool usb_suspended;
+
+/* State applied by the host task. */
+static bool applied;
+static int64_t suspended_since_us;
+
+static bool initialized;
+static struct ble_npl_event change_ev;
+
+#if CONFIG_PM_ENABLE
+static esp_pm_lock_handle_t usb_apb_lock;
+static esp_pm_lock_handle_t usb_sleep_lock;
+static esp_pm_lock_handle_t input_cpu_lock;
+static esp_pm_lock_handle_t input_sleep_lock;
+static bool usb_locks_held;
+#if !CONFIG_DONGLE_PM_ACTIVITY_LOCKS
+static bool input_locks_held;
+#endif
+#endif
+
+#if CONFIG_DONGLE_PM_ACTIVITY_LOCKS
+/* Low 32 bits of the esp_timer clock; differences survive the wrap. */
+static volatile uint32_t last_input_us;
+static volatile bool input_active;
+static int64_t active_since_us;
+static esp_timer_handle_t idle_timer;
+#endif
+
+static struct power_stats stats;
+
+static void check(esp_err_t err, const char *what)
+{
+    if (err != ESP_OK)
+    {
+        stats.pm_errors++;
+        ESP_LOGW(tag, "%s: %s", what, esp_err_to_name(err));
+    }
+}
+
+static void set_usb_locks(bool held)
+{
+#if CONFIG_PM_ENABLE
+    if (held == usb_locks_held)
+    {
+        return;
+    }
+    usb_locks_held = held;
+
+    if (held)
+    {
+        check(esp_pm_lock_acquire(usb_apb_lock), "USB APB lock");
+    }
+    else
+    {
+        check(esp_pm_lock_release(usb_apb_lock), "USB APB lock");
+    }
+#else
+    (void)held;
+#endif
+}
+
+/* Without activity locks: input runs at full speed while the host is awake. */
+static void set_input_locks(bool held)
+{
+#if CONFIG_PM_ENABLE && !CONFIG_DONGLE_PM_ACTIVITY_LOCKS
+    if (held == input_locks_held)
+    {
+        return;
+    }
+    input_locks_held = held;
+
+    if (held)
+    {
+        check(esp_pm_lock_acquire(input_cpu_lock), "input CPU lock");
+        check(esp_pm_lock_acquire(input_sleep_lock), "input sleep lock");
+    }
+    else
+    {
+        check(esp_pm_lock_release(input_cpu_lock), "input CPU lock");
+        check(esp_pm_lock_release(input_sleep_lock), "input sleep lock");
+    }
+#else
+    (void)held;
+#endif
+}
+
+#if CONFIG_DONGLE_PM_ACTIVITY_LOCKS
+static void activate(void)
+{
+    bool take = false;
+
+    portENTER_CRITICAL(&power_lock);
+    if (!input_active)
+    {
+        input_active = true;
+        take = true;
+    }
+    portEXIT_CRITICAL(&power_lock);
+
+    if (!take)
+    {
+        return;
+    }
+
+    check(esp_pm_lock_acquire(input_cpu_lock), "input CPU lock");
+    check(esp_pm_lock_acquire(input_sleep_lock), "input sleep lock");
+    active_since_us = esp_timer_get_time();
+    stats.activations++;
+    esp_timer_start_once(idle_timer, CONFIG_DONGLE_PM_IDLE_MS * 1000);
+}
+
+/* esp_timer task: lets the locks go once input has been quiet long enough. */
+static void on_idle_timer(void *arg)
+{
+    int64_t now = esp_timer_get_time();
+    uint32_t quiet;
+    bool release = false;
+
+    portENTER_CRITICAL(&power_lock);
+    quiet = (uint32_t)now - last_input_us;
+    if (quiet >= CONFIG_DONGLE_PM_IDLE_MS * 1000)
+    {
+        input_active = false;
+        release = true;
+    }
+    portEXIT_CRITICAL(&power_lock);
+
+    if (!release)
+    {
+        esp_timer_start_once(idle_timer, CONFIG_DONGLE_PM_IDLE_MS * 1000 - quiet);
+        return;
+    }
+
+    stats.active_us += now - active_since_us;
+    check(esp_pm_lock_release(input_cpu_lock), "input CPU lock");
+    check(esp_pm_lock_release(input_sleep_lock), "input sleep lock");
+}
+#endif
+
+void power_on_input(int64_t now)
+{
+#if CONFIG_DONGLE_PM_ACTIVITY_LOCKS
+    uint32_t start = esp_cpu_get_cycle_count();
+    uint32_t cycles;
+
+    last_input_us = (uint32_t)now;
+    if (input_active)
+    {
+        cycles = esp_cpu_get_cycle_count() - start;
+        if (cycles > stats.hot_cycles_max)
+        {
+            stats.hot_cycles_max = cycles;
+        }
+        return;
+    }
+
+    activate();
+    cycles = esp_cpu_get_cycle_count() - start;
+    if (cycles > stats.activate_cycles_max)
+    {
+        stats.activate_cycles_max = cycles;
+    }
+#else
+    (void)now;
+#endif
+}
+
+/* Host task. */
+static void on_change_event(struct ble_npl_event *ev)
+{
+    int64_t now = esp_timer_get_time();
+    bool suspended;
+
+    portENTER_CRITICAL(&power_lock);
+    suspended = usb_suspended;
+    portEXIT_CRITICAL(&power_lock);
+
+    if (suspended == applied)
+    {
+        return;
+    }
+    applied = suspended;
+
+    if (suspended)
+    {
+        suspended_since_us = now;
+    }
+    else
+    {
+        stats.suspended_us += now - suspended_since_us;
+    }
+
+    ESP_LOGI(tag, "USB %s", suspended ? "suspended" : "resumed");
+    conn_ctrl_set_suspended(suspended);
+    set_usb_locks(!suspended);
+    set_input_locks(!suspended);
+}
+
+static void post(bool suspended)
+{
+    portENTER_CRITICAL(&power_lock);
+    usb_suspended = suspended;
+    portEXIT_CRITICAL(&power_lock);
+
+    /* USB can come up before the host stack. */
+    if (initialized)
+    {
+        ble_npl_eventq_put(nimble_port_get_dflt_eventq(), &change_ev);
+    }
+}
+
+void tud_suspend_cb(bool remote_wakeup_en)
+{
+    stats.suspends++;
+    if (remote_wakeup_en)
+    {
+        stats.wakeup_enabled++;
+    }
+
+    report_set_suspended(true, remote_wakeup_en);
+    post(true);
+}
+
+void tud_resume_cb(void)
+{
+    stats.resumes++;
+
+    report_set_suspended(false, false);
+    post(false);
+
+    /* The host is back; it may well be about to use the mouse. */
+    scan_boost();
+}
+
+void power_init(void)
+{
+#if CONFIG_PM_ENABLE
+    esp_pm_config_t cfg = {
+        .max_freq_mhz = CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ,
+        .min_freq_mhz = CONFIG_DONGLE_PM_MIN_CPU_MHZ,
+#if CONFIG_FREERTOS_USE_TICKLESS_IDLE
+        .light_sleep_enable = true,
+#endif
+    };
+
+    check(esp_pm_lock_create(ESP_PM_APB_FREQ_MAX, 0, "usb", &usb_apb_lock), "create lock");
+    check(esp_pm_lock_create(ESP_PM_NO_LIGHT_SLEEP, 0, "usb", &usb_sleep_lock), "create lock");
+    check(esp_pm_lock_create(ESP_PM_CPU_FREQ_MAX, 0, "input", &input_cpu_lock), "create lock");
+    check(esp_pm_lock_create(ESP_PM_NO_LIGHT_SLEEP, 0, "input", &input_sleep_lock), "create lock");
+
+    /* Take the USB locks before the clock is allowed to drop.  The sleep
+     * lock is never let go, so the controller always sees resume. */
+    set_usb_locks(true);
+    check(esp_pm_lock_acquire(usb_sleep_lock), "USB sleep lock");
+    check(esp_pm_configure(&cfg), "configure");
+
+#if CONFIG_DONGLE_PM_ACTIVITY_LOCKS
+    const esp_timer_create_args_t args = {
+        .callback = on_idle_timer,
+        .name = "pm_idle",
+    };
+    ESP_ERROR_CHECK(esp_timer_create(&args, &idle_timer));
+#else
+    /* Baseline for comparison: full speed until the host suspends. */
+    set_input_locks(true);
+#endif
+#endif
+
+    ble_npl_event_init(&change_ev, on_change_event, NULL);
+    initialized = true;
+
+    /* A suspend before the host stack was up. */
+    ble_npl_eventq_put(nimble_port_get_dflt_eventq(), &change_ev);
+}
+
+void power_stats_get(struct power_stats *out)
+{
+    *out = stats;
+}
+
+void power_stats_log(void)
+{
+    ESP_LOGI(tag, "%s; suspends=%" PRIu32 " (wakeup enabled %" PRIu32 ") resumes=%" PRIu32
+                  " suspended=%" PRIu64 "ms pm errors=%" PRIu32,
+             applied ? "suspended" : "active", stats.suspends, stats.wakeup_enabled,
+             stats.resumes, stats.suspended_us / 1000, stats.pm_errors);
+#if CONFIG_DONGLE_PM_ACTIVITY_LOCKS
+    ESP_LOGI(tag, "input locks: activations=%" PRIu32 " held=%" PRIu64 "ms"
+                  " cycles hot/activate max=%" PRIu32 "/%" PRIu32,
+             stats.activations, stats.active_us / 1000, stats.hot_cycles_max,
+             stats.activate_cycles_max);
+#endif
+}
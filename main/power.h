@@ -0,0 +1,58 @@
+#ifndef H_POWER_
+#define H_POWER_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct power_stats {
+    /** USB suspends and resumes seen. */
+    uint32_t suspends;
+    uint32_t resumes;
+
+    /** Suspends during which the host allowed remote wakeup. */
+    uint32_t wakeup_enabled;
+
+    /** Time spent suspended. */
+    uint64_t suspended_us;
+
+    /** Times input took the full-speed locks, and how long they were held. */
+    uint32_t activations;
+    uint64_t active_us;
+
+    /**
+     * Cost of power_on_input() in CPU cycles: with the locks already held
+     * (every input but the first of a burst), and when taking them.
+     */
+    uint32_t hot_cycles_max;
+    uint32_t activate_cycles_max;
+
+    /** Power manager calls that failed. */
+    uint32_t pm_errors;
+};
+
+/**
+ * Configures frequency scaling and light sleep, and handles USB suspend
+ * and resume: relaxes the BLE link and lets the clock drop while the host
+ * sleeps, holding input for remote wakeup.  Call after nimble_port_init().
+ */
+void power_init(void);
+
+/**
+ * Marks input activity: runs the CPU at full speed and keeps it out of
+ * light sleep until CONFIG_DONGLE_PM_IDLE_MS after the last call.  Cheap
+ * enough for every notification.
+ */
+void power_on_input(int64_t now);
+
+void power_stats_get(struct power_stats *out);
+void power_stats_log(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,71 @@
+#include <string.h>
+#include "profile.h"
+
+/*
+ * Registry of the device profiles selected in Kconfig.  The table and the
+ * per-device decoders are generated at build time, so a profile that isn't
+ * enabled contributes neither code nor a comparison at runtime.
+ */
+
+/* Key array entries to bitmap bits; ErrorRollOver keeps the last state. */
+static inline void profile_keys_from_array(const uint8_t *keycode, size_t count,
+                                           struct hid_input *out)
+{
+    size_t i;
+
+    for (i = 0; i < count; i++)
+    {
+        if (keycode[i] == 0x01)
+        {
+            out->has_keyboard = false;
+            return;
+        }
+
+        if (keycode[i] < REPORT_NKRO_KEYS)
+        {
+            out->keys[keycode[i] / 8] |= 1 << (keycode[i] % 8);
+        }
+    }
+
+    /* Usage 0 means "no key". */
+    out->keys[0] &= ~1;
+}
+
+#include "profiles_gen.h"
+
+const char profile_usb_manufacturer[] = PROFILE_USB_MANUFACTURER;
+const char profile_usb_product[] = PROFILE_USB_PRODUCT;
+
+const struct profile *profile_match(const char *adv_name)
+{
+    const char *const *name;
+    int i;
+
+    for (i = 0; i < PROFILE_COUNT; i++)
+    {
+        for (name = profiles[i].adv_names; *name != NULL; name++)
+        {
+            if (strcmp(adv_name, *name) == 0)
+            {
+                return &profiles[i];
+            }
+        }
+    }
+
+    return NULL;
+}
+
+int profile_report_id(const struct profile *profile, uint16_t val_handle)
+{
+    uint8_t i;
+
+    for (i = 0; i < profile->nhandles; i++)
+    {
+        if (profile->handles[i].val_handle == val_handle)
+        {
+            return profile->handles[i].report_id;
+        }
+    }
+
+    return -1;
+}
@@ -0,0 +1,58 @@
+#ifndef H_PROFILE_
+#define H_PROFILE_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "hid_map.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Report value handle known in advance, and the report ID behind it. */
+struct profile_handle {
+    uint16_t val_handle;
+    uint8_t report_id;
+};
+
+/** Decodes one input report; false if the profile doesn't know report_id. */
+typedef bool profile_decode_fn(uint8_t report_id, const uint8_t *buf, size_t len,
+                               struct hid_input *out);
+
+/**
+ * One supported device, generated from gen_profiles.py for the profiles
+ * enabled in Kconfig.
+ */
+struct profile {
+    const char *name;
+
+    /** Advertised names that select this profile, NULL terminated. */
+    const char *const *adv_names;
+
+    /** Report handles to use until the Report References have been read. */
+    const struct profile_handle *handles;
+    uint8_t nhandles;
+
+    /** CCCDs to enable; when empty, every input Report is subscribed. */
+    const uint16_t *cccds;
+    uint8_t ncccds;
+
+    profile_decode_fn *decode;
+};
+
+/** USB string descriptors of the profile chosen as the dongle's identity. */
+extern const char profile_usb_manufacturer[];
+extern const char profile_usb_product[];
+
+/** @return The enabled profile advertising as adv_name, or NULL. */
+const struct profile *profile_match(const char *adv_name);
+
+/** @return Report ID of a handle from the profile's known handles, or -1. */
+int profile_report_id(const struct profile *profile, uint16_t val_handle);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,388 @@
+#include <string.h>
+#include <inttypes.h>
+#include "esp_log.h"
+#include "esp_cpu.h"
+#include "nvs.h"
+#include "freertos/FreeRTOS.h"
+#include "nimble/nimble_port.h"
+#include "report.h"
+#include "remap.h"
+
+/*
+ * Button and key remapping in the decode stage, so remaps take effect
+ * without host software.  The tables live in NVS and are edited by the USB
+ * host through a feature report on the vendor interface; edits are applied
+ * from the host task, the same task that decodes notifications, so the
+ * tables need no locking.
+ *
+ * The stored tables are expanded into lookup tables when they change: one
+ * table maps the whole button byte to the active layer, and one per layer
+ * maps it to the remapped byte with the layer buttons already taken out.
+ * Buttons then cost two loads per report.  Keys go through the layer's
+ * usage table once per key down, and a layer whose key table is the
+ * identity skips them entirely.
+ */
+
+#define REMAP_NVS_NAMESPACE "remap"
+#define REMAP_NVS_KEY "table"
+#define REMAP_VERSION 1
+
+#define REMAP_PENDING 8
+
+static const char *tag = "REMAP";
+
+/* Stored as-is in NVS. */
+struct remap_blob
+{
+    uint8_t version;
+    struct remap_table table;
+};
+
+static struct remap_table table;
+
+/* Expanded from table by rebuild(). */
+static uint8_t layer_lut[256];
+static uint8_t button_lut[REMAP_LAYERS][256];
+static bool keys_identity[REMAP_LAYERS];
+static uint8_t layer_mask;
+
+static uint8_t layer;
+
+/* Edits handed over by the TinyUSB task, waiting for the host task. */
+static portMUX_TYPE remap_lock = portMUX_INITIALIZER_UNLOCKED;
+static uint8_t pending[REMAP_PENDING][REMAP_FEATURE_LEN];
+static uint8_t pending_head;
+static uint8_t pending_count;
+static struct ble_npl_event set_ev;
+
+static struct remap_stats stats;
+
+static void table_reset(void)
+{
+    int l;
+    int i;
+
+    for (l = 0; l < REMAP_LAYERS; l++)
+    {
+        table.layer_button[l] = REMAP_BUTTON_NONE;
+        for (i = 0; i < 8; i++)
+        {
+            table.buttons[l][i] = i;
+        }
+        for (i = 0; i < 256; i++)
+        {
+            table.keys[l][i] = i;
+        }
+    }
+}
+
+static void rebuild(void)
+{
+    int l;
+    int b;
+    int i;
+
+    layer_mask = 0;
+    for (l = 1; l < REMAP_LAYERS; l++)
+    {
+        if (table.layer_button[l] < 8)
+        {
+            layer_mask |= 1 << table.layer_button[l];
+        }
+    }
+
+    for (b = 0; b < 256; b++)
+    {
+        /* The highest layer whose button is held wins. */
+        layer_lut[b] = 0;
+        for (l = 1; l < REMAP_LAYERS; l++)
+        {
+            if (table.layer_button[l] < 8 && (b & (1 << table.layer_button[l])))
+            {
+                layer_lut[b] = l;
+            }
+        }
+
+        for (l = 0; l < REMAP_LAYERS; l++)
+        {
+            uint8_t out = 0;
+
+            for (i = 0; i < 8; i++)
+            {
+                if ((b & ~layer_mask & (1 << i)) && table.buttons[l][i] < 8)
+                {
+                    out |= 1 << table.buttons[l][i];
+                }
+            }
+            button_lut[l][b] = out;
+        }
+    }
+
+    for (l = 0; l < REMAP_LAYERS; l++)
+    {
+        keys_identity[l] = true;
+        for (i = 0; i < 256; i++)
+        {
+            if (table.keys[l][i] != i)
+            {
+                keys_identity[l] = false;
+                break;
+            }
+        }
+    }
+}
+
+static void put_key(uint8_t usage, uint8_t *modifier, uint8_t keys[REPORT_NKRO_BYTES])
+{
+    if (usage >= REMAP_KEY_MODIFIER_FIRST && usage < REMAP_KEY_MODIFIER_FIRST + 8)
+    {
+        *modifier |= 1 << (usage - REMAP_KEY_MODIFIER_FIRST);
+    }
+    else if (usage != REMAP_KEY_NONE && usage < REPORT_NKRO_KEYS)
+    {
+        keys[usage / 8] |= 1 << (usage % 8);
+    }
+}
+
+static void remap_keys(struct hid_input *in, const uint8_t map[256])
+{
+    uint8_t keys[REPORT_NKRO_BYTES] = {0};
+    uint8_t modifier = 0;
+    int byte;
+    int bit;
+
+    for (byte = 0; byte < REPORT_NKRO_BYTES; byte++)
+    {
+        if (in->keys[byte] == 0)
+        {
+            continue;
+        }
+
+        for (bit = 0; bit < 8; bit++)
+        {
+            if (in->keys[byte] & (1 << bit))
+            {
+                put_key(map[byte * 8 + bit], &modifier, keys);
+            }
+        }
+    }
+
+    for (bit = 0; bit < 8; bit++)
+    {
+        if (in->modifier & (1 << bit))
+        {
+            put_key(map[REMAP_KEY_MODIFIER_FIRST + bit], &modifier, keys);
+        }
+    }
+
+    in->modifier = modifier;
+    memcpy(in->keys, keys, sizeof keys);
+}
+
+void remap_apply(struct hid_input *in)
+{
+    uint32_t start = esp_cpu_get_cycle_count();
+
+    if (in->has_mouse)
+    {
+        uint8_t next = layer_lut[in->buttons];
+
+        if (next != layer)
+        {
+            layer = next;
+            stats.layer_switches++;
+        }
+        in->buttons = button_lut[layer][in->buttons];
+    }
+
+    if (in->has_keyboard && !keys_identity[layer])
+    {
+        remap_keys(in, table.keys[layer]);
+    }
+
+    uint32_t cycles = esp_cpu_get_cycle_count() - start;
+    stats.samples++;
+    stats.cycles_sum += cycles;
+    if (cycles > stats.cycles_max)
+    {
+        stats.cycles_max = cycles;
+    }
+}
+
+static void save(void)
+{
+    static struct remap_blob blob;
+    nvs_handle_t nvs;
+    esp_err_t err;
+
+    blob.version = REMAP_VERSION;
+    blob.table = table;
+
+    err = nvs_open(REMAP_NVS_NAMESPACE, NVS_READWRITE, &nvs);
+    if (err == ESP_OK)
+    {
+        err = nvs_set_blob(nvs, REMAP_NVS_KEY, &blob, sizeof blob);
+        if (err == ESP_OK)
+        {
+            err = nvs_commit(nvs);
+        }
+        nvs_close(nvs);
+    }
+
+    if (err != ESP_OK)
+    {
+        ESP_LOGW(tag, "failed to save tables: %s", esp_err_to_name(err));
+        return;
+    }
+
+    stats.saves++;
+}
+
+/* Applies one edit; returns true if the host asked for the tables to be stored. */
+static bool edit(const uint8_t op[REMAP_FEATURE_LEN])
+{
+    uint8_t l = op[1];
+    uint8_t from = op[2];
+    uint8_t to = op[3];
+
+    if (op[0] == REMAP_OP_RESET)
+    {
+        table_reset();
+    }
+    else if (l >= REMAP_LAYERS)
+    {
+        ESP_LOGW(tag, "edit for layer %u ignored", l);
+        return false;
+    }
+    else if (op[0] == REMAP_OP_BUTTON && from < 8)
+    {
+        table.buttons[l][from] = to;
+    }
+    else if (op[0] == REMAP_OP_KEY)
+    {
+        table.keys[l][from] = to;
+    }
+    else if (op[0] == REMAP_OP_LAYER_BUTTON && l > 0)
+    {
+        table.layer_button[l] = from;
+    }
+    else
+    {
+        ESP_LOGW(tag, "edit %u %u %u %u ignored", op[0], l, from, to);
+        return false;
+    }
+
+    return op[4] & REMAP_FLAG_SAVE;
+}
+
+static void on_set_event(struct ble_npl_event *ev)
+{
+    uint8_t op[REMAP_FEATURE_LEN];
+    bool do_save = false;
+
+    for (;;)
+    {
+        portENTER_CRITICAL(&remap_lock);
+        if (pending_count == 0)
+        {
+            portEXIT_CRITICAL(&remap_lock);
+            break;
+        }
+        memcpy(op, pending[pending_head], sizeof op);
+        pending_head = (pending_head + 1) % REMAP_PENDING;
+        pending_count--;
+        portEXIT_CRITICAL(&remap_lock);
+
+        do_save |= edit(op);
+    }
+
+    /* A batch of edits costs one rebuild and at most one NVS write. */
+    rebuild();
+    if (do_save)
+    {
+        save();
+    }
+}
+
+uint16_t remap_get_feature(uint8_t *buffer, uint16_t reqlen)
+{
+    if (reqlen < REMAP_FEATURE_LEN)
+    {
+        return 0;
+    }
+
+    buffer[0] = REMAP_LAYERS;
+    buffer[1] = layer;
+    buffer[2] = layer_mask;
+    buffer[3] = 0;
+    buffer[4] = 0;
+    return REMAP_FEATURE_LEN;
+}
+
+void remap_set_feature(const uint8_t *buffer, uint16_t len)
+{
+    bool queued = false;
+
+    if (len < REMAP_FEATURE_LEN)
+    {
+        return;
+    }
+
+    portENTER_CRITICAL(&remap_lock);
+    if (pending_count < REMAP_PENDING)
+    {
+        memcpy(pending[(pending_head + pending_count) % REMAP_PENDING], buffer,
+               REMAP_FEATURE_LEN);
+        pending_count++;
+        queued = true;
+    }
+    portEXIT_CRITICAL(&remap_lock);
+
+    if (!queued)
+    {
+        stats.host_drops++;
+        return;
+    }
+
+    stats.host_sets++;
+    ble_npl_eventq_put(nimble_port_get_dflt_eventq(), &set_ev);
+}
+
+void remap_init(void)
+{
+    static struct remap_blob blob;
+    size_t size = sizeof blob;
+    nvs_handle_t nvs;
+
+    ble_npl_event_init(&set_ev, on_set_event, NULL);
+
+    table_reset();
+    if (nvs_open(REMAP_NVS_NAMESPACE, NVS_READONLY, &nvs) == ESP_OK)
+    {
+        if (nvs_get_blob(nvs, REMAP_NVS_KEY, &blob, &size) == ESP_OK &&
+            size == sizeof blob && blob.version == REMAP_VERSION)
+        {
+            table = blob.table;
+            ESP_LOGI(tag, "stored tables loaded");
+        }
+        nvs_close(nvs);
+    }
+
+    rebuild();
+}
+
+void remap_stats_get(struct remap_stats *out)
+{
+    *out = stats;
+}
+
+void remap_stats_log(void)
+{
+    ESP_LOGI(tag, "layer %u; samples=%" PRIu32 " cycles avg=%" PRIu32 " max=%" PRIu32
+                  " layer switches=%" PRIu32,
+             layer, stats.samples,
+             stats.samples ? (uint32_t)(stats.cycles_sum / stats.samples) : 0,
+             stats.cycles_max, stats.layer_switches);
+    ESP_LOGI(tag, "host sets=%" PRIu32 " drops=%" PRIu32 " saves=%" PRIu32,
+             stats.host_sets, stats.host_drops, stats.saves);
+}
@@ -0,0 +1,90 @@
+#ifndef H_REMAP_
+#define H_REMAP_
+
+#include <stdint.h>
+#include "hid_map.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Tables, layer 0 being the one in use while no layer button is held. */
+#define REMAP_LAYERS 4
+
+/** Table entry meaning "drop this input". */
+#define REMAP_BUTTON_NONE 0xFF
+#define REMAP_KEY_NONE 0x00
+
+/** Keyboard usage of the first modifier; modifiers remap like keys. */
+#define REMAP_KEY_MODIFIER_FIRST 0xE0
+
+/** Feature report on the vendor interface that edits the tables. */
+#define REMAP_REPORT_ID 0x21
+#define REMAP_FEATURE_LEN 5
+
+/** Operations of the feature report: op, layer, from, to, flags. */
+#define REMAP_OP_BUTTON 1
+#define REMAP_OP_KEY 2
+#define REMAP_OP_LAYER_BUTTON 3
+#define REMAP_OP_RESET 4
+
+/** Feature report flag: also store the tables in NVS. */
+#define REMAP_FLAG_SAVE 0x01
+
+/** Stored in NVS as-is. */
+struct remap_table {
+    /** Button bit that selects each layer while held; layer 0's is unused. */
+    uint8_t layer_button[REMAP_LAYERS];
+
+    /** Destination button bit for each source button bit. */
+    uint8_t buttons[REMAP_LAYERS][8];
+
+    /** Destination usage for each keyboard usage, modifiers included. */
+    uint8_t keys[REMAP_LAYERS][256];
+};
+
+struct remap_stats {
+    /** Inputs remapped, and CPU cycles spent in remap_apply(). */
+    uint32_t samples;
+    uint64_t cycles_sum;
+    uint32_t cycles_max;
+
+    /** Times the active layer changed. */
+    uint32_t layer_switches;
+
+    /** Edits received from the USB host, lost to a full queue, and saves. */
+    uint32_t host_sets;
+    uint32_t host_drops;
+    uint32_t saves;
+};
+
+/** Loads the stored tables, or identity ones. Call after nimble_port_init(). */
+void remap_init(void);
+
+/**
+ * Remaps the buttons, keys and modifiers of a decoded input in place.  The
+ * active layer follows the layer buttons of the latest mouse input.  Cost
+ * doesn't depend on the table contents: one lookup for the buttons, one
+ * per key down, none at all for a layer whose key table is the identity.
+ */
+void remap_apply(struct hid_input *in);
+
+/**
+ * GET_REPORT(Feature) on the vendor interface: layer count, active layer,
+ * layer button mask.
+ *
+ * @return Number of bytes written.
+ */
+uint16_t remap_get_feature(uint8_t *buffer, uint16_t reqlen);
+
+/** SET_REPORT(Feature) from the TinyUSB task; applied from the host task. */
+void remap_set_feature(const uint8_t *buffer, uint16_t len);
+
+void remap_stats_get(struct remap_stats *out);
+void remap_stats_log(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,920 @@
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "tinyusb.h"
+#include "class/hid/hid_device.h"
+#include "report.h"
+#include "passthrough.h"
+#include "trace.h"
+#include "stall.h"
+
+/*
+ * All reports leave the dongle from the TinyUSB task: BLE inputs only update
+ * the pending state below, and the start-of-frame callback merges whatever
+ * arrived since the previous poll into a single report and submits it right
+ * before the host's next IN token.  Keeping a single sender means the
+ * tud_hid_ready() check and the submit can't race each other.
+ *
+ * Input falls into two classes.  Edges (button, key and consumer control
+ * state changes) go through a bounded FIFO and are sent one per report, in
+ * order, before anything else; a press and release inside one frame are two
+ * reports.  Motion and wheel are summed and ride along in whatever mouse
+ * report goes out next, or get a report of their own when no edge is
+ * waiting.
+ *
+ * The last state sent for every report ID is cached.  A report that would
+ * not change that state (same keys, same buttons, no motion) is suppressed,
+ * GET_REPORT is answered from the cache, and a non-zero SET_IDLE rate
+ * re-sends the cached state when nothing changed for that long.
+ *
+ * Keyboard state is held as an N-key-rollover bitmap, so every keyboard
+ * report has the same size however many keys are down.  When the host has
+ * switched the interface to the boot protocol the bitmap is folded into the
+ * 6-key boot report instead and mouse reports are held back.
+ *
+ * With CONFIG_DONGLE_MOTION_SPREAD, motion-only reports don't dump a BLE
+ * sample into the first frame after it arrives.  The scheduler predicts
+ * when the next notification is due from the recent notification spacing
+ * and hands out an equal share of the pending motion every frame until
+ * then, so the cursor moves every millisecond instead of once per
+ * connection interval.  Only received motion is ever sent: the shares come
+ * out of the pending sum, and anything left when the prediction runs out
+ * goes out at once, so total distance is conserved exactly.
+ */
+
+#define REPORT_FRAME_US 1000
+/* Longest gap between motion samples still taken as a connection interval. */
+#define REPORT_SPACING_MAX_US 100000
+#define REPORT_PHASE_BUCKET_US (REPORT_FRAME_US / REPORT_PHASE_BUCKETS)
+
+/* Report IDs double as cache indices; ID 0 is the boot keyboard report. */
+#define REPORT_ID_BOOT 0
+#define REPORT_ID_COUNT (REPORT_ID_CONSUMER + 1)
+
+/* Boot report slots all set to this when more than six keys are down. */
+#define REPORT_KEY_ERR_ROLLOVER 0x01
+
+static const char *tag = "REPORT";
+
+enum report_edge_kind
+{
+    REPORT_EDGE_MOUSE,
+    REPORT_EDGE_KEYBOARD,
+    REPORT_EDGE_CONSUMER,
+};
+
+struct report_edge
+{
+    uint8_t kind;
+    /* Button bits for mouse edges, modifier byte for keyboard edges. */
+    uint8_t bits;
+    uint8_t keys[REPORT_NKRO_BYTES];
+    /* Usage for consumer edges. */
+    uint16_t usage;
+    int64_t at_us;
+};
+
+struct mouse_pending
+{
+    bool dirty;
+    int32_t dx;
+    int32_t dy;
+    int32_t wheel;
+    int32_t pan;
+    /** Arrival time of the oldest motion not sent yet. */
+    int64_t first_us;
+
+    /** Arrival of the latest motion sample and the smoothed spacing. */
+    int64_t last_us;
+    int32_t spacing_us;
+};
+
+static portMUX_TYPE report_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static struct report_edge edges[CONFIG_DONGLE_EDGE_QUEUE_LEN];
+static uint32_t edge_head;
+static uint32_t edge_count;
+
+static struct mouse_pending mouse;
+
+/* Latest state seen from BLE, used to detect edges. */
+static uint8_t in_buttons;
+static uint8_t in_modifier;
+static uint8_t in_keys[REPORT_NKRO_BYTES];
+static uint16_t in_usage;
+
+/* Key held on behalf of a mouse control, and the merged state last queued. */
+static uint8_t extra_modifier;
+static uint8_t extra_key;
+static uint8_t queued_modifier;
+static uint8_t queued_keys[REPORT_NKRO_BYTES];
+
+/* USB suspend: whether the host allowed remote wakeup, and whether a press
+ * has asked for it and the request is still to be made. */
+static bool suspended;
+static bool wakeup_allowed;
+static bool wake_requested;
+static bool wake_due;
+
+/*
+ * Last state sent per report ID.  Relative axes are stored as zero: the
+ * state of a mouse is its buttons, motion is only ever reported once.
+ */
+struct report_cache
+{
+    bool valid;
+    uint8_t len;
+    uint8_t data[sizeof(report_nkro_t)];
+    int64_t sent_us;
+};
+
+static struct report_cache cache[REPORT_ID_COUNT];
+
+/* SET_IDLE rate in ms, 0 for report-on-change only. */
+static uint32_t idle_ms;
+
+static volatile int64_t last_sof_us;
+static struct report_stats stats;
+
+static int8_t clamp_axis(int32_t v)
+{
+    if (v > 127)
+    {
+        return 127;
+    }
+    else if (v < -127)
+    {
+        return -127;
+    }
+
+    return (int8_t)v;
+}
+
+static void record_phase(int64_t now)
+{
+    int64_t sof = last_sof_us;
+    uint32_t phase;
+
+    if (sof == 0)
+    {
+        return;
+    }
+
+    phase = (uint32_t)((now - sof) % REPORT_FRAME_US);
+    stats.phase_hist[phase / REPORT_PHASE_BUCKET_US]++;
+}
+
+static void record_wait(int64_t first_us, int64_t now)
+{
+    uint32_t wait = (uint32_t)(now - first_us);
+
+    stats.wait_us_sum += wait;
+    stats.wait_samples++;
+    if (wait > stats.wait_us_max)
+    {
+        stats.wait_us_max = wait;
+    }
+}
+
+/*
+ * Caller holds report_lock.  While suspended, an edge is only kept if the
+ * host can be woken to receive it, and the first press asks for that.
+ */
+static bool suspend_gate(bool press)
+{
+    if (!suspended)
+    {
+        return true;
+    }
+
+    if (press && wakeup_allowed && !wake_requested)
+    {
+        wake_requested = true;
+        wake_due = true;
+        stats.wakeups++;
+    }
+    return wakeup_allowed;
+}
+
+/* Called without report_lock after queueing input. */
+static void wake_host(void)
+{
+    bool due;
+
+    portENTER_CRITICAL(&report_lock);
+    due = wake_due;
+    wake_due = false;
+    portEXIT_CRITICAL(&report_lock);
+
+    if (due)
+    {
+        /* Edges wait in the queue; SOF after resume sends them. */
+        tud_remote_wakeup();
+    }
+}
+
+/* Caller holds report_lock.  Returns the queued edge, NULL if it was dropped. */
+static struct report_edge *push_edge(uint8_t kind, uint8_t bits,
+                                     const uint8_t keys[REPORT_NKRO_BYTES], int64_t now)
+{
+    struct report_edge *edge;
+
+    stats.edges_in++;
+
+    if (edge_count == CONFIG_DONGLE_EDGE_QUEUE_LEN)
+    {
+        stats.edge_drops++;
+        return NULL;
+    }
+
+    edge = &edges[(edge_head + edge_count) % CONFIG_DONGLE_EDGE_QUEUE_LEN];
+    edge->kind = kind;
+    edge->bits = bits;
+    if (keys != NULL)
+    {
+        memcpy(edge->keys, keys, sizeof edge->keys);
+    }
+    edge->at_us = now;
+
+    edge_count++;
+    if (edge_count > stats.edge_depth_max)
+    {
+        stats.edge_depth_max = edge_count;
+    }
+    return edge;
+}
+
+void report_mouse_input(uint8_t buttons, int16_t dx, int16_t dy,
+                        int8_t wheel, int8_t pan)
+{
+    int64_t now = esp_timer_get_time();
+
+    portENTER_CRITICAL(&report_lock);
+    stats.mouse_in++;
+    record_phase(now);
+
+    if (buttons != in_buttons)
+    {
+        bool press = (buttons & ~in_buttons) != 0;
+
+        in_buttons = buttons;
+        if (suspend_gate(press))
+        {
+            push_edge(REPORT_EDGE_MOUSE, buttons, NULL, now);
+        }
+    }
+
+    /* Motion while the host sleeps would only make the cursor jump. */
+    if (!suspended && (dx != 0 || dy != 0 || wheel != 0 || pan != 0))
+    {
+        int64_t spacing = now - mouse.last_us;
+
+        /* The first sample has no gap to measure, and gaps far beyond the
+         * current estimate are pauses in motion, not connection intervals. */
+        if (mouse.last_us != 0 && spacing <= REPORT_SPACING_MAX_US &&
+            (mouse.spacing_us == 0 || spacing < 3 * mouse.spacing_us))
+        {
+            mouse.spacing_us += (int32_t)(spacing - mouse.spacing_us) / 4;
+        }
+        mouse.last_us = now;
+
+        if (mouse.dirty)
+        {
+            stats.merged++;
+            /* Motion the previous prediction didn't get out in time. */
+            stats.spread_residual += abs(mouse.dx) + abs(mouse.dy);
+        }
+        else
+        {
+            mouse.first_us = now;
+        }
+        mouse.dirty = true;
+        mouse.dx += dx;
+        mouse.dy += dy;
+        mouse.wheel += wheel;
+        mouse.pan += pan;
+    }
+    portEXIT_CRITICAL(&report_lock);
+
+    wake_host();
+}
+
+void report_mouse_pan(int16_t pan)
+{
+    int64_t now = esp_timer_get_time();
+
+    if (pan == 0)
+    {
+        return;
+    }
+
+    /* Not a BLE mouse sample: the notification spacing estimate stays put. */
+    portENTER_CRITICAL(&report_lock);
+    if (suspended)
+    {
+        portEXIT_CRITICAL(&report_lock);
+        return;
+    }
+    stats.mouse_in++;
+    if (mouse.dirty)
+    {
+        stats.merged++;
+    }
+    else
+    {
+        mouse.first_us = now;
+    }
+    mouse.dirty = true;
+    mouse.pan += pan;
+    portEXIT_CRITICAL(&report_lock);
+}
+
+/* Caller holds report_lock.  Queues BLE state plus the extra key if it changed. */
+static void keyboard_push(int64_t now)
+{
+    uint8_t modifier = in_modifier | extra_modifier;
+    uint8_t keys[REPORT_NKRO_BYTES];
+
+    memcpy(keys, in_keys, sizeof keys);
+    if (extra_key != 0 && extra_key < REPORT_NKRO_KEYS)
+    {
+        keys[extra_key / 8] |= 1 << (extra_key % 8);
+    }
+
+    if (modifier != queued_modifier || memcmp(keys, queued_keys, sizeof keys) != 0)
+    {
+        bool press = (modifier & ~queued_modifier) != 0;
+        size_t i;
+
+        for (i = 0; i < sizeof keys; i++)
+        {
+            press |= (keys[i] & ~queued_keys[i]) != 0;
+        }
+        if (!suspend_gate(press))
+        {
+            return;
+        }
+
+        queued_modifier = modifier;
+        memcpy(queued_keys, keys, sizeof keys);
+        push_edge(REPORT_EDGE_KEYBOARD, modifier, keys, now);
+    }
+}
+
+/* Caller holds report_lock. */
+static void keyboard_update(uint8_t modifier, const uint8_t keys[REPORT_NKRO_BYTES], int64_t now)
+{
+    stats.keyboard_in++;
+    record_phase(now);
+
+    in_modifier = modifier;
+    memcpy(in_keys, keys, sizeof in_keys);
+    keyboard_push(now);
+}
+
+void report_keyboard_keys(uint8_t modifier, const uint8_t *keycode, size_t count)
+{
+    uint8_t keys[REPORT_NKRO_BYTES] = {0};
+    int64_t now = esp_timer_get_time();
+    size_t i;
+
+    for (i = 0; i < count; i++)
+    {
+        if (keycode[i] == REPORT_KEY_ERR_ROLLOVER)
+        {
+            /* Phantom state: the keyboard can't tell which keys are down,
+             * keep the last known state. */
+            return;
+        }
+
+        if (keycode[i] < REPORT_NKRO_KEYS)
+        {
+            keys[keycode[i] / 8] |= 1 << (keycode[i] % 8);
+        }
+    }
+
+    /* Usage 0 means "no key" in array reports; it's never a real key. */
+    keys[0] &= ~1;
+
+    portENTER_CRITICAL(&report_lock);
+    keyboard_update(modifier, keys, now);
+    portEXIT_CRITICAL(&report_lock);
+
+    wake_host();
+}
+
+void report_keyboard_bitmap(uint8_t modifier, const uint8_t *bitmap, size_t len)
+{
+    uint8_t keys[REPORT_NKRO_BYTES] = {0};
+    int64_t now = esp_timer_get_time();
+
+    memcpy(keys, bitmap, len < sizeof keys ? len : sizeof keys);
+
+    portENTER_CRITICAL(&report_lock);
+    keyboard_update(modifier, keys, now);
+    portEXIT_CRITICAL(&report_lock);
+
+    wake_host();
+}
+
+void report_keyboard_extra(uint8_t modifier, uint8_t key)
+{
+    int64_t now = esp_timer_get_time();
+
+    portENTER_CRITICAL(&report_lock);
+    extra_modifier = modifier;
+    extra_key = key;
+    keyboard_push(now);
+    portEXIT_CRITICAL(&report_lock);
+
+    wake_host();
+}
+
+void report_consumer_input(uint16_t usage)
+{
+    int64_t now = esp_timer_get_time();
+    struct report_edge *edge;
+
+    portENTER_CRITICAL(&report_lock);
+    if (usage != in_usage && suspend_gate(usage != 0))
+    {
+        in_usage = usage;
+        edge = push_edge(REPORT_EDGE_CONSUMER, 0, NULL, now);
+        if (edge != NULL)
+        {
+            edge->usage = usage;
+        }
+    }
+    portEXIT_CRITICAL(&report_lock);
+
+    wake_host();
+}
+
+void report_set_suspended(bool is_suspended, bool remote_wakeup_en)
+{
+    portENTER_CRITICAL(&report_lock);
+    suspended = is_suspended;
+    wakeup_allowed = remote_wakeup_en;
+    wake_requested = false;
+    wake_due = false;
+    if (is_suspended)
+    {
+        mouse.dirty = false;
+        mouse.dx = 0;
+        mouse.dy = 0;
+        mouse.wheel = 0;
+        mouse.pan = 0;
+    }
+    portEXIT_CRITICAL(&report_lock);
+}
+
+static bool cache_matches(uint8_t report_id, const void *state, uint8_t len)
+{
+    return cache[report_id].valid && cache[report_id].len == len &&
+           memcmp(cache[report_id].data, state, len) == 0;
+}
+
+static bool submit(uint8_t report_id, const void *report, const void *state,
+                   uint8_t len, int64_t now)
+{
+    bool sent;
+
+    TRACE_BEGIN(USB_SUBMIT, report_id);
+    sent = tud_hid_report(report_id, report, len);
+    TRACE_END(USB_SUBMIT, report_id);
+
+    if (!sent)
+    {
+        return false;
+    }
+
+    cache[report_id].valid = true;
+    cache[report_id].len = len;
+    memcpy(cache[report_id].data, state, len);
+    cache[report_id].sent_us = now;
+    return true;
+}
+
+#if CONFIG_DONGLE_MOTION_SPREAD
+/* Frames left until the next notification is expected, at least 1. */
+static int32_t spread_frames(int64_t now)
+{
+    int64_t due = mouse.last_us + mouse.spacing_us;
+
+    if (due <= now)
+    {
+        if (mouse.dirty)
+        {
+            stats.spread_late++;
+        }
+        return 1;
+    }
+
+    return (int32_t)((due - now + REPORT_FRAME_US - 1) / REPORT_FRAME_US);
+}
+#endif
+
+/*
+ * Sends one mouse report with the given buttons and as much pending motion
+ * as fits, or only this frame's share of it when spread is set.  Motion is
+ * only consumed once TinyUSB has accepted the report.  Returns false only
+ * when TinyUSB refused the report.
+ */
+static bool send_mouse(uint8_t buttons, bool spread, int64_t now)
+{
+    hid_mouse_report_t report = {.buttons = buttons};
+    hid_mouse_report_t state = {.buttons = buttons};
+    bool had_motion;
+
+    if (tud_hid_get_protocol() == HID_PROTOCOL_BOOT)
+    {
+        /* A boot keyboard interface can't carry mouse reports. */
+        portENTER_CRITICAL(&report_lock);
+        memset(&mouse, 0, sizeof mouse);
+        portEXIT_CRITICAL(&report_lock);
+        return true;
+    }
+
+    portENTER_CRITICAL(&report_lock);
+    if (mouse.dx == 0 && mouse.dy == 0 && mouse.wheel == 0 && mouse.pan == 0)
+    {
+        /* Motion that cancelled out before it went anywhere. */
+        mouse.dirty = false;
+    }
+    had_motion = mouse.dirty;
+    report.x = clamp_axis(mouse.dx);
+    report.y = clamp_axis(mouse.dy);
+#if CONFIG_DONGLE_MOTION_SPREAD
+    if (spread)
+    {
+        int32_t frames = spread_frames(now);
+
+        report.x = clamp_axis(mouse.dx / frames);
+        report.y = clamp_axis(mouse.dy / frames);
+    }
+#else
+    (void)spread;
+#endif
+    report.wheel = clamp_axis(mouse.wheel);
+    report.pan = clamp_axis(mouse.pan);
+    portEXIT_CRITICAL(&report_lock);
+
+    if (spread && had_motion && report.x == 0 && report.y == 0 && report.wheel == 0 &&
+        report.pan == 0)
+    {
+        /* This frame's share rounds to nothing; it adds up over the next ones. */
+        return true;
+    }
+
+    if (!had_motion && cache_matches(HID_ITF_PROTOCOL_MOUSE, &state, sizeof state))
+    {
+        stats.suppressed++;
+        return true;
+    }
+
+    if (!submit(HID_ITF_PROTOCOL_MOUSE, &report, &state, sizeof report, now))
+    {
+        return false;
+    }
+
+    portENTER_CRITICAL(&report_lock);
+    if (had_motion)
+    {
+        record_wait(mouse.first_us, now);
+        mouse.dx -= report.x;
+        mouse.dy -= report.y;
+        mouse.wheel -= report.wheel;
+        mouse.pan -= report.pan;
+        /* Motion beyond the report range stays pending for the next frame. */
+        mouse.dirty = mouse.dx != 0 || mouse.dy != 0 || mouse.wheel != 0 || mouse.pan != 0;
+        mouse.first_us = now;
+    }
+    stats.mouse_sent++;
+    portEXIT_CRITICAL(&report_lock);
+
+    return true;
+}
+
+/* Folds the bitmap into the 6-key boot report. */
+static void keys_to_boot(const uint8_t keys[REPORT_NKRO_BYTES], uint8_t keycode[6])
+{
+    size_t n = 0;
+    size_t byte;
+    int bit;
+
+    for (byte = 0; byte < REPORT_NKRO_BYTES; byte++)
+    {
+        if (keys[byte] == 0)
+        {
+            continue;
+        }
+
+        for (bit = 0; bit < 8; bit++)
+        {
+            if (keys[byte] & (1 << bit))
+            {
+                if (n == 6)
+                {
+                    memset(keycode, REPORT_KEY_ERR_ROLLOVER, 6);
+                    return;
+                }
+                keycode[n++] = byte * 8 + bit;
+            }
+        }
+    }
+}
+
+static bool send_keyboard(uint8_t modifier, const uint8_t keys[REPORT_NKRO_BYTES], int64_t now)
+{
+    if (tud_hid_get_protocol() == HID_PROTOCOL_BOOT)
+    {
+        hid_keyboard_report_t boot = {.modifier = modifier};
+
+        keys_to_boot(keys, boot.keycode);
+        if (cache_matches(REPORT_ID_BOOT, &boot, sizeof boot))
+        {
+            stats.suppressed++;
+            return true;
+        }
+
+        if (!submit(REPORT_ID_BOOT, &boot, &boot, sizeof boot, now))
+        {
+            return false;
+        }
+    }
+    else
+    {
+        report_nkro_t report = {.modifier = modifier};
+
+        memcpy(report.keys, keys, sizeof report.keys);
+        if (cache_matches(HID_ITF_PROTOCOL_KEYBOARD, &report, sizeof report))
+        {
+            stats.suppressed++;
+            return true;
+        }
+
+        if (!submit(HID_ITF_PROTOCOL_KEYBOARD, &report, &report, sizeof report, now))
+        {
+            return false;
+        }
+    }
+
+    stats.keyboard_sent++;
+    return true;
+}
+
+static bool send_consumer(uint16_t usage, int64_t now)
+{
+    if (tud_hid_get_protocol() == HID_PROTOCOL_BOOT)
+    {
+        /* No consumer page in the boot protocol either. */
+        return true;
+    }
+
+    if (cache_matches(REPORT_ID_CONSUMER, &usage, sizeof usage))
+    {
+        stats.suppressed++;
+        return true;
+    }
+
+    if (!submit(REPORT_ID_CONSUMER, &usage, &usage, sizeof usage, now))
+    {
+        return false;
+    }
+
+    stats.consumer_sent++;
+    return true;
+}
+
+static bool send_edge(int64_t now)
+{
+    struct report_edge edge;
+    bool sent;
+
+    /* Peek only: the edge leaves the queue once TinyUSB has accepted it. */
+    portENTER_CRITICAL(&report_lock);
+    edge = edges[edge_head];
+    portEXIT_CRITICAL(&report_lock);
+
+    if (edge.kind == REPORT_EDGE_MOUSE)
+    {
+        /* Clicks take all motion before them, the share doesn't matter. */
+        sent = send_mouse(edge.bits, false, now);
+    }
+    else if (edge.kind == REPORT_EDGE_CONSUMER)
+    {
+        sent = send_consumer(edge.usage, now);
+    }
+    else
+    {
+        sent = send_keyboard(edge.bits, edge.keys, now);
+    }
+
+    if (!sent)
+    {
+        return false;
+    }
+
+    portENTER_CRITICAL(&report_lock);
+    edge_head = (edge_head + 1) % CONFIG_DONGLE_EDGE_QUEUE_LEN;
+    edge_count--;
+    stats.edges_sent++;
+    record_wait(edge.at_us, now);
+    portEXIT_CRITICAL(&report_lock);
+
+    return true;
+}
+
+/* Re-sends a cached state whose idle period ran out. */
+static void send_idle(int64_t now)
+{
+    uint8_t id;
+
+    for (id = 0; id < REPORT_ID_COUNT; id++)
+    {
+        /* Only re-send reports that belong to the current protocol. */
+        if ((id == REPORT_ID_BOOT) != (tud_hid_get_protocol() == HID_PROTOCOL_BOOT))
+        {
+            continue;
+        }
+
+        if (cache[id].valid && now - cache[id].sent_us >= idle_ms * 1000LL)
+        {
+            if (submit(id, cache[id].data, cache[id].data, cache[id].len, now))
+            {
+                stats.idle_repeats++;
+            }
+            return;
+        }
+    }
+}
+
+/* Submits at most one report; the next one follows on completion. */
+static void report_flush(int64_t now)
+{
+    bool edges, dirty;
+
+    /* Set by the host task, cleared only here: the snapshot can miss work
+     * that lands right after it, which the next frame picks up. */
+    portENTER_CRITICAL(&report_lock);
+    edges = edge_count > 0;
+    dirty = mouse.dirty;
+    portEXIT_CRITICAL(&report_lock);
+
+    if (!edges && !dirty && idle_ms == 0)
+    {
+        return;
+    }
+
+    if (!tud_hid_ready())
+    {
+        if (edges || dirty)
+        {
+            stats.busy++;
+        }
+        return;
+    }
+
+    if (edges)
+    {
+        send_edge(now);
+    }
+    else if (dirty)
+    {
+        send_mouse(cache[HID_ITF_PROTOCOL_MOUSE].data[0], true, now);
+    }
+    else
+    {
+        send_idle(now);
+    }
+}
+
+void tud_sof_cb(uint32_t frame_count)
+{
+    STALL_BEGIN(stall_start);
+    int64_t now = esp_timer_get_time();
+
+    (void)frame_count;
+
+    last_sof_us = now;
+    stats.frames++;
+    report_flush(now);
+    STALL_END(SOF, stall_start);
+}
+
+void tud_hid_report_complete_cb(uint8_t instance, uint8_t const *report, uint16_t len)
+{
+    (void)report;
+    (void)len;
+
+    TRACE_INSTANT(USB_COMPLETE, instance);
+
+    if (instance == PASSTHROUGH_ITF)
+    {
+        passthrough_on_complete();
+        return;
+    }
+
+    report_flush(esp_timer_get_time());
+}
+
+bool tud_hid_set_idle_cb(uint8_t instance, uint8_t idle_rate)
+{
+    if (instance == PASSTHROUGH_ITF)
+    {
+        return true;
+    }
+
+    /* SET_IDLE is in 4 ms units; TinyUSB answers GET_IDLE itself. */
+    idle_ms = idle_rate * 4;
+    return true;
+}
+
+uint16_t report_get_input(uint8_t report_id, uint8_t *buffer, uint16_t reqlen)
+{
+    uint16_t len;
+
+    if (report_id >= REPORT_ID_COUNT)
+    {
+        return 0;
+    }
+
+    portENTER_CRITICAL(&report_lock);
+    len = cache[report_id].valid ? cache[report_id].len : 0;
+    if (len > reqlen)
+    {
+        len = reqlen;
+    }
+    memcpy(buffer, cache[report_id].data, len);
+    portEXIT_CRITICAL(&report_lock);
+
+    if (len == 0)
+    {
+        /* Nothing sent yet: the state is all released, all zero. */
+        len = report_id == REPORT_ID_BOOT             ? sizeof(hid_keyboard_report_t)
+              : report_id == HID_ITF_PROTOCOL_KEYBOARD ? sizeof(report_nkro_t)
+              : report_id == REPORT_ID_CONSUMER        ? sizeof(uint16_t)
+                                                       : sizeof(hid_mouse_report_t);
+        len = len > reqlen ? reqlen : len;
+        memset(buffer, 0, len);
+    }
+
+    stats.get_reports++;
+    return len;
+}
+
+int64_t report_last_sof_us(void)
+{
+    return last_sof_us;
+}
+
+void report_init(void)
+{
+    memset(&mouse, 0, sizeof mouse);
+    memset(&stats, 0, sizeof stats);
+    memset(cache, 0, sizeof cache);
+    idle_ms = 0;
+    edge_head = 0;
+    edge_count = 0;
+
+    tud_sof_cb_enable(true);
+}
+
+void report_stats_get(struct report_stats *out)
+{
+    portENTER_CRITICAL(&report_lock);
+    *out = stats;
+    out->edge_depth = edge_count;
+    portEXIT_CRITICAL(&report_lock);
+}
+
+void report_stats_log(void)
+{
+    struct report_stats s;
+
+    report_stats_get(&s);
+
+    ESP_LOGI(tag, "frames=%" PRIu32 " mouse in/sent=%" PRIu32 "/%" PRIu32
+                  " kbd in/sent=%" PRIu32 "/%" PRIu32 " consumer=%" PRIu32
+                  " merged=%" PRIu32 " busy=%" PRIu32,
+             s.frames, s.mouse_in, s.mouse_sent, s.keyboard_in, s.keyboard_sent,
+             s.consumer_sent, s.merged, s.busy);
+    ESP_LOGI(tag, "edges in/sent=%" PRIu32 "/%" PRIu32 " drops=%" PRIu32 " depth max=%" PRIu32
+                  " wakeups=%" PRIu32,
+             s.edges_in, s.edges_sent, s.edge_drops, s.edge_depth_max, s.wakeups);
+    ESP_LOGI(tag, "suppressed=%" PRIu32 " idle repeats=%" PRIu32 " (idle=%" PRIu32 "ms) get_report=%" PRIu32,
+             s.suppressed, s.idle_repeats, idle_ms, s.get_reports);
+#if CONFIG_DONGLE_MOTION_SPREAD
+    ESP_LOGI(tag, "spread residual=%" PRIu32 " late=%" PRIu32, s.spread_residual, s.spread_late);
+#endif
+    ESP_LOGI(tag, "wait avg=%" PRIu32 "us max=%" PRIu32 "us",
+             s.wait_samples ? (uint32_t)(s.wait_us_sum / s.wait_samples) : 0,
+             s.wait_us_max);
+    ESP_LOGI(tag, "phase (125us buckets): %" PRIu32 " %" PRIu32 " %" PRIu32 " %" PRIu32
+                  " %" PRIu32 " %" PRIu32 " %" PRIu32 " %" PRIu32,
+             s.phase_hist[0], s.phase_hist[1], s.phase_hist[2], s.phase_hist[3],
+             s.phase_hist[4], s.phase_hist[5], s.phase_hist[6], s.phase_hist[7]);
+}
@@ -0,0 +1,150 @@
+#ifndef H_REPORT_
+#define H_REPORT_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Number of 125 us buckets used for the arrival phase histogram. */
+#define REPORT_PHASE_BUCKETS 8
+
+/** Keyboard page usages 0x00-0xDF, one bit each; modifiers go separately. */
+#define REPORT_NKRO_KEYS 224
+#define REPORT_NKRO_BYTES (REPORT_NKRO_KEYS / 8)
+
+/** Consumer control report, one 16-bit usage, after the keyboard and mouse IDs. */
+#define REPORT_ID_CONSUMER 3
+
+/** Input report layout behind the keyboard report ID. */
+typedef struct {
+    uint8_t modifier;
+    uint8_t keys[REPORT_NKRO_BYTES];
+} report_nkro_t;
+
+struct report_stats {
+    /** Start-of-frame callbacks seen since boot. */
+    uint32_t frames;
+
+    /** BLE inputs handed to the scheduler. */
+    uint32_t mouse_in;
+    uint32_t keyboard_in;
+
+    /** Reports actually submitted to TinyUSB. */
+    uint32_t mouse_sent;
+    uint32_t keyboard_sent;
+    uint32_t consumer_sent;
+
+    /** Motion inputs folded into motion that was already pending. */
+    uint32_t merged;
+
+    /** Button and key state changes queued, sent, and lost to a full queue. */
+    uint32_t edges_in;
+    uint32_t edges_sent;
+    uint32_t edge_drops;
+    uint32_t edge_depth_max;
+
+    /** Edges queued right now. */
+    uint32_t edge_depth;
+
+    /** Reports dropped because they wouldn't change the cached state. */
+    uint32_t suppressed;
+
+    /** Cached states re-sent because the SET_IDLE period ran out. */
+    uint32_t idle_repeats;
+
+    /** GET_REPORT requests answered from the cache. */
+    uint32_t get_reports;
+
+    /**
+     * Motion spreading accuracy: counts still pending when the next sample
+     * arrived (prediction too long), and frames that found the prediction
+     * expired with motion left (prediction too short).
+     */
+    uint32_t spread_residual;
+    uint32_t spread_late;
+
+    /** Remote wakeups requested by a press while USB was suspended. */
+    uint32_t wakeups;
+
+    /** Frames with pending input where the endpoint was still busy. */
+    uint32_t busy;
+
+    /** Time between the oldest merged input and its submission. */
+    uint64_t wait_us_sum;
+    uint32_t wait_us_max;
+    uint32_t wait_samples;
+
+    /** Where inside the 1 ms USB frame BLE inputs arrive. */
+    uint32_t phase_hist[REPORT_PHASE_BUCKETS];
+};
+
+/**
+ * Starts the start-of-frame driven scheduler.  Must be called after the
+ * TinyUSB driver is installed.
+ */
+void report_init(void);
+
+/**
+ * Queues mouse input for the next USB frame.  Relative axes are summed with
+ * whatever is still pending; a change of button state is queued as an edge
+ * and never merged away.
+ */
+void report_mouse_input(uint8_t buttons, int16_t dx, int16_t dy,
+                        int8_t wheel, int8_t pan);
+
+/**
+ * Queues horizontal scroll from a source other than the mouse report, such
+ * as a diverted thumb wheel.  Summed like motion; button state is left alone.
+ */
+void report_mouse_pan(int16_t pan);
+
+/**
+ * Queues a keyboard state given as a key array (6KRO style) as an edge;
+ * repeats of the last state are ignored, zero entries mean "no key".
+ */
+void report_keyboard_keys(uint8_t modifier, const uint8_t *keycode, size_t count);
+
+/** Same as report_keyboard_keys() for a keyboard that reports a key bitmap. */
+void report_keyboard_bitmap(uint8_t modifier, const uint8_t *bitmap, size_t len);
+
+/**
+ * Holds a modifier and key on top of the keyboard state from BLE, for
+ * mouse controls mapped to keys.  Key 0 with modifier 0 releases them.
+ */
+void report_keyboard_extra(uint8_t modifier, uint8_t key);
+
+/** Queues the consumer control usage held down, 0 for none, as an edge. */
+void report_consumer_input(uint16_t usage);
+
+/**
+ * Follows USB suspend and resume.  While suspended motion is dropped, and
+ * button and key changes are only queued if the host allows remote
+ * wakeup; the first press then wakes it and everything queued goes out
+ * once frames resume.
+ */
+void report_set_suspended(bool suspended, bool remote_wakeup_en);
+
+/**
+ * Answers a GET_REPORT(Input) request from the cached state.
+ *
+ * Report ID 0 is the boot protocol keyboard report.
+ *
+ * @return Number of bytes written to buffer, 0 for an unknown report ID.
+ */
+uint16_t report_get_input(uint8_t report_id, uint8_t *buffer, uint16_t reqlen);
+
+/** Arrival time (esp_timer clock, us) of the most recent start of frame. */
+int64_t report_last_sof_us(void);
+
+void report_stats_get(struct report_stats *out);
+void report_stats_log(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
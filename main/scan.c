@@ -0,0 +1,224 @@
+#include <inttypes.h>
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "host/ble_hs.h"
+#include "nimble/nimble_port.h"
+#include "scan.h"
+
+/*
+ * Searches for the device with a scan duty cycle that backs off over time.
+ * A search starts with continuous scanning, so a mouse that just woke up
+ * or came back in range reconnects at once, then steps down to shorter
+ * windows so an absent device doesn't keep the radio busy forever.  Each
+ * stage is a timed GAP discovery; its completion starts the next one.
+ *
+ * USB resume and the host (through a feature report) can put a running
+ * search back into the fast stage, e.g. when the user is likely to pick
+ * the mouse up.
+ */
+
+static const char *tag = "SCAN";
+
+struct scan_params
+{
+    /* 0.625 ms units. */
+    uint16_t itvl;
+    uint16_t window;
+    int32_t duration_ms;
+};
+
+static const struct scan_params stage_params[SCAN_STAGE_COUNT] = {
+    [SCAN_FAST] = {10, 10, CONFIG_DONGLE_SCAN_FAST_MS},
+    [SCAN_MEDIUM] = {CONFIG_DONGLE_SCAN_MEDIUM_ITVL, CONFIG_DONGLE_SCAN_MEDIUM_WINDOW,
+                     CONFIG_DONGLE_SCAN_MEDIUM_MS},
+    [SCAN_SLOW] = {CONFIG_DONGLE_SCAN_SLOW_ITVL, CONFIG_DONGLE_SCAN_SLOW_WINDOW,
+                   BLE_HS_FOREVER},
+};
+
+static const char *const stage_names[SCAN_STAGE_COUNT] = {
+    [SCAN_FAST] = "fast",
+    [SCAN_MEDIUM] = "medium",
+    [SCAN_SLOW] = "slow",
+};
+
+static struct
+{
+    ble_gap_event_fn *cb;
+    bool searching;
+    enum scan_stage stage;
+    int64_t search_start_us;
+    int64_t stage_start_us;
+} sc;
+
+static bool initialized;
+static struct ble_npl_event boost_ev;
+
+static struct scan_stats stats;
+
+/* Books the time spent in the current stage. */
+static void account(int64_t now)
+{
+    struct scan_stage_stats *s = &stats.stages[sc.stage];
+    uint64_t elapsed = now - sc.stage_start_us;
+
+    s->scan_us += elapsed;
+    s->radio_us += elapsed * stage_params[sc.stage].window / stage_params[sc.stage].itvl;
+    sc.stage_start_us = now;
+}
+
+static void start_stage(enum scan_stage stage)
+{
+    const struct scan_params *p = &stage_params[stage];
+    struct ble_gap_disc_params disc_params = {
+        .itvl = p->itvl,
+        .window = p->window,
+        .filter_policy = 0,
+        .limited = 0,
+        /* Don't send follow-up scan requests to each advertiser. */
+        .passive = 1,
+        /* Let the controller drop repeated advertisements. */
+        .filter_duplicates = 1,
+    };
+    uint8_t own_addr_type;
+    int rc;
+
+    sc.stage = stage;
+    sc.stage_start_us = esp_timer_get_time();
+    stats.stages[stage].starts++;
+
+    rc = ble_hs_id_infer_auto(0, &own_addr_type);
+    if (rc == 0)
+    {
+        rc = ble_gap_disc(own_addr_type, p->duration_ms, &disc_params, sc.cb, NULL);
+    }
+    if (rc != 0)
+    {
+        stats.errors++;
+        sc.searching = false;
+        ESP_LOGE(tag, "scan not started; rc=%d", rc);
+        return;
+    }
+
+    ESP_LOGI(tag, "%s scan, window %u of %u", stage_names[stage], p->window, p->itvl);
+}
+
+void scan_start(void)
+{
+    if (sc.searching)
+    {
+        ble_gap_disc_cancel();
+        account(esp_timer_get_time());
+    }
+
+    sc.searching = true;
+    sc.search_start_us = esp_timer_get_time();
+    start_stage(SCAN_FAST);
+}
+
+int scan_found(void)
+{
+    int64_t now = esp_timer_get_time();
+    uint32_t find_us;
+    int rc;
+
+    rc = ble_gap_disc_cancel();
+    if (rc != 0 || !sc.searching)
+    {
+        return rc;
+    }
+
+    account(now);
+    sc.searching = false;
+
+    find_us = now - sc.search_start_us;
+    stats.stages[sc.stage].finds++;
+    stats.find_us_last = find_us;
+    if (find_us > stats.find_us_max)
+    {
+        stats.find_us_max = find_us;
+    }
+
+    ESP_LOGI(tag, "found after %" PRIu32 " ms in the %s stage", find_us / 1000,
+             stage_names[sc.stage]);
+    return 0;
+}
+
+void scan_on_complete(int reason)
+{
+    if (!sc.searching)
+    {
+        return;
+    }
+
+    account(esp_timer_get_time());
+    start_stage(sc.stage < SCAN_SLOW ? sc.stage + 1 : SCAN_SLOW);
+}
+
+/* Host task. */
+static void on_boost_event(struct ble_npl_event *ev)
+{
+    if (!sc.searching)
+    {
+        return;
+    }
+
+    stats.boosts++;
+    ble_gap_disc_cancel();
+    account(esp_timer_get_time());
+    start_stage(SCAN_FAST);
+}
+
+void scan_boost(void)
+{
+    /* USB can resume before the host stack is up. */
+    if (!initialized)
+    {
+        return;
+    }
+
+    ble_npl_eventq_put(nimble_port_get_dflt_eventq(), &boost_ev);
+}
+
+uint16_t scan_get_feature(uint8_t *buffer, uint16_t reqlen)
+{
+    if (reqlen < SCAN_FEATURE_LEN)
+    {
+        return 0;
+    }
+
+    buffer[0] = sc.searching;
+    buffer[1] = sc.stage;
+    return SCAN_FEATURE_LEN;
+}
+
+void scan_init(ble_gap_event_fn *cb)
+{
+    sc.cb = cb;
+    ble_npl_event_init(&boost_ev, on_boost_event, NULL);
+    initialized = true;
+}
+
+void scan_stats_get(struct scan_stats *out)
+{
+    *out = stats;
+}
+
+void scan_stats_log(void)
+{
+    int i;
+
+    ESP_LOGI(tag, "%s; find last=%" PRIu32 "ms max=%" PRIu32 "ms boosts=%" PRIu32
+                  " errors=%" PRIu32,
+             sc.searching ? stage_names[sc.stage] : "idle", stats.find_us_last / 1000,
+             stats.find_us_max / 1000, stats.boosts, stats.errors);
+
+    for (i = 0; i < SCAN_STAGE_COUNT; i++)
+    {
+        const struct scan_stage_stats *s = &stats.stages[i];
+
+        ESP_LOGI(tag, "  %-6s starts=%" PRIu32 " finds=%" PRIu32 " scan=%" PRIu32 "ms"
+                      " radio=%" PRIu32 "ms",
+                 stage_names[i], s->starts, s->finds, (uint32_t)(s->scan_us / 1000),
+                 (uint32_t)(s->radio_us / 1000));
+    }
+}
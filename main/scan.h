@@ -0,0 +1,76 @@
+#ifndef H_SCAN_
+#define H_SCAN_
+
+#include <stdint.h>
+#include "host/ble_hs.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Feature report on the vendor interface: searching, stage; any SET boosts. */
+#define SCAN_REPORT_ID 0x22
+#define SCAN_FEATURE_LEN 2
+
+/** Scan duty cycle stages, from fast reconnect down to background. */
+enum scan_stage {
+    SCAN_FAST,
+    SCAN_MEDIUM,
+    SCAN_SLOW,
+    SCAN_STAGE_COUNT,
+};
+
+struct scan_stage_stats {
+    /** Times the stage was entered, and searches that ended in it. */
+    uint32_t starts;
+    uint32_t finds;
+
+    /** Time spent scanning in this stage, and the part the radio listened. */
+    uint64_t scan_us;
+    uint64_t radio_us;
+};
+
+struct scan_stats {
+    struct scan_stage_stats stages[SCAN_STAGE_COUNT];
+
+    /** Time from the start of a search to finding the device. */
+    uint32_t find_us_last;
+    uint32_t find_us_max;
+
+    /** Returns to the fast stage on USB resume or host request. */
+    uint32_t boosts;
+
+    /** Scans the controller refused to start. */
+    uint32_t errors;
+};
+
+/** GAP events of the scan go to cb. Call after nimble_port_init(). */
+void scan_init(ble_gap_event_fn *cb);
+
+/** Starts a new search in the fast stage. */
+void scan_start(void);
+
+/**
+ * The device was found; stops scanning so it can be connected.
+ *
+ * @return 0 on success, the ble_gap_disc_cancel() error otherwise.
+ */
+int scan_found(void);
+
+/** BLE_GAP_EVENT_DISC_COMPLETE: the stage ran out, moves to the next. */
+void scan_on_complete(int reason);
+
+/** Goes back to the fast stage if a search is running. Any task. */
+void scan_boost(void);
+
+/** GET_REPORT(Feature) on the vendor interface. @return Bytes written. */
+uint16_t scan_get_feature(uint8_t *buffer, uint16_t reqlen);
+
+void scan_stats_get(struct scan_stats *out);
+void scan_stats_log(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,215 @@
+#include <string.h>
+#include <inttypes.h>
+#include "esp_log.h"
+#include "nvs.h"
+#include "freertos/FreeRTOS.h"
+#include "nimble/nimble_port.h"
+#include "hidpp.h"
+#include "sensor.h"
+
+/*
+ * Keeps the mouse's resolution and report rate consistent across hosts.
+ * The profile comes from NVS (or Kconfig on first boot) and goes out over
+ * HID++ as soon as the link is subscribed.  The USB host can read and
+ * replace it through a feature report on the vendor interface; a new
+ * profile is applied at once and stored when the host asks for it.
+ */
+
+#define HIDPP_FEATURE_ADJUSTABLE_DPI 0x2201
+#define HIDPP_ADJUSTABLE_DPI_SET 3
+
+#define HIDPP_FEATURE_REPORT_RATE 0x8060
+#define HIDPP_REPORT_RATE_SET 2
+
+#define SENSOR_NVS_NAMESPACE "sensor"
+#define SENSOR_NVS_KEY "profile"
+#define SENSOR_VERSION 1
+
+static const char *tag = "SENSOR";
+
+/* Stored as-is in NVS. */
+struct sensor_blob
+{
+    uint8_t version;
+    struct sensor_profile profile;
+};
+
+static portMUX_TYPE sensor_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static struct sensor_profile profile = {
+    .dpi = CONFIG_DONGLE_SENSOR_DPI,
+    .rate_ms = CONFIG_DONGLE_SENSOR_RATE_MS,
+};
+
+/* Profile handed over by the TinyUSB task, waiting for the host task. */
+static struct sensor_profile pending;
+static bool pending_save;
+static struct ble_npl_event set_ev;
+
+static struct sensor_stats stats;
+
+static void on_response(int status, const uint8_t *params, size_t len, void *arg)
+{
+    const char *what = arg;
+
+    stats.last_status = status;
+    if (status != 0)
+    {
+        stats.failed++;
+        ESP_LOGW(tag, "setting %s failed; status=%d", what, status);
+        return;
+    }
+
+    stats.applied++;
+}
+
+static void save(const struct sensor_profile *p)
+{
+    struct sensor_blob blob = {
+        .version = SENSOR_VERSION,
+        .profile = *p,
+    };
+    nvs_handle_t nvs;
+    esp_err_t err;
+
+    err = nvs_open(SENSOR_NVS_NAMESPACE, NVS_READWRITE, &nvs);
+    if (err == ESP_OK)
+    {
+        err = nvs_set_blob(nvs, SENSOR_NVS_KEY, &blob, sizeof blob);
+        if (err == ESP_OK)
+        {
+            err = nvs_commit(nvs);
+        }
+        nvs_close(nvs);
+    }
+
+    if (err != ESP_OK)
+    {
+        ESP_LOGW(tag, "failed to save profile: %s", esp_err_to_name(err));
+        return;
+    }
+
+    stats.saves++;
+}
+
+void sensor_apply(void)
+{
+    struct sensor_profile p;
+    uint8_t params[3];
+
+    portENTER_CRITICAL(&sensor_lock);
+    p = profile;
+    portEXIT_CRITICAL(&sensor_lock);
+
+    if (p.dpi != 0)
+    {
+        /* Sensor 0, DPI big endian. */
+        params[0] = 0;
+        params[1] = p.dpi >> 8;
+        params[2] = p.dpi & 0xFF;
+        hidpp_call(HIDPP_FEATURE_ADJUSTABLE_DPI, HIDPP_ADJUSTABLE_DPI_SET, params, 3,
+                   on_response, "DPI");
+    }
+
+    if (p.rate_ms != 0)
+    {
+        params[0] = p.rate_ms;
+        hidpp_call(HIDPP_FEATURE_REPORT_RATE, HIDPP_REPORT_RATE_SET, params, 1,
+                   on_response, "report rate");
+    }
+}
+
+static void on_set_event(struct ble_npl_event *ev)
+{
+    struct sensor_profile p;
+    bool do_save;
+
+    portENTER_CRITICAL(&sensor_lock);
+    p = pending;
+    do_save = pending_save;
+    profile = p;
+    portEXIT_CRITICAL(&sensor_lock);
+
+    ESP_LOGI(tag, "profile from host: %u dpi, %u ms%s", p.dpi, p.rate_ms,
+             do_save ? ", saved" : "");
+
+    if (do_save)
+    {
+        save(&p);
+    }
+
+    /* Not connected yet is fine: the profile goes out on connect. */
+    sensor_apply();
+}
+
+uint16_t sensor_get_feature(uint8_t *buffer, uint16_t reqlen)
+{
+    struct sensor_profile p;
+
+    if (reqlen < SENSOR_FEATURE_LEN)
+    {
+        return 0;
+    }
+
+    portENTER_CRITICAL(&sensor_lock);
+    p = profile;
+    portEXIT_CRITICAL(&sensor_lock);
+
+    buffer[0] = p.dpi & 0xFF;
+    buffer[1] = p.dpi >> 8;
+    buffer[2] = p.rate_ms;
+    buffer[3] = 0;
+    return SENSOR_FEATURE_LEN;
+}
+
+void sensor_set_feature(const uint8_t *buffer, uint16_t len)
+{
+    if (len < SENSOR_FEATURE_LEN)
+    {
+        return;
+    }
+
+    portENTER_CRITICAL(&sensor_lock);
+    pending.dpi = buffer[0] | buffer[1] << 8;
+    pending.rate_ms = buffer[2];
+    pending_save = buffer[3] & SENSOR_FLAG_SAVE;
+    portEXIT_CRITICAL(&sensor_lock);
+
+    stats.host_sets++;
+    ble_npl_eventq_put(nimble_port_get_dflt_eventq(), &set_ev);
+}
+
+void sensor_init(void)
+{
+    struct sensor_blob blob;
+    size_t size = sizeof blob;
+    nvs_handle_t nvs;
+
+    ble_npl_event_init(&set_ev, on_set_event, NULL);
+
+    if (nvs_open(SENSOR_NVS_NAMESPACE, NVS_READONLY, &nvs) != ESP_OK)
+    {
+        return;
+    }
+
+    if (nvs_get_blob(nvs, SENSOR_NVS_KEY, &blob, &size) == ESP_OK &&
+        size == sizeof blob && blob.version == SENSOR_VERSION)
+    {
+        profile = blob.profile;
+        ESP_LOGI(tag, "stored profile: %u dpi, %u ms", profile.dpi, profile.rate_ms);
+    }
+    nvs_close(nvs);
+}
+
+void sensor_stats_get(struct sensor_stats *out)
+{
+    *out = stats;
+}
+
+void sensor_stats_log(void)
+{
+    ESP_LOGI(tag, "profile %u dpi %u ms; applied=%" PRIu32 " failed=%" PRIu32 " (last %d)"
+                  " host sets=%" PRIu32 " saves=%" PRIu32,
+             profile.dpi, profile.rate_ms, stats.applied, stats.failed, stats.last_status,
+             stats.host_sets, stats.saves);
+}
@@ -0,0 +1,58 @@
+#ifndef H_SENSOR_
+#define H_SENSOR_
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Feature report on the vendor interface holding the sensor profile. */
+#define SENSOR_REPORT_ID 0x20
+#define SENSOR_FEATURE_LEN 4
+
+/** Feature report flag: also store the profile in NVS. */
+#define SENSOR_FLAG_SAVE 0x01
+
+/** Resolution and report rate pushed to the mouse; 0 leaves the device's own. */
+struct sensor_profile {
+    uint16_t dpi;
+    uint8_t rate_ms;
+};
+
+struct sensor_stats {
+    /** Settings written to the mouse, and rejected or unanswered. */
+    uint32_t applied;
+    uint32_t failed;
+    int last_status;
+
+    /** Profiles received from the USB host, and stored in NVS. */
+    uint32_t host_sets;
+    uint32_t saves;
+};
+
+/** Loads the stored profile, or the Kconfig defaults. Call after nimble_port_init(). */
+void sensor_init(void);
+
+/** Pushes the profile to the mouse; call once HID++ is running. */
+void sensor_apply(void);
+
+/**
+ * GET_REPORT(Feature) on the vendor interface: little endian DPI, report
+ * interval in ms, flags.
+ *
+ * @return Number of bytes written.
+ */
+uint16_t sensor_get_feature(uint8_t *buffer, uint16_t reqlen);
+
+/** SET_REPORT(Feature) from the TinyUSB task; applied from the host task. */
+void sensor_set_feature(const uint8_t *buffer, uint16_t len);
+
+void sensor_stats_get(struct sensor_stats *out);
+void sensor_stats_log(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,182 @@
+#include <inttypes.h>
+#include <string.h>
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "nvs.h"
+#include "stall.h"
+
+/*
+ * Measures whether flash operations still stall the input path.  The GAP
+ * handler and the start-of-frame callback count their cycles into one
+ * histogram while flash is quiet and another while NVS is being written or
+ * shortly after, when the instruction cache is refilling.  A background
+ * task writes NVS on demand, standing in for the writes bonding and the
+ * HOGP and HID++ caches make, so two builds, with and without
+ * CONFIG_DONGLE_HOT_PATH_IRAM (see linker.lf), can be compared on the same
+ * load (see loadgen.h).
+ *
+ * IRAM only saves cache misses: while one core writes flash, the other is
+ * parked, and that wait still shows up as the flash column's tail.
+ */
+
+#define STALL_NVS_NAMESPACE "stall"
+#define STALL_BLOB_LEN 256
+/* A run starting this soon after a write still counts as under writes. */
+#define STALL_AFTER_US 2000
+
+static const char *tag = "STALL";
+
+static const char *const point_names[STALL_POINT_COUNT] = {
+    [STALL_NOTIFY] = "notify",
+    [STALL_SOF] = "sof",
+};
+
+static TaskHandle_t writer;
+static volatile bool writes_on = CONFIG_DONGLE_STALL_WRITES_AT_BOOT;
+static volatile bool writing;
+static volatile int64_t write_end_us;
+
+static struct stall_stats stats;
+
+void stall_record(enum stall_point point, uint32_t cycles)
+{
+    bool flash = writing || esp_timer_get_time() - write_end_us < STALL_AFTER_US;
+    struct stall_hist *h = &stats.hist[point][flash];
+    int bucket = 0;
+
+    if (cycles >= 1024)
+    {
+        bucket = 31 - __builtin_clz(cycles) - 9;
+        if (bucket >= STALL_BUCKETS)
+        {
+            bucket = STALL_BUCKETS - 1;
+        }
+    }
+
+    h->count++;
+    h->cycles_sum += cycles;
+    if (cycles > h->cycles_max)
+    {
+        h->cycles_max = cycles;
+    }
+    h->buckets[bucket]++;
+}
+
+static void writer_task(void *param)
+{
+    uint8_t blob[STALL_BLOB_LEN];
+    nvs_handle_t nvs;
+    uint8_t fill = 0;
+    int64_t start;
+    uint32_t took;
+    esp_err_t err;
+
+    err = nvs_open(STALL_NVS_NAMESPACE, NVS_READWRITE, &nvs);
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(tag, "nvs_open failed; err=%d", err);
+        writer = NULL;
+        vTaskDelete(NULL);
+        return;
+    }
+
+    for (;;)
+    {
+        if (!writes_on)
+        {
+            ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+            continue;
+        }
+
+        /* New contents every time, or NVS would skip the write. */
+        memset(blob, fill++, sizeof blob);
+
+        start = esp_timer_get_time();
+        writing = true;
+        err = nvs_set_blob(nvs, "blob", blob, sizeof blob);
+        if (err == ESP_OK)
+        {
+            err = nvs_commit(nvs);
+        }
+        writing = false;
+        write_end_us = esp_timer_get_time();
+
+        took = write_end_us - start;
+        stats.writes++;
+        if (err != ESP_OK)
+        {
+            stats.write_errors++;
+        }
+        if (took > stats.write_us_max)
+        {
+            stats.write_us_max = took;
+        }
+
+        vTaskDelay(pdMS_TO_TICKS(CONFIG_DONGLE_STALL_WRITE_PERIOD_MS));
+    }
+}
+
+void stall_init(void)
+{
+    write_end_us = INT64_MIN / 2;
+
+    if (xTaskCreate(writer_task, "stall_nvs", 3072, NULL, tskIDLE_PRIORITY + 1,
+                    &writer) != pdPASS)
+    {
+        ESP_LOGE(tag, "no memory for the NVS writer task");
+    }
+}
+
+void stall_set_writes(bool on)
+{
+    writes_on = on;
+    ESP_LOGI(tag, "NVS writes %s", on ? "on" : "off");
+
+    if (on && writer != NULL)
+    {
+        xTaskNotifyGive(writer);
+    }
+}
+
+bool stall_writes(void)
+{
+    return writes_on;
+}
+
+void stall_reset(void)
+{
+    memset(stats.hist, 0, sizeof stats.hist);
+}
+
+void stall_stats_get(struct stall_stats *out)
+{
+    *out = stats;
+}
+
+void stall_stats_log(void)
+{
+    int p;
+    int f;
+
+    ESP_LOGI(tag, "%s%s; writes=%" PRIu32 " errors=%" PRIu32 " longest=%" PRIu32 "us",
+#if CONFIG_DONGLE_HOT_PATH_IRAM
+             "hot path in IRAM",
+#else
+             "hot path in flash",
+#endif
+             writes_on ? ", writing" : "", stats.writes, stats.write_errors, stats.write_us_max);
+
+    for (p = 0; p < STALL_POINT_COUNT; p++)
+    {
+        for (f = 0; f < 2; f++)
+        {
+            const struct stall_hist *h = &stats.hist[p][f];
+
+            ESP_LOGI(tag, "%s %s: n=%" PRIu32 " cycles avg=%" PRIu32 " max=%" PRIu32,
+                     point_names[p], f ? "flash" : "quiet", h->count,
+                     h->count ? (uint32_t)(h->cycles_sum / h->count) : 0, h->cycles_max);
+        }
+    }
+}
@@ -0,0 +1,72 @@
+#ifndef H_STALL_
+#define H_STALL_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "esp_cpu.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Where the input path is timed. */
+enum stall_point {
+    /** GAP handler, from a notification to its input being queued. */
+    STALL_NOTIFY,
+    /** Start-of-frame callback, which builds and submits the reports. */
+    STALL_SOF,
+    STALL_POINT_COUNT,
+};
+
+/** Buckets of cycles: under 1024, then each up to twice the last; the last is open. */
+#define STALL_BUCKETS 12
+
+struct stall_hist {
+    uint32_t count;
+    uint64_t cycles_sum;
+    uint32_t cycles_max;
+    uint32_t buckets[STALL_BUCKETS];
+};
+
+struct stall_stats {
+    /**
+     * By point, then quiet [0] or flash [1]: runs that overlapped an NVS
+     * write of the background writer or started soon after one.
+     */
+    struct stall_hist hist[STALL_POINT_COUNT][2];
+
+    /** Background NVS writes, failed ones, and the longest, in us. */
+    uint32_t writes;
+    uint32_t write_errors;
+    uint32_t write_us_max;
+};
+
+#if CONFIG_DONGLE_STALL_PROBE
+#define STALL_BEGIN(var) uint32_t var = esp_cpu_get_cycle_count()
+#define STALL_END(point, var) stall_record(STALL_##point, esp_cpu_get_cycle_count() - (var))
+#else
+#define STALL_BEGIN(var) ((void)0)
+#define STALL_END(point, var) ((void)0)
+#endif
+
+/** Use the STALL_*() macros, which compile away without CONFIG_DONGLE_STALL_PROBE. */
+void stall_record(enum stall_point point, uint32_t cycles);
+
+/** Creates the background NVS writer. Call after nvs_flash_init(). */
+void stall_init(void);
+
+/** Starts or stops the background NVS writes. */
+void stall_set_writes(bool on);
+bool stall_writes(void);
+
+/** Clears the histograms, e.g. between a quiet run and one with writes. */
+void stall_reset(void);
+
+void stall_stats_get(struct stall_stats *out);
+void stall_stats_log(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
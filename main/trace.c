@@ -0,0 +1,209 @@
+#include <inttypes.h>
+#include <string.h>
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_cpu.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "trace.h"
+
+/*
+ * Begin/end events of the input pipeline in a ring of fixed-size records,
+ * for a timeline of how notifications, decoding, discovery and USB
+ * transfers overlap.  Recording takes a timestamp and a short critical
+ * section; the newest events are kept.
+ *
+ * Tasks are numbered in the order they first record an event (or when a
+ * stream starts), so a record needs a byte for its task rather than the
+ * handle, and the stream names each number once: the header names every
+ * task that exists then, and a task created later is named in a record of
+ * its own just before its first event.
+ */
+
+#define TRACE_MAX_TASKS 24
+
+static const char *tag = "TRACE";
+
+static portMUX_TYPE trace_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static volatile bool enabled = CONFIG_DONGLE_TRACE_AT_BOOT;
+
+static struct trace_event ring[CONFIG_DONGLE_TRACE_RING_LEN];
+static size_t head;
+static size_t count;
+
+static TaskHandle_t tasks[TRACE_MAX_TASKS];
+static char names[TRACE_MAX_TASKS][TRACE_TASK_NAME_LEN];
+static size_t task_count;
+/* Tasks the current stream has named so far. */
+static size_t named;
+
+/* Only used while writing a stream header. */
+static TaskStatus_t status[TRACE_MAX_TASKS];
+
+static struct trace_stats stats;
+
+/* Under trace_lock.  Tasks past the table share its last number. */
+static uint8_t task_index(TaskHandle_t task)
+{
+    size_t i;
+
+    for (i = 0; i < task_count; i++)
+    {
+        if (tasks[i] == task)
+        {
+            return i;
+        }
+    }
+
+    if (task_count == TRACE_MAX_TASKS)
+    {
+        return TRACE_MAX_TASKS - 1;
+    }
+
+    tasks[task_count] = task;
+    strncpy(names[task_count], pcTaskGetName(task), TRACE_TASK_NAME_LEN - 1);
+    return task_count++;
+}
+
+void trace_record(enum trace_point point, uint8_t phase, uint8_t arg)
+{
+    struct trace_event *ev;
+    TaskHandle_t task;
+
+    if (!enabled)
+    {
+        return;
+    }
+
+    task = xTaskGetCurrentTaskHandle();
+    if (esp_cpu_get_core_id() != 0)
+    {
+        phase |= TRACE_CORE1;
+    }
+
+    portENTER_CRITICAL(&trace_lock);
+    ev = &ring[head];
+    ev->timestamp_us = (uint32_t)esp_timer_get_time();
+    ev->point = point;
+    ev->phase = phase;
+    ev->task = task_index(task);
+    ev->arg = arg;
+
+    head = (head + 1) % CONFIG_DONGLE_TRACE_RING_LEN;
+    if (count < CONFIG_DONGLE_TRACE_RING_LEN)
+    {
+        count++;
+    }
+    else
+    {
+        /* Overwrote the oldest; the one after it now starts the ring. */
+        ring[head].phase |= TRACE_LOST;
+        stats.lost++;
+    }
+    stats.events++;
+    portEXIT_CRITICAL(&trace_lock);
+}
+
+void trace_set_enabled(bool on)
+{
+    enabled = on;
+    ESP_LOGI(tag, "trace %s", on ? "on" : "off");
+}
+
+bool trace_enabled(void)
+{
+    return enabled;
+}
+
+size_t trace_file_header(uint8_t *buffer, size_t size)
+{
+    struct trace_file_header header = {
+        .magic = TRACE_MAGIC,
+        .version = TRACE_VERSION,
+        .record_len = sizeof(struct trace_event),
+    };
+    UBaseType_t n;
+    size_t i;
+    size_t len;
+
+    /* Number every task now, so the header can name them all. */
+    n = uxTaskGetSystemState(status, TRACE_MAX_TASKS, NULL);
+
+    portENTER_CRITICAL(&trace_lock);
+    for (i = 0; i < n; i++)
+    {
+        task_index(status[i].xHandle);
+    }
+    header.task_count = task_count;
+    named = task_count;
+    portEXIT_CRITICAL(&trace_lock);
+
+    len = sizeof header + header.task_count * TRACE_TASK_NAME_LEN;
+    if (len > size)
+    {
+        return 0;
+    }
+
+    memcpy(buffer, &header, sizeof header);
+    memcpy(buffer + sizeof header, names, header.task_count * TRACE_TASK_NAME_LEN);
+
+    return len;
+}
+
+size_t trace_read(uint8_t *buffer, size_t size)
+{
+    size_t len = 0;
+    size_t tail;
+
+    portENTER_CRITICAL(&trace_lock);
+    tail = (head + CONFIG_DONGLE_TRACE_RING_LEN - count) % CONFIG_DONGLE_TRACE_RING_LEN;
+    while (count > 0)
+    {
+        const struct trace_event *ev = &ring[tail];
+
+        if (ev->task >= named)
+        {
+            /* Numbered after the header: name the task before its event. */
+            struct trace_event rec = {
+                .timestamp_us = ev->timestamp_us,
+                .point = TRACE_TASK_NAME,
+                .task = named,
+            };
+
+            if (len + sizeof rec + TRACE_TASK_NAME_LEN > size)
+            {
+                break;
+            }
+            memcpy(buffer + len, &rec, sizeof rec);
+            memcpy(buffer + len + sizeof rec, names[named], TRACE_TASK_NAME_LEN);
+            len += sizeof rec + TRACE_TASK_NAME_LEN;
+            named++;
+            continue;
+        }
+
+        if (len + sizeof *ev > size)
+        {
+            break;
+        }
+        memcpy(buffer + len, ev, sizeof *ev);
+        len += sizeof *ev;
+        tail = (tail + 1) % CONFIG_DONGLE_TRACE_RING_LEN;
+        count--;
+    }
+    portEXIT_CRITICAL(&trace_lock);
+
+    return len;
+}
+
+void trace_stats_get(struct trace_stats *out)
+{
+    *out = stats;
+}
+
+void trace_stats_log(void)
+{
+    ESP_LOGI(tag, "%s; events=%" PRIu32 " lost=%" PRIu32 " buffered=%u of %u",
+             enabled ? "on" : "off", stats.events, stats.lost, (unsigned)count,
+             (unsigned)CONFIG_DONGLE_TRACE_RING_LEN);
+}
@@ -0,0 +1,120 @@
+#ifndef H_TRACE_
+#define H_TRACE_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Trace points: name, and the label shown on the timeline.  The argument
+ * byte of each event is noted next to it.  tools/trace2json.py reads this
+ * list, so keep one X() per line.
+ */
+#define TRACE_POINTS(X)                                                      \
+    X(GAP_EVENT, "gap event")           /* event type */                    \
+    X(DECODE, "decode")                 /* report ID; end: decoded or not */ \
+    X(USB_SUBMIT, "usb submit")         /* report ID */                     \
+    X(USB_COMPLETE, "usb complete")     /* HID instance */                  \
+    X(DISC_SVC, "discover service")     /* status, low byte */              \
+    X(DISC_CHR, "discover characteristic") /* status, low byte */           \
+    X(DISC_DSC, "discover descriptor")  /* status, low byte */
+
+enum trace_point {
+#define TRACE_ENUM(name, label) TRACE_##name,
+    TRACE_POINTS(TRACE_ENUM)
+#undef TRACE_ENUM
+    TRACE_POINT_COUNT,
+};
+
+/*
+ * Trace file format, little endian and packed: a struct trace_file_header,
+ * task_count task names of TRACE_TASK_NAME_LEN bytes (an event's task is
+ * an index into them), then struct trace_event records in time order.
+ * A task that records its first event after the header gets a record with
+ * point TRACE_TASK_NAME before that event, followed by its name in
+ * TRACE_TASK_NAME_LEN bytes.
+ * Streamed from the console with "trace stream", the same way as a capture
+ * (see capture.h); tools/trace2json.py turns it into Chrome trace JSON
+ * for chrome://tracing or Perfetto.
+ */
+
+#define TRACE_MAGIC "DNGLTRC"
+#define TRACE_VERSION 2
+#define TRACE_TASK_NAME_LEN 16
+/** Point of a record that names its task (see above). */
+#define TRACE_TASK_NAME 0xFF
+
+struct trace_file_header {
+    /** TRACE_MAGIC, NUL terminated. */
+    char magic[8];
+    uint16_t version;
+    /** sizeof(struct trace_event). */
+    uint16_t record_len;
+    uint16_t task_count;
+    uint16_t reserved;
+} __attribute__((packed));
+
+#define TRACE_PHASE_BEGIN 0
+#define TRACE_PHASE_END 1
+#define TRACE_PHASE_INSTANT 2
+#define TRACE_PHASE_MASK 0x03
+/** Set in phase when the event ran on core 1. */
+#define TRACE_CORE1 0x80
+/** Set in phase on the first event after older ones were overwritten. */
+#define TRACE_LOST 0x40
+
+struct trace_event {
+    /** Low 32 bits of the esp_timer time; wraps after 71 minutes. */
+    uint32_t timestamp_us;
+    uint8_t point;
+    uint8_t phase;
+    uint8_t task;
+    uint8_t arg;
+} __attribute__((packed));
+
+struct trace_stats {
+    /** Events recorded, and overwritten before they were read. */
+    uint32_t events;
+    uint32_t lost;
+};
+
+#if CONFIG_DONGLE_TRACE
+#define TRACE_BEGIN(point, arg) trace_record(TRACE_##point, TRACE_PHASE_BEGIN, (arg))
+#define TRACE_END(point, arg) trace_record(TRACE_##point, TRACE_PHASE_END, (arg))
+#define TRACE_INSTANT(point, arg) trace_record(TRACE_##point, TRACE_PHASE_INSTANT, (arg))
+#else
+#define TRACE_BEGIN(point, arg) ((void)0)
+#define TRACE_END(point, arg) ((void)0)
+#define TRACE_INSTANT(point, arg) ((void)0)
+#endif
+
+/** Use the TRACE_*() macros, which compile away without CONFIG_DONGLE_TRACE. */
+void trace_record(enum trace_point point, uint8_t phase, uint8_t arg);
+
+/** Starts or stops recording. */
+void trace_set_enabled(bool enabled);
+bool trace_enabled(void);
+
+/**
+ * Writes the file header and task names for a new stream, naming every
+ * task that exists now.
+ *
+ * @return Bytes written, 0 if size is too small.
+ */
+size_t trace_file_header(uint8_t *buffer, size_t size);
+
+/** Takes the oldest events out of the ring. @return Bytes written to buffer. */
+size_t trace_read(uint8_t *buffer, size_t size);
+
+void trace_stats_get(struct trace_stats *out);
+void trace_stats_log(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
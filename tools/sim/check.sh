@@ -0,0 +1,82 @@
+#!/bin/sh
+#
+# Builds the simulator and runs the configurations whose invariants the
+# firmware must keep (sim --check).  Run from the repository root; exits
+# non-zero if any configuration fails.
+#
+#   tools/sim/check.sh [build directory, default /tmp/sim-check]
+
+set -e
+
+out=${1:-/tmp/sim-check}
+mkdir -p "$out"
+
+python3 main/gen_profiles.py --sdkconfig tools/sim/shim/sdkconfig.h --out "$out/profiles_gen.h"
+python3 main/gen_pointer_lut.py --out "$out/pointer_lut.h"
+
+# build NAME [gcc flags]
+build() {
+    name=$1
+    shift
+    gcc -O2 -std=gnu11 "$@" -Itools/sim/shim -Imain -I"$out" -o "$out/$name" \
+        tools/sim/sim.c main/report.c main/profile.c main/pointer.c main/phase_lock.c \
+        main/hid_map.c main/remap.c -lm
+}
+
+build sim
+build sim-spread -DCONFIG_DONGLE_MOTION_SPREAD=1
+
+# Acceleration as Kconfig's defaults set it up (unity to 4 counts, 250 % from
+# 40) and a 10 degree rotation, for timing the transform.
+mkdir -p "$out/accel"
+python3 main/gen_pointer_lut.py --low 4 --high 40 --max-gain 250 --rotation 10 \
+    --out "$out/accel/pointer_lut.h"
+build sim-accel -I"$out/accel" -DCONFIG_DONGLE_POINTER_ROTATION_DEG=10
+
+sim="$out/sim --check"
+spread="$out/sim-spread --check"
+
+# The phase loop settles within reach of its target from any starting
+# anchor, at intervals with a 0.5 ms and a 1 ms phase period.  At 7.5 ms,
+# the shortest interval, late arrivals go the long way round; the simulated
+# link fails the run on a nudge below it.
+for anchor in 0 100 250 400 500 700 900; do
+    $sim --phase-lock --duration 12000 --itvl 7.5,8.75,10,12.5,15 --loss 0,0.05 \
+        --anchor $anchor
+done
+
+# Spreading estimates the notification spacing from the motion samples.
+# Input that starts long after boot, here past the 36 minutes a 32-bit
+# microsecond gap holds, must not skew it.
+for start in 10 5000 2400000; do
+    $spread --start $start --itvl 7.5,15 --binterval 1,4 --max-p99 20
+done
+
+# Button storm: an edge on every sensor sample, as many as the host polls
+# for, sent in bursts of up to eight a connection event and through loss.
+# The dongle must not drop any (check_result() fails on edge_drops); faster
+# than the host polls, no bounded queue could keep up.
+for storm in "1 2" "4 8" "8 16"; do
+    set -- $storm
+    $sim --click $2 --binterval $1 --itvl 7.5,15 --packets 1,4,8 --loss 0,0.2 \
+        --duration 3000
+done
+
+# Clicks behind motion that cancels out on the dongle (+N then -N before a
+# frame takes it) still reach the host, with and without spreading.
+for storm in "1 2" "4 8" "8 16"; do
+    set -- $storm
+    for build in "$sim" "$spread"; do
+        $build --motion jitter --speed 5 --click $2 --binterval $1 --itvl 7.5,15 \
+            --packets 1,4,8 --duration 3000
+    done
+done
+
+# The Report Map decoder and remapped buttons keep up as well.
+$sim --report-map --remap swap --click 50 --itvl 7.5,15 --binterval 1,4 --max-p99 20
+
+# Not a check: what decoding, remapping and the pointer transform cost per
+# report, for comparing.
+"$out/sim-accel" --decode-cost 200
+
+echo "all checks passed"
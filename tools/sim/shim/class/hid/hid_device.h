@@ -0,0 +1,41 @@
+#pragma once
+#include <stdbool.h>
+#include <stdint.h>
+
+/* The parts of TinyUSB's HID class the report path uses. */
+enum
+{
+    HID_ITF_PROTOCOL_NONE = 0,
+    HID_ITF_PROTOCOL_KEYBOARD = 1,
+    HID_ITF_PROTOCOL_MOUSE = 2,
+};
+
+enum
+{
+    HID_PROTOCOL_BOOT = 0,
+    HID_PROTOCOL_REPORT = 1,
+};
+
+typedef struct __attribute__((packed))
+{
+    uint8_t modifier;
+    uint8_t reserved;
+    uint8_t keycode[6];
+} hid_keyboard_report_t;
+
+typedef struct __attribute__((packed))
+{
+    uint8_t buttons;
+    int8_t x;
+    int8_t y;
+    int8_t wheel;
+    int8_t pan;
+} hid_mouse_report_t;
+
+/* Implemented by the simulated USB device in sim.c. */
+bool tud_hid_ready(void);
+bool tud_hid_report(uint8_t report_id, void const *report, uint16_t len);
+uint8_t tud_hid_get_protocol(void);
+
+/* Implemented by report.c. */
+void tud_hid_report_complete_cb(uint8_t instance, uint8_t const *report, uint16_t len);
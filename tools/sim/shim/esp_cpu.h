@@ -0,0 +1,8 @@
+#pragma once
+#include <stdint.h>
+
+/* Cycle counts mean nothing in simulated time. */
+static inline uint32_t esp_cpu_get_cycle_count(void)
+{
+    return 0;
+}
@@ -0,0 +1,5 @@
+#pragma once
+#include <stdint.h>
+
+/* Simulated time, advanced by the event loop in sim.c. */
+int64_t esp_timer_get_time(void);
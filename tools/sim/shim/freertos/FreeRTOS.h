@@ -0,0 +1,14 @@
+#pragma once
+
+/* Like the real one, this brings in the Kconfig values. */
+#include "sdkconfig.h"
+
+/* The simulator is single threaded; critical sections are no-ops. */
+typedef struct
+{
+    int unused;
+} portMUX_TYPE;
+
+#define portMUX_INITIALIZER_UNLOCKED {0}
+#define portENTER_CRITICAL(mux) ((void)(mux))
+#define portEXIT_CRITICAL(mux) ((void)(mux))
@@ -0,0 +1,14 @@
+#pragma once
+#include <stdint.h>
+
+/* The parts of the GAP API the firmware's link code uses. */
+struct ble_gap_conn_desc
+{
+    uint16_t conn_handle;
+    uint16_t conn_itvl;
+    uint16_t conn_latency;
+    uint16_t supervision_timeout;
+};
+
+/* Implemented by the simulated link in sim.c. */
+int ble_gap_conn_find(uint16_t handle, struct ble_gap_conn_desc *out_desc);
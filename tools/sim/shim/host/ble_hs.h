@@ -0,0 +1,13 @@
+#pragma once
+#include <stdint.h>
+#include "nimble/nimble_npl.h"
+#include "host/ble_gap.h"
+
+#define BLE_HS_CONN_HANDLE_NONE 0xffff
+#define BLE_HS_EBUSY 6
+#define BLE_HS_EINVAL 3
+
+#define BLE_HCI_CONN_ITVL_MIN 0x0006
+#define BLE_HCI_CONN_ITVL_MAX 0x0c80
+
+#define MODLOG_DFLT(level, ...) ((void)0)
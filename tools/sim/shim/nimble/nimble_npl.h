@@ -0,0 +1,50 @@
+#pragma once
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * NimBLE's OS abstraction, reduced to the callouts and events the firmware
+ * uses.  The simulator runs every callout on its one thread when it falls
+ * due, and a posted event at once.
+ */
+struct ble_npl_event;
+typedef void ble_npl_event_fn(struct ble_npl_event *ev);
+
+struct ble_npl_eventq
+{
+    int unused;
+};
+
+struct ble_npl_event
+{
+    ble_npl_event_fn *fn;
+    void *arg;
+};
+
+struct ble_npl_callout
+{
+    struct ble_npl_event ev;
+    int64_t due_us;
+    bool armed;
+};
+
+typedef uint32_t ble_npl_time_t;
+
+/* One tick per millisecond, like the firmware's FreeRTOS configuration. */
+static inline ble_npl_time_t ble_npl_time_ms_to_ticks32(uint32_t ms)
+{
+    return ms;
+}
+
+static inline void ble_npl_event_init(struct ble_npl_event *ev, ble_npl_event_fn *fn, void *arg)
+{
+    ev->fn = fn;
+    ev->arg = arg;
+}
+
+/* Implemented by sim.c. */
+void ble_npl_eventq_put(struct ble_npl_eventq *evq, struct ble_npl_event *ev);
+void ble_npl_callout_init(struct ble_npl_callout *co, struct ble_npl_eventq *evq,
+                          ble_npl_event_fn *fn, void *arg);
+int ble_npl_callout_reset(struct ble_npl_callout *co, ble_npl_time_t ticks);
+void ble_npl_callout_stop(struct ble_npl_callout *co);
@@ -0,0 +1,5 @@
+#pragma once
+#include "nimble/nimble_npl.h"
+
+/* Implemented by sim.c. */
+struct ble_npl_eventq *nimble_port_get_dflt_eventq(void);
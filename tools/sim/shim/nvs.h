@@ -0,0 +1,51 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+/* The simulator has no flash: nothing is stored, so every module starts
+ * from its defaults, and saves fail. */
+typedef uint32_t nvs_handle_t;
+
+typedef enum
+{
+    NVS_READONLY,
+    NVS_READWRITE,
+} nvs_open_mode_t;
+
+static inline esp_err_t nvs_open(const char *ns, nvs_open_mode_t mode, nvs_handle_t *out)
+{
+    (void)ns;
+    (void)mode;
+    (void)out;
+    return ESP_ERR_NVS_NOT_FOUND;
+}
+
+static inline esp_err_t nvs_get_blob(nvs_handle_t h, const char *key, void *out, size_t *len)
+{
+    (void)h;
+    (void)key;
+    (void)out;
+    (void)len;
+    return ESP_ERR_NVS_NOT_FOUND;
+}
+
+static inline esp_err_t nvs_set_blob(nvs_handle_t h, const char *key, const void *v, size_t len)
+{
+    (void)h;
+    (void)key;
+    (void)v;
+    (void)len;
+    return ESP_FAIL;
+}
+
+static inline esp_err_t nvs_commit(nvs_handle_t h)
+{
+    (void)h;
+    return ESP_FAIL;
+}
+
+static inline void nvs_close(nvs_handle_t h)
+{
+    (void)h;
+}
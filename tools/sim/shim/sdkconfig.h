@@ -0,0 +1,45 @@
+/*
+ * Kconfig values for the simulator build, defaulting to the firmware
+ * defaults.  Override any of them with -D on the gcc command line.
+ */
+#ifndef CONFIG_DONGLE_EDGE_QUEUE_LEN
+#define CONFIG_DONGLE_EDGE_QUEUE_LEN 32
+#endif
+#ifndef CONFIG_DONGLE_MOTION_SPREAD
+#define CONFIG_DONGLE_MOTION_SPREAD 0
+#endif
+#ifndef CONFIG_DONGLE_POINTER_SCALE_PCT
+#define CONFIG_DONGLE_POINTER_SCALE_PCT 100
+#endif
+#ifndef CONFIG_DONGLE_POINTER_ROTATION_DEG
+#define CONFIG_DONGLE_POINTER_ROTATION_DEG 0
+#endif
+#ifndef CONFIG_DONGLE_POINTER_ANGLE_SNAP
+#define CONFIG_DONGLE_POINTER_ANGLE_SNAP 0
+#endif
+#ifndef CONFIG_DONGLE_POINTER_SNAP_RATIO
+#define CONFIG_DONGLE_POINTER_SNAP_RATIO 8
+#endif
+#ifndef CONFIG_DONGLE_POINTER_SMOOTHING
+#define CONFIG_DONGLE_POINTER_SMOOTHING 0
+#endif
+#ifndef CONFIG_DONGLE_PHASE_LOCK
+#define CONFIG_DONGLE_PHASE_LOCK 1
+#endif
+#ifndef CONFIG_DONGLE_PHASE_LOCK_TARGET_US
+#define CONFIG_DONGLE_PHASE_LOCK_TARGET_US 850
+#endif
+#ifndef CONFIG_DONGLE_PHASE_LOCK_DEADBAND_US
+#define CONFIG_DONGLE_PHASE_LOCK_DEADBAND_US 100
+#endif
+#ifndef CONFIG_DONGLE_PHASE_LOCK_HOLDOFF_MS
+#define CONFIG_DONGLE_PHASE_LOCK_HOLDOFF_MS 2000
+#endif
+#ifndef CONFIG_DONGLE_TRACE
+#define CONFIG_DONGLE_TRACE 0
+#endif
+
+/* Read by gen_profiles.py. */
+#define CONFIG_DONGLE_PROFILE_MX_MASTER_3 1
+#define CONFIG_DONGLE_PROFILE_MX_KEYS 1
+#define CONFIG_DONGLE_USB_IDENTITY_ID "mx_master_3"
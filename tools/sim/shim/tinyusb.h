@@ -0,0 +1,11 @@
+#pragma once
+#include <stdbool.h>
+#include <stdint.h>
+#include "class/hid/hid_device.h"
+
+/* Implemented by the simulated USB device in sim.c. */
+void tud_sof_cb_enable(bool enable);
+bool tud_remote_wakeup(void);
+
+/* Implemented by report.c. */
+void tud_sof_cb(uint32_t frame_count);
@@ -0,0 +1,1693 @@
+/*
+ * Discrete-event simulator of the input pipeline, for choosing the BLE
+ * connection interval, the USB polling interval and the report scheduler
+ * from data instead of guesswork.
+ *
+ * A mouse produces sensor samples (synthetic motion, or motion decoded from
+ * a capture recorded on the dongle, see main/capture.h) and queues them as
+ * notifications, merging motion into the one not sent yet.  Connection
+ * events send up to --packets notifications each; every attempt is lost
+ * with probability --loss and retried at the next event, a lost attempt
+ * ending the event.  The dongle side is the firmware's own code: the
+ * profile decoder (or hid_map.c with --report-map), remap.c, pointer.c and
+ * report.c, driven by a simulated USB device whose start of frame comes
+ * every millisecond and whose endpoint the host polls every --binterval
+ * frames.
+ *
+ * For each configuration it reports, with times from the sensor sample to
+ * the host receiving the report that first shows it:
+ *
+ *   - motion and button latency distributions;
+ *   - notifications, USB reports, motion merged on the dongle, drops;
+ *   - motion error: distance between the sensor's and the host's cursor
+ *     every frame (RMS and max) and after everything drained (final).
+ *
+ * Every option that takes a list runs the product of all lists, one
+ * configuration per line.  Each run is a fresh process, so the firmware
+ * code starts from its boot state every time.
+ *
+ * Build from the repository root (generated headers go anywhere outside
+ * the tree):
+ *
+ *   mkdir -p /tmp/sim
+ *   python3 main/gen_profiles.py --sdkconfig tools/sim/shim/sdkconfig.h \
+ *       --out /tmp/sim/profiles_gen.h
+ *   python3 main/gen_pointer_lut.py --out /tmp/sim/pointer_lut.h
+ *   gcc -O2 -std=gnu11 -Itools/sim/shim -Imain -I/tmp/sim -o /tmp/sim/sim \
+ *       tools/sim/sim.c main/report.c main/profile.c main/pointer.c \
+ *       main/phase_lock.c main/hid_map.c main/remap.c -lm
+ *
+ * Kconfig choices of the firmware are compile-time here too: add e.g.
+ * -DCONFIG_DONGLE_MOTION_SPREAD=1 for the spreading scheduler, and
+ * -DCONFIG_DONGLE_TRACE=1 to allow --trace, which writes the firmware's
+ * trace points (main/trace.h) plus connection events and host polls as
+ * Chrome trace JSON.  Motion error assumes the default, identity pointer
+ * transform.
+ *
+ * Examples:
+ *
+ *   sim --itvl 7.5,11.25,15 --binterval 1,4,8 --loss 0,0.05
+ *   sim --capture mouse.cap --itvl 7.5,15
+ *   sim --capture mouse.cap --as-recorded --binterval 1,8
+ *
+ * --as-recorded skips the mouse and link models and feeds the captured
+ * notifications to the dongle at their recorded times; latency then counts
+ * from their arrival.
+ *
+ * --phase-lock runs phase_lock.c on the notifications, with the link
+ * applying its interval nudges, and adds its nudges, phase error and
+ * jitter to the output.  --check makes the run fail unless every
+ * configuration keeps the invariants in check_result(); check.sh runs the
+ * configurations that matter.
+ *
+ * --remap none|identity|swap runs remap.c with no remapping at all, the
+ * tables it boots with, or buttons 1 and 2 swapped and a layer on button 5.
+ * --decode-cost N times the decode stage instead, N passes over the mouse
+ * reports of the synthetic input, for each decoder and remap mode and with
+ * pointer_transform() after it, and prints nanoseconds per report on the
+ * build machine.
+ */
+
+#include <getopt.h>
+#include <inttypes.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#include "sdkconfig.h"
+#include "esp_timer.h"
+#include "host/ble_hs.h"
+#include "nimble/nimble_port.h"
+#include "tinyusb.h"
+#include "capture.h"
+#include "conn_ctrl.h"
+#include "hid_map.h"
+#include "phase_lock.h"
+#include "pointer.h"
+#include "profile.h"
+#include "remap.h"
+#include "report.h"
+#include "trace.h"
+
+#define FRAME_US 1000
+/* One notification and its acknowledgement on the 1M PHY. */
+#define BLE_PACKET_US 300
+/* Value handle of the MX Master 3 mouse report, which synthetic motion uses. */
+#define MOUSE_HANDLE 0x33
+#define MOUSE_REPORT_LEN 7
+/* Its report ID in the Report Map --report-map decodes with. */
+#define MOUSE_REPORT_ID 2
+#define MOUSE_QUEUE_LEN 8
+#define RX_QUEUE_LEN 64
+/* The run goes on until all input drained. */
+#define DRAIN_US 100000
+#define MAX_LIST 16
+#define BLE_GAP_EVENT_NOTIFY_RX 12
+#define NO_SAMPLE SIZE_MAX
+#define SIM_CONN_HANDLE 1
+#define ITVL_UNIT_US 1250
+/* A parameter update applies at this connection event after the request,
+ * the last one at the old interval; phase_lock.c assumes the same. */
+#define SIM_UPDATE_LAG 7
+#define MAX_CALLOUTS 4
+/* Samples in one jitter window of phase_lock.c. */
+#define PHASE_LOCK_WINDOW 64
+/* Exit status of a run that completed but failed a --check. */
+#define CHECK_FAILED 3
+
+enum remap_mode
+{
+    REMAP_MODE_NONE,
+    REMAP_MODE_IDENTITY,
+    REMAP_MODE_SWAP,
+    REMAP_MODE_COUNT,
+};
+
+static const char *const remap_mode_names[REMAP_MODE_COUNT] = {
+    [REMAP_MODE_NONE] = "none",
+    [REMAP_MODE_IDENTITY] = "identity",
+    [REMAP_MODE_SWAP] = "swap",
+};
+
+/* One configuration of the product of the option lists. */
+struct config
+{
+    double itvl_ms;
+    int binterval;
+    double loss;
+    int packets;
+};
+
+/* Options shared by all configurations. */
+static struct
+{
+    int max_retries;
+    int poll_offset_us;
+    int anchor_us;
+    int64_t start_us;
+    int64_t max_p99_us;
+    uint32_t seed;
+    bool as_recorded;
+    bool csv;
+    bool phase_lock;
+    bool check;
+    bool report_map;
+    enum remap_mode remap;
+    const char *trace_path;
+} opt = {
+    .max_retries = 0,
+    .poll_offset_us = 100,
+    .anchor_us = 250,
+    /* Input starts after a few frames. */
+    .start_us = 10000,
+    .seed = 1,
+    /* What the firmware runs until the host edits the tables. */
+    .remap = REMAP_MODE_IDENTITY,
+};
+
+/* A sensor sample, or one decoded captured notification. */
+struct sample
+{
+    int64_t t_us;
+    uint8_t buttons;
+    int16_t dx;
+    int16_t dy;
+    int8_t wheel;
+    int8_t pan;
+};
+
+/* A notification on its way to the dongle, and the samples it carries. */
+struct packet
+{
+    int64_t at_us;
+    uint16_t handle;
+    uint16_t len;
+    uint8_t data[CAPTURE_MAX_LEN];
+    size_t first;
+    size_t last;
+};
+
+/* A notification still queued in the mouse. */
+struct mouse_packet
+{
+    uint8_t buttons;
+    int32_t dx;
+    int32_t dy;
+    int32_t wheel;
+    int32_t pan;
+    size_t first;
+    size_t last;
+    int attempts;
+};
+
+/* Growable array of sample indices or latencies. */
+struct vec
+{
+    int64_t *v;
+    size_t n;
+    size_t cap;
+};
+
+static struct sample *samples;
+static size_t nsamples;
+
+/* --as-recorded: the captured notifications themselves. */
+static struct packet *recorded;
+static size_t nrecorded;
+
+static const struct profile *profile;
+
+/* --report-map: the MX Master 3 mouse report as its Report Map describes it,
+ * and the table hid_map.c builds from it. */
+static const uint8_t mouse_report_map[] = {
+    0x05, 0x01,       /* Usage Page (Generic Desktop) */
+    0x09, 0x02,       /* Usage (Mouse) */
+    0xA1, 0x01,       /* Collection (Application) */
+    0x85, 0x02,       /*   Report ID (2) */
+    0x09, 0x01,       /*   Usage (Pointer) */
+    0xA1, 0x00,       /*   Collection (Physical) */
+    0x05, 0x09,       /*     Usage Page (Button) */
+    0x19, 0x01,       /*     Usage Minimum (1) */
+    0x29, 0x08,       /*     Usage Maximum (8) */
+    0x15, 0x00,       /*     Logical Minimum (0) */
+    0x25, 0x01,       /*     Logical Maximum (1) */
+    0x75, 0x01,       /*     Report Size (1) */
+    0x95, 0x08,       /*     Report Count (8) */
+    0x81, 0x02,       /*     Input (Data, Variable, Absolute) */
+    0x75, 0x08,       /*     Report Size (8) */
+    0x95, 0x01,       /*     Report Count (1) */
+    0x81, 0x01,       /*     Input (Constant) */
+    0x05, 0x01,       /*     Usage Page (Generic Desktop) */
+    0x16, 0x01, 0xF8, /*     Logical Minimum (-2047) */
+    0x26, 0xFF, 0x07, /*     Logical Maximum (2047) */
+    0x75, 0x0C,       /*     Report Size (12) */
+    0x95, 0x02,       /*     Report Count (2) */
+    0x09, 0x30,       /*     Usage (X) */
+    0x09, 0x31,       /*     Usage (Y) */
+    0x81, 0x06,       /*     Input (Data, Variable, Relative) */
+    0x15, 0x81,       /*     Logical Minimum (-127) */
+    0x25, 0x7F,       /*     Logical Maximum (127) */
+    0x75, 0x08,       /*     Report Size (8) */
+    0x95, 0x01,       /*     Report Count (1) */
+    0x09, 0x38,       /*     Usage (Wheel) */
+    0x81, 0x06,       /*     Input (Data, Variable, Relative) */
+    0x05, 0x0C,       /*     Usage Page (Consumer) */
+    0x0A, 0x38, 0x02, /*     Usage (AC Pan) */
+    0x81, 0x06,       /*     Input (Data, Variable, Relative) */
+    0xC0,             /*   End Collection */
+    0xC0,             /* End Collection */
+};
+
+static struct hid_map report_map;
+
+/* Per-run state; every run is a fresh child process. */
+static int64_t now_us;
+static struct config cfg;
+static uint32_t rng;
+
+/* --phase-lock: the link's interval, and the update the firmware asked for. */
+static struct
+{
+    uint16_t base_itvl;
+    uint16_t itvl;
+    int nudge;
+    bool update_pending;
+    int req_nudge;
+    int update_events;
+} ble_link;
+
+static struct ble_npl_callout *callouts[MAX_CALLOUTS];
+static int ncallouts;
+
+static struct
+{
+    struct mouse_packet q[MOUSE_QUEUE_LEN];
+    size_t head;
+    size_t count;
+} mouse;
+
+static struct
+{
+    struct packet q[RX_QUEUE_LEN];
+    size_t head;
+    size_t count;
+    size_t next_recorded;
+} rx;
+
+static struct
+{
+    bool busy;
+    uint8_t id;
+    uint16_t len;
+    uint8_t data[sizeof(report_nkro_t)];
+    uint8_t last_buttons;
+
+    /* Samples first shown by the report in flight. */
+    struct vec motion;
+    bool has_button;
+    size_t button_sample;
+} usb;
+
+/* Samples the dongle received and hasn't put in a report yet. */
+static struct vec rx_motion;
+static struct vec rx_buttons;
+static uint8_t rx_last_buttons;
+
+static struct
+{
+    uint32_t notifications;
+    uint32_t ble_retries;
+    uint32_t ble_drops;
+    uint32_t mouse_drops;
+    uint32_t usb_reports;
+    uint32_t samples_sent;
+    struct vec motion_lat;
+    struct vec button_lat;
+
+    int64_t sensor_x;
+    int64_t sensor_y;
+    int64_t host_x;
+    int64_t host_y;
+    size_t sensor_next;
+    double err_sq_sum;
+    double err_max;
+    uint32_t err_samples;
+} res;
+
+#if CONFIG_DONGLE_TRACE
+enum sim_track
+{
+    TRACK_HOST_TASK,
+    TRACK_USB_TASK,
+    TRACK_LINK,
+    TRACK_USB_HOST,
+    TRACK_COUNT,
+};
+
+static const char *const track_names[TRACK_COUNT] = {
+    [TRACK_HOST_TASK] = "nimble_host",
+    [TRACK_USB_TASK] = "TinyUSB",
+    [TRACK_LINK] = "BLE link",
+    [TRACK_USB_HOST] = "USB host",
+};
+
+static const char *const point_labels[TRACE_POINT_COUNT] = {
+#define TRACE_LABEL(name, label) label,
+    TRACE_POINTS(TRACE_LABEL)
+#undef TRACE_LABEL
+};
+
+static FILE *trace_fp;
+static const char *trace_sep = "";
+static enum sim_track track;
+
+static void trace_json(const char *name, const char *ph, enum sim_track tid, unsigned arg)
+{
+    fprintf(trace_fp,
+            "%s{\"name\":\"%s\",\"ph\":\"%s\",\"ts\":%" PRId64 ",\"pid\":1,\"tid\":%d,"
+            "\"args\":{\"arg\":%u}%s}",
+            trace_sep, name, ph, now_us, tid, arg, ph[0] == 'i' ? ",\"s\":\"t\"" : "");
+    trace_sep = ",\n";
+}
+
+/* The firmware's trace points, written straight to Chrome trace JSON. */
+void trace_record(enum trace_point point, uint8_t phase, uint8_t arg)
+{
+    static const char *const phases[] = {"B", "E", "i"};
+
+    if (trace_fp != NULL)
+    {
+        trace_json(point_labels[point], phases[phase & TRACE_PHASE_MASK], track, arg);
+    }
+}
+
+static void trace_open(const char *path)
+{
+    int i;
+
+    trace_fp = fopen(path, "w");
+    if (trace_fp == NULL)
+    {
+        perror(path);
+        exit(1);
+    }
+
+    fprintf(trace_fp, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    for (i = 0; i < TRACK_COUNT; i++)
+    {
+        fprintf(trace_fp,
+                "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,"
+                "\"args\":{\"name\":\"%s\"}}",
+                trace_sep, i, track_names[i]);
+        trace_sep = ",\n";
+    }
+}
+
+static void trace_close(void)
+{
+    if (trace_fp != NULL)
+    {
+        fprintf(trace_fp, "\n]}\n");
+        fclose(trace_fp);
+    }
+}
+
+#define SIM_TRACK(t) (track = (t))
+#define SIM_INSTANT(name, t, arg) (trace_fp != NULL ? trace_json((name), "i", (t), (arg)) : (void)0)
+#else
+#define SIM_TRACK(t) ((void)0)
+#define SIM_INSTANT(name, t, arg) ((void)0)
+#endif
+
+int64_t esp_timer_get_time(void)
+{
+    return now_us;
+}
+
+/*
+ * Simulated NimBLE host: callouts, and a link that applies the firmware's
+ * interval nudges.  It stands in for conn_ctrl.c, so only the phase loop
+ * itself is firmware code.
+ */
+
+struct ble_npl_eventq *nimble_port_get_dflt_eventq(void)
+{
+    static struct ble_npl_eventq q;
+
+    return &q;
+}
+
+void ble_npl_eventq_put(struct ble_npl_eventq *evq, struct ble_npl_event *ev)
+{
+    (void)evq;
+    ev->fn(ev);
+}
+
+void ble_npl_callout_init(struct ble_npl_callout *co, struct ble_npl_eventq *evq,
+                          ble_npl_event_fn *fn, void *arg)
+{
+    (void)evq;
+
+    if (ncallouts == MAX_CALLOUTS)
+    {
+        fprintf(stderr, "too many callouts\n");
+        exit(1);
+    }
+
+    *co = (struct ble_npl_callout){.ev = {.fn = fn, .arg = arg}};
+    callouts[ncallouts++] = co;
+}
+
+int ble_npl_callout_reset(struct ble_npl_callout *co, ble_npl_time_t ticks)
+{
+    co->due_us = now_us + (int64_t)ticks * 1000;
+    co->armed = true;
+    return 0;
+}
+
+void ble_npl_callout_stop(struct ble_npl_callout *co)
+{
+    co->armed = false;
+}
+
+static struct ble_npl_callout *next_callout(void)
+{
+    struct ble_npl_callout *next = NULL;
+    int i;
+
+    for (i = 0; i < ncallouts; i++)
+    {
+        if (callouts[i]->armed && (next == NULL || callouts[i]->due_us < next->due_us))
+        {
+            next = callouts[i];
+        }
+    }
+
+    return next;
+}
+
+int ble_gap_conn_find(uint16_t handle, struct ble_gap_conn_desc *out_desc)
+{
+    *out_desc = (struct ble_gap_conn_desc){
+        .conn_handle = handle,
+        .conn_itvl = ble_link.itvl,
+    };
+    return 0;
+}
+
+int conn_ctrl_nudge(uint16_t base_itvl, int dir)
+{
+    if (ble_link.update_pending)
+    {
+        return BLE_HS_EBUSY;
+    }
+
+    if (base_itvl + dir < BLE_HCI_CONN_ITVL_MIN)
+    {
+        fprintf(stderr, "nudge to an interval of %d units\n", base_itvl + dir);
+        exit(1);
+    }
+
+    ble_link.base_itvl = base_itvl;
+    ble_link.update_pending = true;
+    ble_link.req_nudge = dir;
+    ble_link.update_events = 0;
+    return 0;
+}
+
+bool conn_ctrl_is_fast(void)
+{
+    return !ble_link.update_pending;
+}
+
+/* Called at every connection event; the update lands on its SIM_UPDATE_LAG'th. */
+static void link_update(void)
+{
+    struct ble_gap_conn_desc desc;
+
+    if (!ble_link.update_pending || ++ble_link.update_events < SIM_UPDATE_LAG)
+    {
+        return;
+    }
+
+    ble_link.update_pending = false;
+    ble_link.nudge = ble_link.req_nudge;
+    ble_link.itvl = ble_link.base_itvl + ble_link.nudge;
+
+    ble_gap_conn_find(SIM_CONN_HANDLE, &desc);
+    phase_lock_on_params(SIM_CONN_HANDLE, &desc, ble_link.nudge);
+}
+
+static void vec_push(struct vec *v, int64_t x)
+{
+    if (v->n == v->cap)
+    {
+        v->cap = v->cap ? v->cap * 2 : 64;
+        v->v = realloc(v->v, v->cap * sizeof *v->v);
+        if (v->v == NULL)
+        {
+            perror("realloc");
+            exit(1);
+        }
+    }
+    v->v[v->n++] = x;
+}
+
+static void push_sample(const struct sample *s)
+{
+    static size_t cap;
+
+    if (nsamples == cap)
+    {
+        cap = cap ? cap * 2 : 1024;
+        samples = realloc(samples, cap * sizeof *samples);
+        if (samples == NULL)
+        {
+            perror("realloc");
+            exit(1);
+        }
+    }
+    samples[nsamples++] = *s;
+}
+
+/* xorshift32: the same losses for the same seed on every machine. */
+static double random_unit(void)
+{
+    rng ^= rng << 13;
+    rng ^= rng >> 17;
+    rng ^= rng << 5;
+    return (double)rng / 4294967296.0;
+}
+
+/* Simulated TinyUSB device: one IN transfer in flight on the HID endpoint. */
+
+bool tud_hid_ready(void)
+{
+    return !usb.busy;
+}
+
+uint8_t tud_hid_get_protocol(void)
+{
+    return HID_PROTOCOL_REPORT;
+}
+
+void tud_sof_cb_enable(bool enable)
+{
+    (void)enable;
+}
+
+bool tud_remote_wakeup(void)
+{
+    return false;
+}
+
+void passthrough_on_complete(void)
+{
+}
+
+bool tud_hid_report(uint8_t report_id, void const *report, uint16_t len)
+{
+    if (usb.busy || len > sizeof usb.data)
+    {
+        return false;
+    }
+
+    usb.busy = true;
+    usb.id = report_id;
+    usb.len = len;
+    memcpy(usb.data, report, len);
+    res.usb_reports++;
+
+    if (report_id == HID_ITF_PROTOCOL_MOUSE)
+    {
+        hid_mouse_report_t r;
+        size_t i;
+
+        memcpy(&r, report, sizeof r);
+        if (r.x != 0 || r.y != 0 || r.wheel != 0 || r.pan != 0)
+        {
+            for (i = 0; i < rx_motion.n; i++)
+            {
+                vec_push(&usb.motion, rx_motion.v[i]);
+            }
+            rx_motion.n = 0;
+        }
+
+        if (r.buttons != usb.last_buttons && rx_buttons.n > 0)
+        {
+            usb.has_button = true;
+            usb.button_sample = rx_buttons.v[0];
+            memmove(rx_buttons.v, rx_buttons.v + 1, --rx_buttons.n * sizeof *rx_buttons.v);
+        }
+        usb.last_buttons = r.buttons;
+    }
+
+    return true;
+}
+
+/* The host's IN token: the report in flight reaches it. */
+static void usb_poll(void)
+{
+    size_t i;
+
+    SIM_INSTANT("poll", TRACK_USB_HOST, usb.busy);
+    if (!usb.busy)
+    {
+        return;
+    }
+
+    for (i = 0; i < usb.motion.n; i++)
+    {
+        vec_push(&res.motion_lat, now_us - samples[usb.motion.v[i]].t_us);
+    }
+    usb.motion.n = 0;
+
+    if (usb.has_button)
+    {
+        vec_push(&res.button_lat, now_us - samples[usb.button_sample].t_us);
+        usb.has_button = false;
+    }
+
+    if (usb.id == HID_ITF_PROTOCOL_MOUSE)
+    {
+        hid_mouse_report_t r;
+
+        memcpy(&r, usb.data, sizeof r);
+        res.host_x += r.x;
+        res.host_y += r.y;
+    }
+
+    usb.busy = false;
+    SIM_TRACK(TRACK_USB_TASK);
+    tud_hid_report_complete_cb(0, usb.data, usb.len);
+}
+
+static void usb_sof(uint32_t frame)
+{
+    double err;
+
+    /* Where the sensor has moved by now, against where the host cursor is. */
+    while (res.sensor_next < nsamples && samples[res.sensor_next].t_us <= now_us)
+    {
+        res.sensor_x += samples[res.sensor_next].dx;
+        res.sensor_y += samples[res.sensor_next].dy;
+        res.sensor_next++;
+    }
+    err = hypot((double)(res.sensor_x - res.host_x), (double)(res.sensor_y - res.host_y));
+    res.err_sq_sum += err * err;
+    res.err_samples++;
+    if (err > res.err_max)
+    {
+        res.err_max = err;
+    }
+
+    SIM_TRACK(TRACK_USB_TASK);
+    tud_sof_cb(frame);
+}
+
+static int16_t clamp16(int32_t v)
+{
+    return v > INT16_MAX ? INT16_MAX : v < -INT16_MAX ? -INT16_MAX : v;
+}
+
+/* Loads the remap tables of mode through the host's feature report. */
+static void remap_set_mode(enum remap_mode mode)
+{
+    static const uint8_t swap[][REMAP_FEATURE_LEN] = {
+        {REMAP_OP_BUTTON, 0, 0, 1, 0},
+        {REMAP_OP_BUTTON, 0, 1, 0, 0},
+        {REMAP_OP_LAYER_BUTTON, 1, 4, 0, 0},
+    };
+    static const uint8_t reset[REMAP_FEATURE_LEN] = {REMAP_OP_RESET};
+    size_t i;
+
+    remap_set_feature(reset, sizeof reset);
+    for (i = 0; mode == REMAP_MODE_SWAP && i < sizeof swap / sizeof swap[0]; i++)
+    {
+        remap_set_feature(swap[i], sizeof swap[i]);
+    }
+}
+
+/* The dongle's decode stage: the profile decoder or the Report Map, then remapping. */
+static bool dongle_decode(const struct packet *p, bool use_map, enum remap_mode mode,
+                          struct hid_input *in)
+{
+    int report_id;
+    bool decoded;
+
+    if (use_map)
+    {
+        report_id = MOUSE_REPORT_ID;
+        TRACE_BEGIN(DECODE, report_id);
+        decoded = hid_map_decode(&report_map, p->handle, p->data, p->len, in);
+    }
+    else
+    {
+        report_id = profile_report_id(profile, p->handle);
+        TRACE_BEGIN(DECODE, report_id);
+        decoded = report_id >= 0 && profile->decode(report_id, p->data, p->len, in);
+    }
+    TRACE_END(DECODE, decoded);
+
+    if (decoded && mode != REMAP_MODE_NONE)
+    {
+        remap_apply(in);
+    }
+    return decoded;
+}
+
+/* The dongle's BLE_GAP_EVENT_NOTIFY_RX path. */
+static void dongle_rx(const struct packet *p)
+{
+    struct hid_input in;
+    bool decoded;
+    size_t i;
+
+    SIM_TRACK(TRACK_HOST_TASK);
+    TRACE_BEGIN(GAP_EVENT, BLE_GAP_EVENT_NOTIFY_RX);
+    res.notifications++;
+
+    if (opt.phase_lock)
+    {
+        phase_lock_on_notify(SIM_CONN_HANDLE, now_us);
+    }
+
+    decoded = dongle_decode(p, opt.report_map, opt.remap, &in);
+    if (decoded && in.has_mouse)
+    {
+        int32_t x = in.x;
+        int32_t y = in.y;
+
+        if (p->first != NO_SAMPLE)
+        {
+            res.samples_sent += p->last - p->first + 1;
+            for (i = p->first; i <= p->last; i++)
+            {
+                if (samples[i].dx != 0 || samples[i].dy != 0 || samples[i].wheel != 0 ||
+                    samples[i].pan != 0)
+                {
+                    vec_push(&rx_motion, i);
+                }
+            }
+            if (in.buttons != rx_last_buttons)
+            {
+                vec_push(&rx_buttons, p->first);
+            }
+        }
+        rx_last_buttons = in.buttons;
+
+        pointer_transform(&x, &y);
+        report_mouse_input(in.buttons, clamp16(x), clamp16(y), in.wheel, in.pan);
+    }
+    else if (decoded && in.has_keyboard)
+    {
+        report_keyboard_bitmap(in.modifier, in.keys, sizeof in.keys);
+    }
+
+    TRACE_END(GAP_EVENT, BLE_GAP_EVENT_NOTIFY_RX);
+}
+
+/* Mouse side: a sensor sample joins the notification not sent yet, if it can. */
+static void mouse_sample(size_t i)
+{
+    const struct sample *s = &samples[i];
+    struct mouse_packet *tail = NULL;
+
+    if (mouse.count > 0)
+    {
+        tail = &mouse.q[(mouse.head + mouse.count - 1) % MOUSE_QUEUE_LEN];
+    }
+
+    /* 12-bit axes in the report; a button change needs a report of its own. */
+    if (tail != NULL && tail->attempts == 0 && tail->buttons == s->buttons &&
+        abs(tail->dx + s->dx) < 2048 && abs(tail->dy + s->dy) < 2048)
+    {
+        tail->dx += s->dx;
+        tail->dy += s->dy;
+        tail->wheel += s->wheel;
+        tail->pan += s->pan;
+        tail->last = i;
+        return;
+    }
+
+    if (mouse.count == MOUSE_QUEUE_LEN)
+    {
+        res.mouse_drops++;
+        return;
+    }
+
+    tail = &mouse.q[(mouse.head + mouse.count) % MOUSE_QUEUE_LEN];
+    *tail = (struct mouse_packet){
+        .buttons = s->buttons,
+        .dx = s->dx,
+        .dy = s->dy,
+        .wheel = s->wheel,
+        .pan = s->pan,
+        .first = i,
+        .last = i,
+    };
+    mouse.count++;
+}
+
+static int8_t clamp8(int32_t v)
+{
+    return v > 127 ? 127 : v < -127 ? -127 : v;
+}
+
+/* The MX Master 3 mouse report: buttons, pad, 12-bit x and y, wheel, pan. */
+static void encode_mouse(const struct mouse_packet *m, struct packet *p)
+{
+    uint16_t x = (uint16_t)m->dx & 0xFFF;
+    uint16_t y = (uint16_t)m->dy & 0xFFF;
+
+    p->handle = MOUSE_HANDLE;
+    p->len = MOUSE_REPORT_LEN;
+    p->data[0] = m->buttons;
+    p->data[1] = 0;
+    p->data[2] = x & 0xFF;
+    p->data[3] = (x >> 8) | (y & 0x0F) << 4;
+    p->data[4] = y >> 4;
+    p->data[5] = (uint8_t)clamp8(m->wheel);
+    p->data[6] = (uint8_t)clamp8(m->pan);
+    p->first = m->first;
+    p->last = m->last;
+}
+
+static void connection_event(void)
+{
+    int j;
+
+    SIM_INSTANT("connection event", TRACK_LINK, mouse.count);
+
+    for (j = 0; j < cfg.packets && mouse.count > 0; j++)
+    {
+        struct mouse_packet *m = &mouse.q[mouse.head];
+        struct packet *p;
+
+        m->attempts++;
+        if (random_unit() < cfg.loss)
+        {
+            res.ble_retries++;
+            if (opt.max_retries > 0 && m->attempts > opt.max_retries)
+            {
+                res.ble_drops++;
+                mouse.head = (mouse.head + 1) % MOUSE_QUEUE_LEN;
+                mouse.count--;
+            }
+            /* No acknowledgement: the event closes, the rest waits. */
+            return;
+        }
+
+        if (rx.count == RX_QUEUE_LEN)
+        {
+            fprintf(stderr, "rx queue overflow\n");
+            exit(1);
+        }
+        p = &rx.q[(rx.head + rx.count) % RX_QUEUE_LEN];
+        encode_mouse(m, p);
+        p->at_us = now_us + (j + 1) * BLE_PACKET_US;
+        rx.count++;
+
+        mouse.head = (mouse.head + 1) % MOUSE_QUEUE_LEN;
+        mouse.count--;
+    }
+}
+
+static int64_t next_rx_us(void)
+{
+    if (opt.as_recorded)
+    {
+        return rx.next_recorded < nrecorded ? recorded[rx.next_recorded].at_us : INT64_MAX;
+    }
+    return rx.count > 0 ? rx.q[rx.head].at_us : INT64_MAX;
+}
+
+static const struct packet *pop_rx(void)
+{
+    const struct packet *p;
+
+    if (opt.as_recorded)
+    {
+        return &recorded[rx.next_recorded++];
+    }
+
+    p = &rx.q[rx.head];
+    rx.head = (rx.head + 1) % RX_QUEUE_LEN;
+    rx.count--;
+    return p;
+}
+
+static int64_t percentile(const struct vec *v, int pct)
+{
+    return v->n ? v->v[(v->n - 1) * pct / 100] : 0;
+}
+
+static int compare_i64(const void *a, const void *b)
+{
+    int64_t x = *(const int64_t *)a;
+    int64_t y = *(const int64_t *)b;
+
+    return (x > y) - (x < y);
+}
+
+static void print_header(void)
+{
+    if (opt.csv)
+    {
+        printf("itvl_ms,binterval,loss,packets,notifications,samples_per_notification,"
+               "usb_reports,merged,drops,motion_p50_ms,motion_p90_ms,motion_p99_ms,"
+               "motion_max_ms,button_p50_ms,button_p99_ms,button_max_ms,"
+               "err_rms,err_max,err_final%s\n",
+               opt.phase_lock ? ",nudges,phase_err_us,jitter_initial_us,jitter_us" : "");
+        return;
+    }
+
+    printf("%6s %4s %5s %4s | %6s %5s %6s %6s %5s | %6s %6s %6s %6s | %6s %6s %6s | %6s %5s %5s",
+           "itvl", "bint", "loss", "pkts", "notif", "smp/n", "usb", "merged", "drops",
+           "mo p50", "p90", "p99", "max", "bt p50", "p99", "max", "errRMS", "max", "final");
+    if (opt.phase_lock)
+    {
+        printf(" | %6s %5s %6s %6s", "nudges", "err", "jit0", "jit");
+    }
+    printf("\n");
+}
+
+static void print_result(void)
+{
+    struct phase_lock_stats ps;
+    struct report_stats rs;
+    uint32_t drops;
+    double final_err;
+    double spn;
+
+    report_stats_get(&rs);
+    phase_lock_stats_get(&ps);
+    qsort(res.motion_lat.v, res.motion_lat.n, sizeof(int64_t), compare_i64);
+    qsort(res.button_lat.v, res.button_lat.n, sizeof(int64_t), compare_i64);
+
+    drops = res.ble_drops + res.mouse_drops + rs.edge_drops;
+    final_err = hypot((double)(res.sensor_x - res.host_x), (double)(res.sensor_y - res.host_y));
+    spn = res.notifications ? (double)res.samples_sent / res.notifications : 0;
+
+    if (opt.csv)
+    {
+        printf("%g,%d,%g,%d,%" PRIu32 ",%.2f,%" PRIu32 ",%" PRIu32 ",%" PRIu32
+               ",%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%.2f,%.2f,%.2f",
+               cfg.itvl_ms, cfg.binterval, cfg.loss, cfg.packets, res.notifications, spn,
+               res.usb_reports, rs.merged, drops,
+               percentile(&res.motion_lat, 50) / 1000.0, percentile(&res.motion_lat, 90) / 1000.0,
+               percentile(&res.motion_lat, 99) / 1000.0, percentile(&res.motion_lat, 100) / 1000.0,
+               percentile(&res.button_lat, 50) / 1000.0, percentile(&res.button_lat, 99) / 1000.0,
+               percentile(&res.button_lat, 100) / 1000.0,
+               res.err_samples ? sqrt(res.err_sq_sum / res.err_samples) : 0, res.err_max,
+               final_err);
+        if (opt.phase_lock)
+        {
+            printf(",%" PRIu32 ",%" PRId32 ",%" PRIu32 ",%" PRIu32, ps.nudges, ps.err_avg_us,
+                   ps.jitter_initial_us, ps.jitter_us);
+        }
+        printf("\n");
+        return;
+    }
+
+    printf("%6g %4d %5g %4d | %6" PRIu32 " %5.2f %6" PRIu32 " %6" PRIu32 " %5" PRIu32
+           " | %6.2f %6.2f %6.2f %6.2f | %6.2f %6.2f %6.2f | %6.2f %5.1f %5.1f",
+           cfg.itvl_ms, cfg.binterval, cfg.loss, cfg.packets, res.notifications, spn,
+           res.usb_reports, rs.merged, drops,
+           percentile(&res.motion_lat, 50) / 1000.0, percentile(&res.motion_lat, 90) / 1000.0,
+           percentile(&res.motion_lat, 99) / 1000.0, percentile(&res.motion_lat, 100) / 1000.0,
+           percentile(&res.button_lat, 50) / 1000.0, percentile(&res.button_lat, 99) / 1000.0,
+           percentile(&res.button_lat, 100) / 1000.0,
+           res.err_samples ? sqrt(res.err_sq_sum / res.err_samples) : 0, res.err_max, final_err);
+    if (opt.phase_lock)
+    {
+        printf(" | %6" PRIu32 " %5" PRId32 " %6" PRIu32 " %6" PRIu32, ps.nudges, ps.err_avg_us,
+               ps.jitter_initial_us, ps.jitter_us);
+    }
+    printf("\n");
+}
+
+static void run(void)
+{
+    int64_t itvl_us = (int64_t)llround(cfg.itvl_ms * 1000);
+    int64_t end_us = opt.start_us + DRAIN_US;
+    int64_t next_conn = opt.anchor_us;
+    int64_t next_sof = 0;
+    int64_t next_poll = opt.poll_offset_us;
+    uint32_t frame = 0;
+    size_t next_sample = 0;
+
+    rng = opt.seed ? opt.seed : 1;
+    report_init();
+    pointer_reset();
+    remap_set_mode(opt.remap);
+
+    if (opt.phase_lock)
+    {
+        ble_link.base_itvl = ble_link.itvl = (uint16_t)(itvl_us / ITVL_UNIT_US);
+        phase_lock_start(SIM_CONN_HANDLE);
+    }
+
+    if (nsamples > 0)
+    {
+        end_us += samples[nsamples - 1].t_us;
+    }
+    if (opt.as_recorded && nrecorded > 0)
+    {
+        end_us += recorded[nrecorded - 1].at_us;
+    }
+
+    for (;;)
+    {
+        int64_t t_sample = !opt.as_recorded && next_sample < nsamples
+                               ? samples[next_sample].t_us
+                               : INT64_MAX;
+        int64_t t_conn = opt.as_recorded ? INT64_MAX : next_conn;
+        int64_t t_rx = next_rx_us();
+        struct ble_npl_callout *co = next_callout();
+        int64_t t_callout = co != NULL ? co->due_us : INT64_MAX;
+        int64_t t = t_sample;
+
+        t = t_conn < t ? t_conn : t;
+        t = t_callout < t ? t_callout : t;
+        t = t_rx < t ? t_rx : t;
+        t = next_sof < t ? next_sof : t;
+        t = next_poll < t ? next_poll : t;
+        if (t > end_us)
+        {
+            break;
+        }
+        now_us = t;
+
+        /* Same instant: the sample is taken before the event that sends it,
+         * and the frame starts before the host polls in it. */
+        if (t == t_sample)
+        {
+            mouse_sample(next_sample++);
+        }
+        else if (t == t_conn)
+        {
+            connection_event();
+            if (opt.phase_lock)
+            {
+                link_update();
+                itvl_us = (int64_t)ble_link.itvl * ITVL_UNIT_US;
+            }
+            next_conn += itvl_us;
+        }
+        else if (t == t_callout)
+        {
+            SIM_TRACK(TRACK_HOST_TASK);
+            co->armed = false;
+            co->ev.fn(&co->ev);
+        }
+        else if (t == t_rx)
+        {
+            dongle_rx(pop_rx());
+        }
+        else if (t == next_sof)
+        {
+            usb_sof(frame++);
+            next_sof += FRAME_US;
+        }
+        else
+        {
+            usb_poll();
+            next_poll += (int64_t)cfg.binterval * FRAME_US;
+        }
+    }
+
+    print_result();
+}
+
+/* --check: invariants every configuration must hold. */
+static bool check_result(void)
+{
+    struct report_stats rs;
+    bool ok = true;
+
+    if (opt.phase_lock)
+    {
+        struct phase_lock_stats ps;
+        uint32_t reach;
+
+        /* Once locked, the error stays within the deadband, or within half
+         * an interval step where the step is coarser than that. */
+        phase_lock_stats_get(&ps);
+        reach = CONFIG_DONGLE_PHASE_LOCK_DEADBAND_US;
+        if (ps.period_us > 0 && ITVL_UNIT_US % ps.period_us / 2 > reach)
+        {
+            reach = ITVL_UNIT_US % ps.period_us / 2;
+        }
+        if (ps.samples < 2 * PHASE_LOCK_WINDOW || ps.jitter_us > reach)
+        {
+            fprintf(stderr, "check failed: itvl %g: phase error %" PRIu32 "us RMS after %" PRIu32
+                            " events, %" PRIu32 " nudges; want at most %" PRIu32 "us\n",
+                    cfg.itvl_ms, ps.jitter_us, ps.samples, ps.nudges, reach);
+            ok = false;
+        }
+    }
+
+    /* Button and key edges are never lost on the dongle, however many come. */
+    report_stats_get(&rs);
+    if (rs.edge_drops > 0)
+    {
+        fprintf(stderr, "check failed: itvl %g binterval %d packets %d: %" PRIu32
+                        " button edges dropped\n",
+                cfg.itvl_ms, cfg.binterval, cfg.packets, rs.edge_drops);
+        ok = false;
+    }
+
+    /* Every button change the dongle received reached the host. */
+    if (rx_buttons.n > 0)
+    {
+        fprintf(stderr, "check failed: itvl %g binterval %d packets %d: %zu button changes"
+                        " never reached the host\n",
+                cfg.itvl_ms, cfg.binterval, cfg.packets, rx_buttons.n);
+        ok = false;
+    }
+
+    /* print_result() sorted the latencies. */
+    if (opt.max_p99_us > 0 && percentile(&res.motion_lat, 99) > opt.max_p99_us)
+    {
+        fprintf(stderr, "check failed: itvl %g binterval %d: motion p99 %.2f ms; want at most %.2f ms\n",
+                cfg.itvl_ms, cfg.binterval, percentile(&res.motion_lat, 99) / 1000.0,
+                opt.max_p99_us / 1000.0);
+        ok = false;
+    }
+
+    return ok;
+}
+
+/* Synthetic sensor samples. */
+static void synthesize(const char *motion, double speed, int sensor_hz, int duration_ms,
+                       int burst_ms, int click_ms)
+{
+    const double radius = 200;
+    int64_t period_us = 1000000 / sensor_hz;
+    int64_t prev_x = 0;
+    int64_t prev_y = 0;
+    uint8_t prev_buttons = 0;
+    int64_t t;
+
+    for (t = 0; t <= (int64_t)duration_ms * 1000; t += period_us)
+    {
+        double ms = t / 1000.0;
+        double travelled;
+        double x;
+        double y;
+        struct sample s = {.t_us = opt.start_us + t};
+
+        /* Motion in bursts: travel only advances while a burst is on. */
+        if (burst_ms > 0)
+        {
+            int64_t cycle = (int64_t)ms / (2 * burst_ms);
+            double in_cycle = ms - cycle * 2.0 * burst_ms;
+
+            travelled = speed * (cycle * burst_ms + (in_cycle < burst_ms ? in_cycle : burst_ms));
+        }
+        else
+        {
+            travelled = speed * ms;
+        }
+
+        if (strcmp(motion, "circle") == 0)
+        {
+            x = radius * (cos(travelled / radius) - 1);
+            y = radius * sin(travelled / radius);
+        }
+        else if (strcmp(motion, "jitter") == 0)
+        {
+            /* Back and forth every sample: motion that cancels out. */
+            x = (t / period_us) % 2 ? speed : 0;
+            y = 0;
+        }
+        else if (strcmp(motion, "zigzag") == 0)
+        {
+            double phase = fmod(travelled, 4 * radius);
+
+            x = travelled / 2;
+            y = phase < 2 * radius ? phase : 4 * radius - phase;
+        }
+        else
+        {
+            x = travelled;
+            y = 0;
+        }
+
+        /* Whole counts, with the rounding carried so nothing is lost. */
+        s.dx = (int16_t)(llround(x) - prev_x);
+        s.dy = (int16_t)(llround(y) - prev_y);
+        prev_x += s.dx;
+        prev_y += s.dy;
+
+        /* Clicks hold the button 30 ms, or half the period if that's shorter. */
+        if (click_ms > 0 && (int64_t)ms % click_ms < (click_ms < 60 ? click_ms / 2 : 30) &&
+            ms >= click_ms)
+        {
+            s.buttons = 0x01;
+        }
+
+        /* A sensor with nothing to say sends nothing. */
+        if (s.dx != 0 || s.dy != 0 || s.buttons != prev_buttons)
+        {
+            push_sample(&s);
+        }
+        prev_buttons = s.buttons;
+    }
+}
+
+static void load_capture(const char *path)
+{
+    struct capture_file_header header;
+    struct capture_record rec;
+    int64_t first_us = -1;
+    FILE *f;
+
+    f = fopen(path, "rb");
+    if (f == NULL)
+    {
+        perror(path);
+        exit(1);
+    }
+
+    if (fread(&header, sizeof header, 1, f) != 1 ||
+        memcmp(header.magic, CAPTURE_MAGIC, sizeof CAPTURE_MAGIC) != 0 ||
+        header.version != CAPTURE_VERSION || header.record_header_len < sizeof rec)
+    {
+        fprintf(stderr, "%s: not a version %d capture\n", path, CAPTURE_VERSION);
+        exit(1);
+    }
+
+    while (fread(&rec, sizeof rec, 1, f) == 1)
+    {
+        struct packet p = {.handle = rec.attr_handle, .len = rec.len, .first = NO_SAMPLE};
+        struct hid_input in;
+        int report_id;
+
+        fseek(f, header.record_header_len - sizeof rec, SEEK_CUR);
+        if (rec.len > sizeof p.data || fread(p.data, 1, rec.len, f) != rec.len)
+        {
+            fprintf(stderr, "%s: truncated record\n", path);
+            break;
+        }
+
+        if (first_us < 0)
+        {
+            first_us = rec.timestamp_us;
+        }
+        p.at_us = opt.start_us + (int64_t)(rec.timestamp_us - first_us);
+
+        report_id = profile_report_id(profile, rec.attr_handle);
+        if (report_id >= 0 && profile->decode(report_id, p.data, p.len, &in) && in.has_mouse)
+        {
+            struct sample s = {
+                .t_us = p.at_us,
+                .buttons = in.buttons,
+                .dx = in.x,
+                .dy = in.y,
+                .wheel = in.wheel,
+                .pan = in.pan,
+            };
+
+            p.first = p.last = nsamples;
+            push_sample(&s);
+        }
+
+        if (opt.as_recorded)
+        {
+            recorded = realloc(recorded, (nrecorded + 1) * sizeof *recorded);
+            if (recorded == NULL)
+            {
+                perror("realloc");
+                exit(1);
+            }
+            recorded[nrecorded++] = p;
+        }
+    }
+
+    fclose(f);
+}
+
+/*
+ * --decode-cost: each sample as a mouse report of its own, decoded rounds
+ * times over for every decoder and remap mode, and once more followed by
+ * pointer_transform() as the GAP handler runs it.  The transform is what
+ * this build was compiled with: its pointer_lut.h and the
+ * CONFIG_DONGLE_POINTER_* values.  Host CPU time, so compare the rows with
+ * each other rather than with the dongle.
+ */
+static void decode_cost(int rounds)
+{
+    static const struct
+    {
+        enum remap_mode mode;
+        bool pointer;
+    } rows[] = {
+        {REMAP_MODE_NONE, false},
+        {REMAP_MODE_IDENTITY, false},
+        {REMAP_MODE_SWAP, false},
+        {REMAP_MODE_IDENTITY, true},
+    };
+    struct packet *reports = calloc(nsamples ? nsamples : 1, sizeof *reports);
+    volatile int32_t sink = 0;
+    struct hid_input in;
+    struct timespec t0;
+    struct timespec t1;
+    size_t i;
+    size_t row;
+    int use_map;
+    int r;
+
+    if (reports == NULL)
+    {
+        perror("calloc");
+        exit(1);
+    }
+
+    for (i = 0; i < nsamples; i++)
+    {
+        struct mouse_packet m = {
+            .buttons = samples[i].buttons,
+            .dx = samples[i].dx,
+            .dy = samples[i].dy,
+            .wheel = samples[i].wheel,
+            .pan = samples[i].pan,
+        };
+
+        encode_mouse(&m, &reports[i]);
+    }
+
+    printf("pointer: scale %d%%, rotation %d deg, smoothing %d, snapping %d\n",
+           CONFIG_DONGLE_POINTER_SCALE_PCT, CONFIG_DONGLE_POINTER_ROTATION_DEG,
+           CONFIG_DONGLE_POINTER_SMOOTHING, CONFIG_DONGLE_POINTER_ANGLE_SNAP);
+    printf("%-10s %-8s %-7s %9s\n", "decoder", "remap", "pointer", "ns/report");
+    for (use_map = 0; use_map < 2; use_map++)
+    {
+        for (row = 0; row < sizeof rows / sizeof rows[0]; row++)
+        {
+            remap_set_mode(rows[row].mode);
+            pointer_reset();
+
+            clock_gettime(CLOCK_MONOTONIC, &t0);
+            for (r = 0; r < rounds; r++)
+            {
+                for (i = 0; i < nsamples; i++)
+                {
+                    if (!dongle_decode(&reports[i], use_map, rows[row].mode, &in))
+                    {
+                        continue;
+                    }
+                    if (rows[row].pointer && in.has_mouse)
+                    {
+                        int32_t x = in.x;
+                        int32_t y = in.y;
+
+                        pointer_transform(&x, &y);
+                        sink += x + y;
+                    }
+                    sink += in.x + in.buttons;
+                }
+            }
+            clock_gettime(CLOCK_MONOTONIC, &t1);
+
+            printf("%-10s %-8s %-7s %9.2f\n", use_map ? "report-map" : "profile",
+                   remap_mode_names[rows[row].mode], rows[row].pointer ? "yes" : "-",
+                   nsamples && rounds > 0
+                       ? ((t1.tv_sec - t0.tv_sec) * 1e9 + (t1.tv_nsec - t0.tv_nsec)) /
+                             ((double)rounds * nsamples)
+                       : 0.0);
+        }
+    }
+
+    free(reports);
+}
+
+static int parse_list(const char *arg, double *out)
+{
+    char *copy = strdup(arg);
+    char *save = NULL;
+    char *tok;
+    int n = 0;
+
+    for (tok = strtok_r(copy, ",", &save); tok != NULL && n < MAX_LIST;
+         tok = strtok_r(NULL, ",", &save))
+    {
+        out[n++] = atof(tok);
+    }
+
+    free(copy);
+    return n;
+}
+
+static void usage(const char *argv0)
+{
+    fprintf(stderr,
+            "usage: %s [options]\n"
+            "  --itvl MS[,MS...]       BLE connection interval (7.5)\n"
+            "  --binterval N[,N...]    USB polling interval in frames (1)\n"
+            "  --loss P[,P...]         loss probability per transmission (0)\n"
+            "  --packets N[,N...]      notifications per connection event (4)\n"
+            "  --max-retries N         drop a notification after N retries (0: never)\n"
+            "  --poll-offset US        host poll time inside the frame (100)\n"
+            "  --anchor US             first connection event (250)\n"
+            "  --start MS              time input starts after boot (10)\n"
+            "  --seed N                loss pattern (1)\n"
+            "  --capture FILE          motion from a capture instead of synthetic\n"
+            "  --profile NAME          profile decoding the capture (MX Master 3)\n"
+            "  --as-recorded           replay the capture's notifications as timed\n"
+            "  --motion circle|line|zigzag|jitter  synthetic path (circle)\n"
+            "  --speed C               synthetic speed in counts per ms (2)\n"
+            "  --sensor-hz N           synthetic sensor rate (1000)\n"
+            "  --duration MS           synthetic length (2000)\n"
+            "  --burst MS              move for MS, rest for MS (0: move throughout)\n"
+            "  --click MS              click button 1 every MS (0: never), 2 at most\n"
+            "  --phase-lock            run phase_lock.c, which nudges the interval\n"
+            "  --report-map            decode with hid_map.c instead of the profile\n"
+            "  --remap none|identity|swap  remap tables (identity)\n"
+            "  --decode-cost N         time N passes of decoding, remap and transform, and exit\n"
+            "  --check                 fail unless every configuration holds the invariants\n"
+            "  --max-p99 MS            with --check, also fail above this motion p99\n"
+            "  --csv                   comma-separated output\n"
+            "  --trace FILE            Chrome trace JSON of the first configuration\n",
+            argv0);
+    exit(2);
+}
+
+int main(int argc, char **argv)
+{
+    static const struct option options[] = {
+        {"itvl", required_argument, NULL, 'i'},
+        {"binterval", required_argument, NULL, 'b'},
+        {"loss", required_argument, NULL, 'l'},
+        {"packets", required_argument, NULL, 'p'},
+        {"max-retries", required_argument, NULL, 'r'},
+        {"poll-offset", required_argument, NULL, 'o'},
+        {"anchor", required_argument, NULL, 'a'},
+        {"start", required_argument, NULL, 'S'},
+        {"seed", required_argument, NULL, 's'},
+        {"capture", required_argument, NULL, 'c'},
+        {"profile", required_argument, NULL, 'P'},
+        {"as-recorded", no_argument, NULL, 'R'},
+        {"motion", required_argument, NULL, 'm'},
+        {"speed", required_argument, NULL, 'v'},
+        {"sensor-hz", required_argument, NULL, 'h'},
+        {"duration", required_argument, NULL, 'd'},
+        {"burst", required_argument, NULL, 'u'},
+        {"click", required_argument, NULL, 'k'},
+        {"phase-lock", no_argument, NULL, 'L'},
+        {"report-map", no_argument, NULL, 'D'},
+        {"remap", required_argument, NULL, 'x'},
+        {"decode-cost", required_argument, NULL, 'T'},
+        {"check", no_argument, NULL, 'K'},
+        {"max-p99", required_argument, NULL, 'M'},
+        {"csv", no_argument, NULL, 'C'},
+        {"trace", required_argument, NULL, 't'},
+        {NULL, 0, NULL, 0},
+    };
+    double itvls[MAX_LIST] = {7.5};
+    double bintervals[MAX_LIST] = {1};
+    double losses[MAX_LIST] = {0};
+    double packets[MAX_LIST] = {4};
+    int nitvl = 1, nbint = 1, nloss = 1, npackets = 1;
+    const char *capture = NULL;
+    const char *profile_name = "MX Master 3";
+    const char *motion = "circle";
+    double speed = 2;
+    int sensor_hz = 1000;
+    int duration_ms = 2000;
+    int burst_ms = 0;
+    int click_ms = 0;
+    int cost_rounds = 0;
+    int failed = 0;
+    int a, b, l, p;
+    int c;
+
+    while ((c = getopt_long(argc, argv, "", options, NULL)) != -1)
+    {
+        switch (c)
+        {
+        case 'i': nitvl = parse_list(optarg, itvls); break;
+        case 'b': nbint = parse_list(optarg, bintervals); break;
+        case 'l': nloss = parse_list(optarg, losses); break;
+        case 'p': npackets = parse_list(optarg, packets); break;
+        case 'r': opt.max_retries = atoi(optarg); break;
+        case 'o': opt.poll_offset_us = atoi(optarg); break;
+        case 'a': opt.anchor_us = atoi(optarg); break;
+        case 'S': opt.start_us = llround(atof(optarg) * 1000); break;
+        case 's': opt.seed = strtoul(optarg, NULL, 0); break;
+        case 'c': capture = optarg; break;
+        case 'P': profile_name = optarg; break;
+        case 'R': opt.as_recorded = true; break;
+        case 'm': motion = optarg; break;
+        case 'v': speed = atof(optarg); break;
+        case 'h': sensor_hz = atoi(optarg); break;
+        case 'd': duration_ms = atoi(optarg); break;
+        case 'u': burst_ms = atoi(optarg); break;
+        case 'k': click_ms = atoi(optarg); break;
+        case 'L': opt.phase_lock = true; break;
+        case 'D': opt.report_map = true; break;
+        case 'x':
+            for (opt.remap = 0; opt.remap < REMAP_MODE_COUNT; opt.remap++)
+            {
+                if (strcmp(optarg, remap_mode_names[opt.remap]) == 0)
+                {
+                    break;
+                }
+            }
+            if (opt.remap == REMAP_MODE_COUNT)
+            {
+                usage(argv[0]);
+            }
+            break;
+        case 'T': cost_rounds = atoi(optarg); break;
+        case 'K': opt.check = true; break;
+        case 'M': opt.max_p99_us = llround(atof(optarg) * 1000); break;
+        case 'C': opt.csv = true; break;
+        case 't': opt.trace_path = optarg; break;
+        default: usage(argv[0]);
+        }
+    }
+
+    if (optind != argc || nitvl == 0 || nbint == 0 || nloss == 0 || npackets == 0 ||
+        sensor_hz <= 0 || (opt.as_recorded && capture == NULL) ||
+        (opt.as_recorded && opt.phase_lock))
+    {
+        usage(argv[0]);
+    }
+
+    /* The link can only run whole interval units. */
+    for (a = 0; opt.phase_lock && a < nitvl; a++)
+    {
+        if (llround(itvls[a] * 1000) % ITVL_UNIT_US != 0)
+        {
+            fprintf(stderr, "--phase-lock needs intervals in steps of 1.25 ms\n");
+            return 2;
+        }
+    }
+
+#if !CONFIG_DONGLE_TRACE
+    if (opt.trace_path != NULL)
+    {
+        fprintf(stderr, "--trace needs a build with -DCONFIG_DONGLE_TRACE=1\n");
+        return 2;
+    }
+#endif
+
+    profile = profile_match(profile_name);
+    if (profile == NULL)
+    {
+        fprintf(stderr, "no profile advertising as \"%s\" in this build\n", profile_name);
+        return 2;
+    }
+
+    if (hid_map_parse(&report_map, mouse_report_map, sizeof mouse_report_map) != 0 ||
+        hid_map_add_handle(&report_map, MOUSE_HANDLE, MOUSE_REPORT_ID) != 0)
+    {
+        fprintf(stderr, "the mouse Report Map doesn't parse\n");
+        return 1;
+    }
+    remap_init();
+
+    if (capture != NULL)
+    {
+        load_capture(capture);
+    }
+    else
+    {
+        synthesize(motion, speed, sensor_hz, duration_ms, burst_ms, click_ms);
+    }
+
+    if (cost_rounds > 0)
+    {
+        decode_cost(cost_rounds);
+        return 0;
+    }
+
+    print_header();
+    fflush(stdout);
+
+    for (a = 0; a < nitvl; a++)
+        for (b = 0; b < nbint; b++)
+            for (l = 0; l < nloss; l++)
+                for (p = 0; p < npackets; p++)
+                {
+                    pid_t pid;
+                    int status;
+
+                    cfg = (struct config){
+                        .itvl_ms = itvls[a],
+                        .binterval = (int)bintervals[b] > 0 ? (int)bintervals[b] : 1,
+                        .loss = losses[l],
+                        .packets = (int)packets[p] > 0 ? (int)packets[p] : 1,
+                    };
+
+                    pid = fork();
+                    if (pid < 0)
+                    {
+                        perror("fork");
+                        return 1;
+                    }
+                    if (pid == 0)
+                    {
+#if CONFIG_DONGLE_TRACE
+                        if (opt.trace_path != NULL)
+                        {
+                            trace_open(opt.trace_path);
+                        }
+#endif
+                        run();
+#if CONFIG_DONGLE_TRACE
+                        trace_close();
+#endif
+                        fflush(stdout);
+                        _exit(opt.check && !check_result() ? CHECK_FAILED : 0);
+                    }
+
+                    waitpid(pid, &status, 0);
+                    if (WIFEXITED(status) && WEXITSTATUS(status) == CHECK_FAILED)
+                    {
+                        failed++;
+                    }
+                    else if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+                    {
+                        fprintf(stderr, "configuration failed\n");
+                        return 1;
+                    }
+                    /* Only the first configuration is traced. */
+                    opt.trace_path = NULL;
+                }
+
+    if (failed > 0)
+    {
+        fprintf(stderr, "%d configuration%s failed the checks\n", failed, failed > 1 ? "s" : "");
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,124 @@
+#!/usr/bin/env python3
+#
+# Converts a trace stream recorded from the dongle console ("trace stream",
+# format in main/trace.h) to Chrome trace JSON, for chrome://tracing or
+# https://ui.perfetto.dev.  Trace point names are read from main/trace.h so
+# the two can't drift apart.
+
+import argparse
+import json
+import os
+import re
+import struct
+import sys
+
+HEADER = struct.Struct('<8sHHHH')
+EVENT = struct.Struct('<IBBBB')
+
+MAGIC = b'DNGLTRC\0'
+VERSION = 2
+TASK_NAME_LEN = 16
+TASK_NAME = 0xFF
+
+PHASE_MASK = 0x03
+PHASES = {0: 'B', 1: 'E', 2: 'i'}
+CORE1 = 0x80
+LOST = 0x40
+
+
+def read_points(trace_h):
+    with open(trace_h) as f:
+        return re.findall(r'X\((\w+),\s*"([^"]+)"\)', f.read())
+
+
+def thread_name(data, offset, tid):
+    name = data[offset:offset + TASK_NAME_LEN].split(b'\0', 1)[0]
+    return {'name': 'thread_name', 'ph': 'M', 'pid': 1, 'tid': tid,
+            'args': {'name': name.decode(errors='replace')}}
+
+
+def convert(data, points):
+    magic, version, record_len, task_count, _ = HEADER.unpack_from(data)
+    if magic != MAGIC or version != VERSION:
+        raise ValueError('not a version %d trace stream' % VERSION)
+
+    offset = HEADER.size
+    events = [{'name': 'process_name', 'ph': 'M', 'pid': 1, 'args': {'name': 'dongle'}}]
+    for tid in range(task_count):
+        events.append(thread_name(data, offset, tid))
+        offset += TASK_NAME_LEN
+
+    # Timestamps are the low 32 bits of a microsecond clock.
+    base = None
+    last = 0
+    wraps = 0
+    # Begins still open per task and point; ends without one are dropped,
+    # their begin was overwritten on the device.
+    open_count = {}
+
+    while offset + record_len <= len(data):
+        ts, point, phase, task, arg = EVENT.unpack_from(data, offset)
+        offset += record_len
+
+        # A task created after the header, named before its first event.
+        if point == TASK_NAME:
+            events.append(thread_name(data, offset, task))
+            offset += TASK_NAME_LEN
+            continue
+
+        if base is not None and ts < last:
+            wraps += 1
+        last = ts
+        ts += wraps << 32
+        if base is None:
+            base = ts
+        ts -= base
+
+        if phase & LOST:
+            events.append({'name': 'events lost', 'ph': 'i', 's': 'g', 'ts': ts, 'pid': 1,
+                           'tid': task})
+
+        ph = PHASES.get(phase & PHASE_MASK)
+        if ph is None or point >= len(points):
+            continue
+
+        key = (task, point)
+        if ph == 'B':
+            open_count[key] = open_count.get(key, 0) + 1
+        elif ph == 'E':
+            if open_count.get(key, 0) == 0:
+                continue
+            open_count[key] -= 1
+
+        ev = {'name': points[point][1], 'ph': ph, 'ts': ts, 'pid': 1, 'tid': task,
+              'args': {'arg': arg, 'core': 1 if phase & CORE1 else 0}}
+        if ph == 'i':
+            ev['s'] = 't'
+        events.append(ev)
+
+    return {'traceEvents': events, 'displayTimeUnit': 'ms'}
+
+
+def main():
+    here = os.path.dirname(os.path.abspath(__file__))
+    parser = argparse.ArgumentParser()
+    parser.add_argument('input', help='binary trace stream')
+    parser.add_argument('-o', '--out', help='JSON output, stdout by default')
+    parser.add_argument('--trace-h', default=os.path.join(here, '..', 'main', 'trace.h'),
+                        help='trace.h with the TRACE_POINTS list')
+    args = parser.parse_args()
+
+    with open(args.input, 'rb') as f:
+        data = f.read()
+
+    trace = convert(data, read_points(args.trace_h))
+
+    if args.out:
+        with open(args.out, 'w') as f:
+            json.dump(trace, f)
+    else:
+        json.dump(trace, sys.stdout)
+
+
+if __name__ == '__main__':
+    main()